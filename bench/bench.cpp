@@ -0,0 +1,184 @@
+#include "syntactic.hpp"
+#include "semantic.hpp"
+
+#include <charconv>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+
+/** Measures how compilation phases scale with source size over synthetic programs, so quadratic passes become visible.
+Usage: bench [lines...] [--workload NAME]... (defaults to 1000 10000 100000 1000000 lines of every workload).*/
+
+/** Generates synthetic source of (roughly) specified number of lines.*/
+struct Workload {
+    string name;
+    function< void( ostream &, size_t ) > generate;
+};
+
+const vector< Workload > Workloads = {
+    //single long chain of dependent arithmetic expressions (constants differ within line since equal TERMs are merged):
+    { "arithmetic", []( ostream & o, const size_t lines ) {
+        o << "v0 = 1" << endl;
+        for ( size_t i = 1; i < lines; ++ i )
+            o << "v" << i << " = v" << i - 1 << " * 3 + " << i + 3 << " - v" << i - 1 << " / 2" << endl;
+    } },
+    //many inputs declared at once and consumed by sums:
+    { "inputs", []( ostream & o, const size_t lines ) {
+        const size_t Width = 64;
+        for ( size_t i = 0; i < lines; i += 2 ) {
+            o << "inputs";
+            for ( size_t w = 0; w < Width; ++ w )
+                o << " a" << i << "_" << w;
+            o << endl;
+            o << "s" << i << " = a" << i << "_0 + a" << i << "_" << Width - 1 << endl;
+        }
+    } },
+    //statements nested into each other with deep indentation (every one is assigned, so the program passes semantic analysis as well):
+    { "entities", []( ostream & o, const size_t lines ) {
+        const size_t Depth = 16;
+        for ( size_t i = 0; i < lines; ) {
+            for ( size_t d = 0; d < Depth && i < lines; ++ d, ++ i ) {
+                o << string( d * 4, ' ' ) << "e" << i << " = ";
+                if ( d == 0 )
+                    o << i + 1 << endl;
+                else
+                    o << "e" << i - 1 << " + " << i + 1 << endl;
+            }
+            if ( i < lines ) {
+                o << string( Depth * 4, ' ' ) << "x" << i << " = e" << i - 1 << " + " << i + 1 << endl;
+                ++ i;
+            }
+        }
+    } },
+    //expressions interleaved with single-line and multiline comments:
+    { "comments", []( ostream & o, const size_t lines ) {
+        for ( size_t i = 0; i < lines; i += 6 ) {
+            o << "// single line comment number " << i << endl;
+            o << "/** multiline comment" << endl;
+            o << "    spanning several lines" << endl;
+            o << "*/" << endl;
+            o << "c" << i << " = " << i << " // trailing comment" << endl;
+            o << "d" << i << " = c" << i << " /* inline */ + 1" << endl;
+        }
+    } },
+    //conditional expressions nested into assignments, deciding between constants by unknown inputs:
+    { "conditionals", []( ostream & o, const size_t lines ) {
+        for ( size_t i = 0; i < lines; i += 5 ) {
+            o << "inputs bird" << i << endl;
+            o << "n" << i << " = " << i + 1 << endl;
+            o << "    opened" << i << " = n" << i << " + " << i + 2 << endl;
+            o << "    closed" << i << " = n" << i << " + " << i + 3 << endl;
+            o << "    door" << i << " <- if bird" << i << " then opened" << i << " else closed" << i << endl;
+        }
+    } },
+};
+
+/** Counts graph nodes reachable from root.*/
+size_t count_nodes( Node * root ) {
+    size_t nodes = 0;
+    pulse( root, [&]( Node * ) { ++ nodes; } );
+    return nodes;
+}
+
+void report( const string & phase, const double seconds, const size_t lines, const size_t nodes ) {
+    cout << "    " << left << setw( 28 ) << phase << right
+        << setw( 10 ) << fixed << setprecision( 4 ) << seconds << " s"
+        << setw( 14 ) << setprecision( 0 ) << lines / max( seconds, 1e-9 ) << " lines/s"
+        << setw( 14 ) << nodes / max( seconds, 1e-9 ) << " nodes/s" << endl;
+}
+
+/** Only the first line of (probably huge) error description.*/
+string headline( const string & error ) {
+    return error.substr( 0, error.find( '\n' ) );
+}
+
+void run( const Workload & workload, const size_t lines ) {
+    stringstream source;
+    workload.generate( source, lines );
+    cout << workload.name << ", " << lines << " lines:" << endl;
+
+    Stats stats;
+    StatsScope scope( & stats );
+    const auto start = chrono::steady_clock::now();
+    Node * root = nullptr;
+    //semantic analysis doesn't support everything front-end does, but timings of all the completed phases are still reported:
+    try {
+        root = parse_source( source, workload.name + ".rcl" );
+        semantic( root );
+    }
+    catch ( const exception & e ) {
+        cout << "    FAILED: " << headline( e.what() ) << endl;
+    }
+    const auto total = chrono::duration< double >( chrono::steady_clock::now() - start ).count();
+
+    const size_t nodes = root ? count_nodes( root ) : 0;
+    //every phase is measured against the graph it worked over, which shrinks and grows between phases:
+    for ( const auto & phase : stats.phase_times() )
+        report( phase.name, phase.seconds, lines, phase.nodes );
+    report( "total", total, lines, nodes );
+    cout << "    " << nodes << " nodes, " << stats.nodes_created << " created, " << stats.edges_added << " edges added" << endl;
+    if ( root )
+        destroy_graph( root );
+}
+
+void print_usage( ostream & out ) {
+    out << "Usage: bench [lines...] [--workload NAME]..." << endl;
+    out << "    lines              positive numbers of lines of generated sources (default: 1000 10000 100000 1000000)" << endl;
+    out << "    --workload NAME    run only specified workloads (default: all of them):";
+    for ( const auto & workload : Workloads )
+        out << " " << workload.name;
+    out << endl;
+}
+
+/** Returns false if arguments are malformed.*/
+bool parse_arguments( const int argc, char * argv[], vector< size_t > & sizes, vector< Workload > & selected ) {
+    for ( int i = 1; i < argc; ++ i ) {
+        const string arg = argv[ i ];
+        if ( arg == "--workload" ) {
+            if ( ++ i >= argc )
+                return false;
+            const string name = argv[ i ];
+            const auto found = find_if( Workloads.begin(), Workloads.end(), [&]( const Workload & workload ) { return workload.name == name; } );
+            if ( found == Workloads.end() ) {
+                cerr << "ERROR: unknown workload " << name << endl;
+                return false;
+            }
+            selected.push_back( * found );
+            continue;
+        }
+        size_t lines = 0;
+        const auto end = arg.data() + arg.size();
+        const auto [ ptr, error ] = from_chars( arg.data(), end, lines );
+        if ( error != errc() || ptr != end || lines == 0 ) {
+            cerr << "ERROR: malformed number of lines " << arg << endl;
+            return false;
+        }
+        sizes.push_back( lines );
+    }
+    return true;
+}
+
+int main( int argc, char * argv[] ) {
+    vector< size_t > sizes;
+    vector< Workload > selected;
+    if ( ! parse_arguments( argc, argv, sizes, selected ) ) {
+        print_usage( cerr );
+        return 2;
+    }
+    if ( sizes.empty() )
+        sizes = { 1000, 10000, 100000, 1000000 };
+    if ( selected.empty() )
+        selected = Workloads;
+
+    //errors are reported per workload, so traces would only clutter the report:
+    ostream discard( nullptr );
+    trace_sink().redirect( discard );
+
+    for ( const auto & workload : selected ) {
+        for ( const auto size : sizes )
+            run( workload, size );
+    }
+    trace_sink().redirect( cout );
+    return 0;
+}
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+Binary files made of arrays of plain records (sections) which are used in place once the file is memory-mapped, so loading doesn't deserialize anything:
+    BinaryHeader
+    BinarySection[ sections ]
+    section 0 records (aligned to 8 bytes)
+    ...
+Records are stored in native byte order, so files aren't portable among machines of different endianness (which is checked on load).
+*/
+struct BinaryHeader {
+    /** Identifies the format of file, zero-padded.*/
+    char magic[ 8 ];
+    uint32_t version;
+    /** Written as ByteOrder: reads differently on machine of another endianness.*/
+    uint32_t byte_order;
+    uint32_t sections;
+    uint32_t reserved = 0;
+
+    static constexpr uint32_t ByteOrder = 0x01020304;
+};
+struct BinarySection {
+    /** From the beginning of file.*/
+    uint64_t offset;
+    /** Number of records.*/
+    uint64_t count;
+};
+static_assert( sizeof( BinaryHeader ) == 24 && sizeof( BinarySection ) == 16 );
+
+/** Alignment of every section, so records up to 8 bytes alignment might be used in place.*/
+constexpr size_t BinaryAlignment = 8;
+
+/** Assembles binary file in memory section by section.*/
+struct BinaryWriter {
+    BinaryWriter( const string & magic, const uint32_t version, const uint32_t sections ): sections( sections ) {
+        if ( magic.size() > sizeof( BinaryHeader::magic ) )
+            throw runtime_error( "ERROR: binary magic is too long" );
+        BinaryHeader header{};
+        memcpy( header.magic, magic.data(), magic.size() );
+        header.version = version;
+        header.byte_order = BinaryHeader::ByteOrder;
+        header.sections = sections;
+        buffer.append( reinterpret_cast< const char * >( & header ), sizeof( header ) );
+        buffer.resize( buffer.size() + sections * sizeof( BinarySection ), 0 );
+    }
+
+    template< typename Record >
+    void section( const uint32_t index, const Record * records, const size_t count ) {
+        static_assert( is_trivially_copyable_v< Record > && alignof( Record ) <= BinaryAlignment );
+        if ( index >= sections )
+            throw out_of_range( "BinaryWriter::section(): no such section" );
+        buffer.resize( ( buffer.size() + BinaryAlignment - 1 ) / BinaryAlignment * BinaryAlignment, 0 );
+        const BinarySection desc{ buffer.size(), count };
+        memcpy( buffer.data() + sizeof( BinaryHeader ) + index * sizeof( BinarySection ), & desc, sizeof( desc ) );
+        buffer.append( reinterpret_cast< const char * >( records ), count * sizeof( Record ) );
+    }
+    template< typename Record >
+    void section( const uint32_t index, const vector< Record > & records ) {
+        section( index, records.data(), records.size() );
+    }
+
+    /** Writes into temporary file of it's own (within the same directory) first and renames it then, so readers never map partially written file, while concurrent writers of the same path never write into the same temporary file.*/
+    void save( const string & path ) const {
+        string temporary = path + ".XXXXXX";
+        const int fd = mkstemp( temporary.data() );
+        if ( fd < 0 )
+            throw runtime_error( string( "ERROR: cannot create temporary file for " ) + path );
+        bool written = fchmod( fd, 0644 ) == 0;
+        for ( size_t offset = 0; written && offset < buffer.size(); ) {
+            const auto chunk = ::write( fd, buffer.data() + offset, buffer.size() - offset );
+            if ( chunk < 0 && errno == EINTR )
+                continue;
+            written = chunk > 0;
+            offset += written ? size_t( chunk ) : 0;
+        }
+        written = close( fd ) == 0 && written;
+        if ( ! written ) {
+            unlink( temporary.c_str() );
+            throw runtime_error( string( "ERROR: cannot write " ) + temporary );
+        }
+        error_code error;
+        filesystem::rename( temporary, path, error );
+        if ( error ) {
+            unlink( temporary.c_str() );
+            throw runtime_error( string( "ERROR: cannot rename " ) + temporary + " to " + path + ": " + error.message() );
+        }
+    }
+
+    const string & bytes() const {
+        return buffer;
+    }
+
+private:
+    const uint32_t sections;
+    string buffer;
+};
+
+/** Read-only memory mapping of binary file written by BinaryWriter. Throws runtime_error if file cannot be mapped or isn't of expected format and version.*/
+struct BinaryFile {
+    BinaryFile( const string & path, const string & magic, const uint32_t version, const uint32_t sections ): path( path ) {
+        const int fd = open( path.c_str(), O_RDONLY | O_CLOEXEC );
+        if ( fd < 0 )
+            throw runtime_error( string( "ERROR: cannot open " ) + path );
+        struct stat st;
+        if ( fstat( fd, & st ) != 0 || size_t( st.st_size ) < sizeof( BinaryHeader ) ) {
+            close( fd );
+            throw runtime_error( string( "ERROR: " ) + path + " is too short" );
+        }
+        length = st.st_size;
+        void * mapped = mmap( nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0 );
+        close( fd );
+        if ( mapped == MAP_FAILED )
+            throw runtime_error( string( "ERROR: cannot map " ) + path );
+        data = static_cast< const char * >( mapped );
+
+        try {
+            const auto & header = * reinterpret_cast< const BinaryHeader * >( data );
+            if ( strncmp( header.magic, magic.c_str(), sizeof( header.magic ) ) != 0 )
+                fail( "isn't of expected format" );
+            if ( header.byte_order != BinaryHeader::ByteOrder )
+                fail( "was written on machine of another endianness" );
+            if ( header.version != version )
+                fail( "is of version " + to_string( header.version ) + " while " + to_string( version ) + " is expected" );
+            if ( header.sections != sections || length < sizeof( BinaryHeader ) + sections * sizeof( BinarySection ) )
+                fail( "has unexpected number of sections" );
+            table = reinterpret_cast< const BinarySection * >( data + sizeof( BinaryHeader ) );
+        }
+        catch ( ... ) {
+            munmap( const_cast< char * >( data ), length );
+            throw;
+        }
+    }
+    BinaryFile( const BinaryFile & ) = delete;
+    BinaryFile & operator =( const BinaryFile & ) = delete;
+    ~BinaryFile() {
+        munmap( const_cast< char * >( data ), length );
+    }
+
+    /** Records of section right within the mapping.*/
+    template< typename Record >
+    span< const Record > section( const uint32_t index ) const {
+        static_assert( is_trivially_copyable_v< Record > && alignof( Record ) <= BinaryAlignment );
+        const auto & desc = table[ index ];
+        if ( desc.count == 0 )
+            return {};
+        if ( desc.offset % BinaryAlignment != 0 || desc.offset > length || desc.count > ( length - desc.offset ) / sizeof( Record ) )
+            fail( "has section " + to_string( index ) + " out of bounds" );
+        return { reinterpret_cast< const Record * >( data + desc.offset ), desc.count };
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    const string path;
+    const char * data = nullptr;
+    size_t length = 0;
+    const BinarySection * table = nullptr;
+
+    [[noreturn]] void fail( const string & reason ) const {
+        throw runtime_error( "ERROR: " + path + " " + reason );
+    }
+};
+
+/** Interns strings, so every distinct one is stored once and referred by index.*/
+struct SymbolTable {
+    uint32_t intern( const string & symbol ) {
+        const auto found = index.find( symbol );
+        if ( found != index.end() )
+            return found->second;
+        const uint32_t interned = offsets.size() - 1;
+        index.emplace( symbol, interned );
+        chars += symbol;
+        offsets.push_back( chars.size() );
+        return interned;
+    }
+
+    /** Writes offsets (one more than symbols) and characters of all the symbols.*/
+    void write( BinaryWriter & writer, const uint32_t offsets_section, const uint32_t chars_section ) const {
+        writer.section( offsets_section, offsets );
+        writer.section( chars_section, chars.data(), chars.size() );
+    }
+
+private:
+    unordered_map< string, uint32_t > index;
+    vector< uint32_t > offsets = { 0 };
+    string chars;
+};
+
+/** Symbols written by SymbolTable within mapped BinaryFile.*/
+struct SymbolsView {
+    SymbolsView( const BinaryFile & file, const uint32_t offsets_section, const uint32_t chars_section ):
+        offsets( file.section< uint32_t >( offsets_section ) ),
+        chars( file.section< char >( chars_section ) )
+    {
+        if ( offsets.empty() )
+            throw runtime_error( "ERROR: binary symbols have no offsets" );
+        for ( size_t i = 1; i < offsets.size(); ++ i ) {
+            if ( offsets[ i ] < offsets[ i - 1 ] || offsets[ i ] > chars.size() )
+                throw runtime_error( "ERROR: binary symbols are malformed" );
+        }
+    }
+
+    size_t size() const {
+        return offsets.size() - 1;
+    }
+    string_view operator []( const uint32_t symbol ) const {
+        if ( symbol >= size() )
+            throw out_of_range( "SymbolsView: no such symbol" );
+        return { chars.data() + offsets[ symbol ], offsets[ symbol + 1 ] - offsets[ symbol ] };
+    }
+
+private:
+    span< const uint32_t > offsets;
+    span< const char > chars;
+};
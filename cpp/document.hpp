@@ -0,0 +1,355 @@
+#pragma once
+
+#include "syntactic.hpp"
+#include "position_index.hpp"
+
+#include <unordered_map>
+
+/** Replaces lines of Document.*/
+struct LineEdit {
+    /** First replaced line, 1-based numbered as it is in text editors. Lines are inserted before it if nothing is removed.*/
+    int32_t line;
+    /** Number of replaced lines.*/
+    int32_t removed = 0;
+    vector< string > inserted;
+};
+
+/**
+Single source file kept parsed (as parse_source() does) while it's being edited: only the statements touched by edits are parsed again.
+Source is split into blocks: every line without indentation (once comments are removed) starts the next block, while indented, empty and commented out lines continue the previous one. Nothing is matched across blocks (statements continue onto the following lines only if those are indented), so every block is parsed on it's own and spliced into the file's graph then.
+The graph must not be changed by anyone else (i.e. with merge_occurences()), since Document deletes nodes of every block it parses again.
+Lines of nodes are numbered within their blocks (the first line of block is 1), so inserted and removed lines move just the blocks following them rather than renumbering all their nodes: position() resolves where node actually is, while clone() copies the whole graph positioned as parse_source() positions it.
+Nodes of every block are kept within PositionIndex of the block along the way, so nodes at any position are looked up without traversing the graph.
+*/
+struct Document {
+    Document( const string & file_name, const string & text, ThreadPool & pool = default_pool() ): file_name( file_name ), pool( pool ) {
+        istringstream source( text );
+        string line;
+        while ( getline( source, line ) )
+            texts.push_back( line );
+        in_comment.assign( texts.size() + 1, false );
+
+        file_node = new Node(
+            file_name,
+            TYPE::SOURCE_FILE,
+            SourcePos( 0, 0, 0, file_name )
+        );
+        try {
+            reparse( 0, 0, 0 );
+        }
+        catch ( ... ) {
+            destroy();
+            throw;
+        }
+    }
+    Document( const Document & ) = delete;
+    Document & operator =( const Document & ) = delete;
+    ~Document() {
+        destroy();
+    }
+
+    /** SOURCE_FILE of the whole graph. Nodes are positioned within their blocks (see position()).*/
+    Node * root() const {
+        return file_node;
+    }
+    /** Copy of the whole graph with every node positioned where it is within the text.
+    @param copies receives copies by nodes of the graph if specified.*/
+    Node * clone( map< Node *, Node * > * copies = nullptr ) const {
+        map< Node *, Node * > local;
+        auto & copy_of = copies == nullptr ? local : * copies;
+        auto copy = clone_graph( file_node, & copy_of );
+        for ( const auto & [ node, copied ] : copy_of )
+            copied->source_pos = position( node );
+        return copy;
+    }
+    /** Where node of the graph is within the text.*/
+    SourcePos position( Node * node ) const {
+        auto result = node->source_pos;
+        const auto owner = owners.find( node );
+        if ( owner != owners.end() )
+            result.line += owner->second->first;
+        return result;
+    }
+    /** Malformed block which is left out of the graph until it's edited.*/
+    struct Error {
+        /** Lines [first, end) of text, 0-based.*/
+        int32_t first;
+        int32_t end;
+        string message;
+    };
+    vector< Error > errors() const {
+        vector< Error > result;
+        for ( const auto & block : blocks ) {
+            if ( ! block->error.empty() )
+                result.push_back( { block->first, block->end, block->error } );
+        }
+        return result;
+    }
+
+    /** Nodes spanning specified character (1-based numbered as it is in text editors) in syntactic order.*/
+    vector< Node * > at( const int32_t line, const int32_t column ) const {
+        if ( blocks.empty() || line < 1 )
+            return {};
+        const auto & block = * blocks[ block_of( line - 1 ) ];
+        if ( line - 1 < block.first || line - 1 >= block.end )
+            return {};
+        return block.index.at( file_name, line - block.first, column );
+    }
+    size_t lines() const {
+        return texts.size();
+    }
+    /** Line of text, 0-based.*/
+    const string & line( const size_t index ) const {
+        return texts.at( index );
+    }
+    string text() const {
+        string result;
+        for ( const auto & line : texts )
+            result += line + "\n";
+        return result;
+    }
+
+    /** Applies edits one by one (so every edit is positioned within the text changed by previous ones). Throws out_of_range if edit is out of text or runtime_error if edited source is malformed (graph is left without malformed block then).*/
+    void edit( const vector< LineEdit > & edits ) {
+        for ( const auto & e : edits )
+            edit( e );
+    }
+    void edit( const LineEdit & e ) {
+        const int32_t first = e.line - 1;
+        if ( first < 0 || e.removed < 0 || first + e.removed > int32_t( texts.size() ) )
+            throw out_of_range( "Document::edit(): lines out of text" );
+
+        //block of the line before the edit is parsed again as well, since inserted lines might continue it:
+        const auto from = block_of( max( 0, first - 1 ) );
+        const auto to = e.removed > 0 ? block_of( first + e.removed - 1 ) + 1 : from + 1;
+        const int32_t start = blocks.empty() ? 0 : blocks[ from ]->first;
+        const int32_t old_end = blocks.empty() ? 0 : blocks[ to - 1 ]->end;
+
+        texts.erase( texts.begin() + first, texts.begin() + first + e.removed );
+        texts.insert( texts.begin() + first, e.inserted.begin(), e.inserted.end() );
+        //the first line after the edit keeps comment state it was parsed within, so it's known whether it has to be parsed again:
+        in_comment.erase( in_comment.begin() + first, in_comment.begin() + first + e.removed );
+        in_comment.insert( in_comment.begin() + first, e.inserted.size(), false );
+
+        //nodes are positioned within their blocks, so the following blocks are moved as they are:
+        const int32_t delta = int32_t( e.inserted.size() ) - e.removed;
+        for ( auto b = to; b < blocks.size(); ++ b ) {
+            blocks[ b ]->first += delta;
+            blocks[ b ]->end += delta;
+        }
+        reparse( from, to, old_end + delta, start );
+    }
+
+private:
+    /** Lines [first, end) of text, 0-based.*/
+    struct Block {
+        int32_t first = 0;
+        int32_t end = 0;
+        /** Nodes by their positions within the block.*/
+        PositionIndex index;
+        /** LINE nodes chained within the block.*/
+        Node * first_line = nullptr;
+        Node * last_line = nullptr;
+        /** TERMs and OPERATORs chained in syntactic order within the block.*/
+        Node * first_token = nullptr;
+        Node * last_token = nullptr;
+        /** Everything parsed from the block.*/
+        vector< Node * > nodes;
+        /** Why the block is left empty if it's malformed.*/
+        string error;
+    };
+
+    const string file_name;
+    ThreadPool & pool;
+    vector< string > texts;
+    /** Whether every line (and the end of text) starts within multiline comment.*/
+    vector< bool > in_comment;
+    /** Blocks stay where they are in memory, so nodes refer to them.*/
+    vector< unique_ptr< Block > > blocks;
+    /** Block of every node besides file_node.*/
+    unordered_map< Node *, const Block * > owners;
+    Node * file_node = nullptr;
+
+    /** Index of block containing specified line.*/
+    size_t block_of( const int32_t line ) const {
+        const auto found = upper_bound( blocks.begin(), blocks.end(), line, []( const int32_t l, const unique_ptr< Block > & b ) { return l < b->first; } );
+        return found == blocks.begin() ? 0 : found - blocks.begin() - 1;
+    }
+
+    /** Deletes all the nodes of block.*/
+    void release( Block & block ) {
+        for ( auto node : block.nodes ) {
+            owners.erase( node );
+            delete node;
+        }
+        block.nodes.clear();
+        block.index = PositionIndex();
+    }
+
+    void destroy() {
+        for ( auto & block : blocks ) {
+            for ( auto node : block->nodes )
+                delete node;
+        }
+        blocks.clear();
+        owners.clear();
+        delete file_node;
+        file_node = nullptr;
+    }
+
+    /** Parses blocks [from, to) again, starting from specified line at least up to the line end: parsing goes on up to the start of the first block which starts within the same comment state as it did.*/
+    void reparse( const size_t from, size_t to, int32_t end, const int32_t start = 0 ) {
+        for ( auto b = from; b < to; ++ b )
+            release( * blocks[ b ] );
+
+        vector< Node * > lines;
+        vector< int32_t > block_starts = { start };
+        bool multiline = in_comment[ start ];
+        int32_t line = start;
+        for ( ; line < int32_t( texts.size() ); ++ line ) {
+            if ( line >= end && to < blocks.size() ) {
+                if ( multiline == in_comment[ line ] )
+                    break;
+                //the following block is commented out (or in) differently now:
+                release( * blocks[ to ] );
+                end = blocks[ to ]->end;
+                ++ to;
+            }
+            in_comment[ line ] = multiline;
+
+            const auto & text = texts[ line ];
+            if ( only_whitespace( text ) )
+                continue;
+            string content = text;
+            SourcePos source_pos( line + 1, 1, text.size(), file_name );
+            if ( ! strip_comments( content, source_pos, multiline ) || only_whitespace( content ) )
+                continue;
+            if ( line > start && ! isspace( content.front() ) )
+                block_starts.push_back( line );
+            lines.push_back( new Node( content, TYPE::LINE, source_pos ) );
+        }
+        in_comment[ line ] = multiline;
+
+        //malformed blocks are left empty, so they're parsed again once edited:
+        exception_ptr error;
+        vector< unique_ptr< Block > > parsed;
+        size_t next_line = 0;
+        for ( size_t b = 0; b < block_starts.size(); ++ b ) {
+            parsed.push_back( make_unique< Block >() );
+            auto & block = * parsed.back();
+            block.first = block_starts[ b ];
+            block.end = b + 1 < block_starts.size() ? block_starts[ b + 1 ] : line;
+            vector< Node * > block_lines;
+            while ( next_line < lines.size() && lines[ next_line ]->source_pos.line - 1 < block.end )
+                block_lines.push_back( lines[ next_line ++ ] );
+            try {
+                parse_block( block, block_lines );
+            }
+            catch ( const exception & e ) {
+                block.error = e.what();
+                if ( ! error )
+                    error = current_exception();
+            }
+            catch ( ... ) {
+                block.error = "ERROR: malformed statement";
+                if ( ! error )
+                    error = current_exception();
+            }
+        }
+
+        blocks.erase( blocks.begin() + from, blocks.begin() + to );
+        blocks.insert( blocks.begin() + from, make_move_iterator( parsed.begin() ), make_move_iterator( parsed.end() ) );
+        relink( from, from + parsed.size() );
+        if ( error )
+            rethrow_exception( error );
+    }
+
+    /** Parses lines of single block on it's own SOURCE_FILE (which is deleted then), so every pass touches only the block.*/
+    void parse_block( Block & block, const vector< Node * > & lines ) {
+        auto block_file = new Node( file_name, TYPE::SOURCE_FILE, SourcePos( 0, 0, 0, file_name ) );
+        Node * previous = block_file;
+        for ( auto line : lines ) {
+            previous->ref( line );
+            previous = line;
+        }
+        try {
+            parse_includes( block_file );
+            map< Node *, FileCache > cache;
+            lex( block_file, cache, pool );
+            chain_terms_and_operators( cache );
+            match_semantics( cache );
+            merge_ifs( block_file );
+            match_right_all( block_file );
+        }
+        catch ( ... ) {
+            destroy_graph( block_file );
+            throw;
+        }
+
+        pulse( block_file, [&]( Node * node ) {
+            if ( node != block_file )
+                block.nodes.push_back( node );
+        } );
+        block.first_line = block_file->child( TYPE::LINE );
+        if ( block.first_line != nullptr ) {
+            block.last_line = block.first_line;
+            while ( auto next = block.last_line->child( TYPE::LINE ) )
+                block.last_line = next;
+        }
+        for ( auto ref : block_file->refs ) {
+            if ( ref->type( set{ TYPE::TERM, TYPE::OPERATOR } ) )
+                block.first_token = ref;
+        }
+        if ( block.first_token != nullptr ) {
+            block.last_token = block.first_token;
+            while ( auto next = find_types( block.last_token->refs, vector{ TYPE::TERM, TYPE::OPERATOR } ) )
+                block.last_token = next;
+        }
+        //INCLUDEs move to the file:
+        for ( auto ref : block_file->refs ) {
+            if ( ref->type( TYPE::INCLUDE ) )
+                file_node->ref( ref );
+        }
+        delete block_file;
+        //parsed positioned within the text, so errors tell where they are:
+        for ( auto node : block.nodes ) {
+            node->source_pos.line -= block.first;
+            block.index.insert( node );
+            owners.emplace( node, & block );
+        }
+    }
+
+    /** Chains LINEs and tokens of blocks [from, to) with the blocks around, as if the whole file was parsed at once.*/
+    void relink( const size_t from, const size_t to ) {
+        const auto & chain = [&]( Node * Block::* first, Node * Block::* last ) {
+            //the closest ends around, which were chained directly to each other if there was nothing in between:
+            Node * before = file_node;
+            for ( auto b = from; b > 0; -- b ) {
+                if ( blocks[ b - 1 ].get()->*last != nullptr ) {
+                    before = blocks[ b - 1 ].get()->*last;
+                    break;
+                }
+            }
+            Node * after = nullptr;
+            for ( auto b = to; b < blocks.size(); ++ b ) {
+                if ( blocks[ b ].get()->*first != nullptr ) {
+                    after = blocks[ b ].get()->*first;
+                    break;
+                }
+            }
+            Node * caret = before;
+            for ( auto b = from; b < to; ++ b ) {
+                if ( blocks[ b ].get()->*first == nullptr )
+                    continue;
+                if ( caret == before && after != nullptr )
+                    before->unref( after );
+                caret->ref( blocks[ b ].get()->*first );
+                caret = blocks[ b ].get()->*last;
+            }
+            if ( after != nullptr )
+                caret->ref( after );
+        };
+        chain( & Block::first_line, & Block::last_line );
+        chain( & Block::first_token, & Block::last_token );
+    }
+};
@@ -0,0 +1,276 @@
+#pragma once
+
+#include "binary.hpp"
+#include "syntactic.hpp"
+#include "semantic.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+/**
+Precompiled graph file: the whole graph parsed from some source along with all the files it includes, so unchanged sources skip parsing altogether. Used right within the mapped file (see BinaryFile) while the graph is rebuilt.
+*/
+struct GraphFormat {
+    static constexpr const char * Magic = "RCLGRAPH";
+    static constexpr uint32_t Version = 1;
+
+    enum SECTION : uint32_t {
+        /** Interned contents and file names of nodes (see SymbolTable).*/
+        SYMBOL_OFFSETS,
+        SYMBOL_CHARS,
+        /** Included files the graph was parsed from besides the source itself.*/
+        DEPENDENCIES,
+        /** The source's SOURCE_FILE goes first.*/
+        NODES,
+        /** Refs of all the nodes as indices of nodes.*/
+        EDGES,
+        SECTIONS,
+    };
+
+    struct Dependency {
+        uint32_t path;
+        uint32_t reserved;
+        uint64_t hash;
+    };
+    struct Node {
+        uint32_t content;
+        uint32_t file;
+        int32_t line;
+        int32_t char_start;
+        int32_t char_end;
+        /** Bit per TYPE.*/
+        uint32_t types;
+        /** MEMORY the node was accounted within.*/
+        uint32_t memory;
+        /** Range within EDGES.*/
+        uint32_t refs_begin;
+        uint32_t refs_end;
+    };
+};
+
+/** Graphs parsed with another set of operators (or their properties) are different graphs.*/
+inline uint64_t operators_hash() {
+    static const uint64_t hash = []{
+        ostringstream table;
+        for ( const auto & desc : OperatorsDesc )
+            table << desc.text << " " << desc.operand << " " << desc.nonabelian << "\n";
+        return content_hash( table.str() );
+    }();
+    return hash;
+}
+
+/** Reads the whole file. Returns false if it cannot be read.*/
+inline bool read_file( const string & file_name, string & content ) {
+    ifstream file( file_name, ios::binary );
+    if ( ! file )
+        return false;
+    ostringstream buffer;
+    buffer << file.rdbuf();
+    content = buffer.str();
+    return true;
+}
+
+/** Name of cache file of graph parsed from source (of specified content) up to specified stage.*/
+inline string graph_cache_path( const string & cache_dir, const string & file_name, const string & source, const bool merged ) {
+    auto hash = content_hash( to_string( GraphFormat::Version ) + ( merged ? " merged " : " parsed " ) + to_string( operators_hash() ) );
+    hash = content_hash( filesystem::absolute( file_name ).lexically_normal().string() + '\0', hash );
+    hash = content_hash( source, hash );
+    ostringstream name;
+    name << hex << setw( 16 ) << setfill( '0' ) << hash << ".graph";
+    return ( filesystem::path( cache_dir ) / name.str() ).string();
+}
+
+/** Writes the whole graph reachable from root (which is restored as root then) into precompiled graph file along with contents hashes of all the files it includes.
+@param hashes of included files as they were parsed (see parse_program()): files might change since then.*/
+inline void save_graph( const string & path, Node * root, const map< string, uint64_t > & hashes ) {
+    using Format = GraphFormat;
+    SymbolTable symbols;
+    vector< Format::Dependency > dependencies;
+    vector< Node * > nodes;
+    unordered_map< Node *, uint32_t > indices;
+    pulse( root, [&]( Node * node ) {
+        indices.emplace( node, nodes.size() );
+        nodes.push_back( node );
+        if ( node != root && node->type( TYPE::SOURCE_FILE ) ) {
+            const auto hash = hashes.find( node->content );
+            if ( hash == hashes.end() )
+                throw runtime_error( "ERROR: content of included " + node->content + " wasn't hashed as it was parsed" );
+            dependencies.push_back( { symbols.intern( filesystem::absolute( node->content ).lexically_normal().string() ), 0, hash->second } );
+        }
+    } );
+    vector< Format::Node > records;
+    records.reserve( nodes.size() );
+    vector< uint32_t > edges;
+    for ( auto node : nodes ) {
+        uint32_t types = 0;
+        for ( const auto type : node->types )
+            types |= 1u << type;
+        Format::Node record{
+            symbols.intern( node->content ),
+            symbols.intern( node->source_pos.file ),
+            node->source_pos.line,
+            node->source_pos.char_start,
+            node->source_pos.char_end,
+            types,
+            uint32_t( node->memory ),
+            uint32_t( edges.size() ),
+            0,
+        };
+        for ( auto ref : node->refs )
+            edges.push_back( indices.at( ref ) );
+        record.refs_end = edges.size();
+        records.push_back( record );
+    }
+
+    BinaryWriter writer( Format::Magic, Format::Version, Format::SECTIONS );
+    symbols.write( writer, Format::SYMBOL_OFFSETS, Format::SYMBOL_CHARS );
+    writer.section( Format::DEPENDENCIES, dependencies );
+    writer.section( Format::NODES, records );
+    writer.section( Format::EDGES, edges );
+    writer.save( path );
+}
+
+/** Mapped precompiled graph file.*/
+struct GraphView {
+    using Format = GraphFormat;
+
+    BinaryFile file;
+    SymbolsView symbols;
+    span< const Format::Dependency > dependencies;
+    span< const Format::Node > nodes;
+    span< const uint32_t > edges;
+
+    GraphView( const string & path ):
+        file( path, Format::Magic, Format::Version, Format::SECTIONS ),
+        symbols( file, Format::SYMBOL_OFFSETS, Format::SYMBOL_CHARS ),
+        dependencies( file.section< Format::Dependency >( Format::DEPENDENCIES ) ),
+        nodes( file.section< Format::Node >( Format::NODES ) ),
+        edges( file.section< uint32_t >( Format::EDGES ) )
+    {
+        if ( nodes.empty() )
+            throw runtime_error( "ERROR: precompiled graph " + path + " has no nodes" );
+        for ( const auto & node : nodes ) {
+            if ( node.refs_begin > node.refs_end || node.refs_end > edges.size() || node.memory >= MemorySubsystems || node.types == 0 )
+                throw runtime_error( "ERROR: precompiled graph " + path + " has malformed node" );
+        }
+        for ( const auto edge : edges ) {
+            if ( edge >= nodes.size() )
+                throw runtime_error( "ERROR: precompiled graph " + path + " has edge out of bounds" );
+        }
+    }
+
+    /** Returns false if any of included files changed since the graph was stored.*/
+    bool up_to_date() const {
+        for ( const auto & dependency : dependencies ) {
+            string content;
+            if ( ! read_file( string( symbols[ dependency.path ] ), content ) || content_hash( content ) != dependency.hash )
+                return false;
+        }
+        return true;
+    }
+
+    /** Builds the stored graph. Returns it's root.*/
+    Node * load() const {
+        vector< Node * > loaded;
+        loaded.reserve( nodes.size() );
+        try {
+            for ( const auto & record : nodes ) {
+                //node is accounted within the same MEMORY it was created within:
+                optional< TYPE > created;
+                for ( uint32_t type = 0; type <= TYPE::NONABELIAN; ++ type ) {
+                    if ( ! ( record.types & ( 1u << type ) ) )
+                        continue;
+                    if ( ! created )
+                        created = TYPE( type );
+                    if ( Node::memory_of( TYPE( type ) ) == MEMORY( record.memory ) ) {
+                        created = TYPE( type );
+                        break;
+                    }
+                }
+                auto node = new Node(
+                    string( symbols[ record.content ] ),
+                    * created,
+                    SourcePos( record.line, record.char_start, record.char_end, string( symbols[ record.file ] ) )
+                );
+                loaded.push_back( node );
+                for ( uint32_t type = 0; type <= TYPE::NONABELIAN; ++ type ) {
+                    if ( record.types & ( 1u << type ) )
+                        node->types.insert( TYPE( type ) );
+                }
+            }
+        }
+        catch ( ... ) {
+            for ( auto node : loaded )
+                delete node;
+            throw;
+        }
+        for ( size_t i = 0; i < nodes.size(); ++ i ) {
+            for ( const auto ref : edges.subspan( nodes[ i ].refs_begin, nodes[ i ].refs_end - nodes[ i ].refs_begin ) )
+                loaded[ i ]->ref( loaded[ ref ] );
+        }
+        return loaded[ 0 ];
+    }
+};
+
+/** Parses source along with all the files it includes (see parse_program()) unless the same graph is found within cache_dir: the source, all of it's includes and the operators must be the same. Parsed graph is stored into cache_dir then.
+@param merged whether graph is cached (and returned) with all the occurences merged already (see merge_occurences()).*/
+inline Node * cached_parse_program( const string & file_name, const string & cache_dir, ThreadPool & pool = default_pool(), const bool merged = false ) {
+    string source;
+    if ( cache_dir.empty() || ! read_file( file_name, source ) ) {
+        auto root = parse_program( file_name, pool );
+        if ( root != nullptr && merged ) {
+            try {
+                merge_occurences( root );
+            }
+            catch ( ... ) {
+                destroy_graph( root );
+                throw;
+            }
+        }
+        return root;
+    }
+
+    const auto path = graph_cache_path( cache_dir, file_name, source, merged );
+    if ( filesystem::exists( path ) ) {
+        try {
+            Phase phase( "load_graph" );
+            GraphView view( path );
+            if ( view.up_to_date() ) {
+                count_stat( & Stats::graph_cache_hits );
+                TRACE( PARSER, INFO ) << "Precompiled graph of " << file_name << " is loaded from " << path;
+                return view.load();
+            }
+        }
+        catch ( const exception & e ) {
+            //stale format or broken file is just parsed again:
+            TRACE( PARSER, INFO ) << "Precompiled graph " << path << " is ignored: " << e.what();
+        }
+    }
+    count_stat( & Stats::graph_cache_misses );
+
+    istringstream stream( source );
+    map< string, uint64_t > hashes;
+    auto root = parse_program( stream, file_name, pool, & hashes );
+    if ( root == nullptr )
+        return root;
+    if ( merged ) {
+        try {
+            Phase phase( "merge_occurences" );
+            merge_occurences( root );
+        }
+        catch ( ... ) {
+            destroy_graph( root );
+            throw;
+        }
+    }
+    //failure to store the graph doesn't fail the compilation:
+    try {
+        Phase phase( "save_graph" );
+        filesystem::create_directories( cache_dir );
+        save_graph( path, root, hashes );
+    }
+    catch ( const exception & e ) {
+        TRACE( PARSER, ERROR ) << "ERROR: precompiled graph of " << file_name << " cannot be stored: " << e.what();
+    }
+    return root;
+}
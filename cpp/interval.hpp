@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <ostream>
+
+using namespace std;
+
+/** Closed range of values some node might take when it's exact value is unknown (like for yet unknown inputs). Constraints of strict comparisons keep their bounds (x > 0 constrains x to [0, inf]), so the range might be wider than the exact set of values, but never narrower.*/
+struct Interval {
+    double low = - numeric_limits< double >::infinity();
+    double high = numeric_limits< double >::infinity();
+
+    static Interval whole() {
+        return {};
+    }
+    static Interval point( const double value ) {
+        return { value, value };
+    }
+    /** Truth of comparison: [0,0] is false, [1,1] is true and [0,1] is undecidable.*/
+    static Interval truth( const bool can_be_false, const bool can_be_true ) {
+        return { can_be_false ? 0. : 1., can_be_true ? 1. : 0. };
+    }
+
+    bool is_empty() const {
+        return low > high;
+    }
+    bool is_whole() const {
+        return low == - numeric_limits< double >::infinity() && high == numeric_limits< double >::infinity();
+    }
+    bool is_point() const {
+        return low == high;
+    }
+    bool contains( const double value ) const {
+        return low <= value && value <= high;
+    }
+
+    bool operator ==( const Interval & other ) const {
+        return low == other.low && high == other.high;
+    }
+};
+
+inline Interval intersect( const Interval & a, const Interval & b ) {
+    return { max( a.low, b.low ), min( a.high, b.high ) };
+}
+inline Interval hull( const Interval & a, const Interval & b ) {
+    return { min( a.low, b.low ), max( a.high, b.high ) };
+}
+
+inline Interval operator +( const Interval & a, const Interval & b ) {
+    return { a.low + b.low, a.high + b.high };
+}
+inline Interval operator -( const Interval & a, const Interval & b ) {
+    return { a.low - b.high, a.high - b.low };
+}
+inline Interval operator *( const Interval & a, const Interval & b ) {
+    //zero times infinity is zero here since the infinity only stands for "unbounded":
+    const auto & times = []( const double x, const double y ) {
+        return x == 0 || y == 0 ? 0. : x * y;
+    };
+    const double products[] = { times( a.low, b.low ), times( a.low, b.high ), times( a.high, b.low ), times( a.high, b.high ) };
+    return { * min_element( begin( products ), end( products ) ), * max_element( begin( products ), end( products ) ) };
+}
+inline Interval operator /( const Interval & a, const Interval & b ) {
+    //divisor spanning zero might produce anything:
+    if ( b.contains( 0 ) )
+        return Interval::whole();
+    return a * Interval{ 1 / b.high, 1 / b.low };
+}
+
+/** Truth of a < b: decided only if it holds (or fails) for every pair of values, so bounds shared by both ranges leave it undecidable.*/
+inline Interval truth_less( const Interval & a, const Interval & b ) {
+    return Interval::truth( a.high >= b.low, a.low < b.high );
+}
+inline Interval truth_less_equal( const Interval & a, const Interval & b ) {
+    return Interval::truth( a.high > b.low, a.low <= b.high );
+}
+inline Interval truth_equal( const Interval & a, const Interval & b ) {
+    return Interval::truth( ! ( a.is_point() && a == b ), ! intersect( a, b ).is_empty() );
+}
+inline Interval truth_not( const Interval & a ) {
+    return Interval::truth( ! ( a.is_point() && a.low == 0 ), a.contains( 0 ) );
+}
+
+inline ostream & operator <<( ostream & o, const Interval & interval ) {
+    return o << "[" << interval.low << ", " << interval.high << "]";
+}
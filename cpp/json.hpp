@@ -0,0 +1,284 @@
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+/** Writes JSON string literal with all the special characters escaped.*/
+inline void write_json_string( ostream & o, const string & s ) {
+    o << '"';
+    for ( const auto ch : s ) {
+        switch ( ch ) {
+            case '"' : o << "\\\""; break;
+            case '\\': o << "\\\\"; break;
+            case '\n': o << "\\n"; break;
+            case '\r': o << "\\r"; break;
+            case '\t': o << "\\t"; break;
+            default:
+                if ( (unsigned char) ch < 0x20 )
+                    o << "\\u" << hex << setw( 4 ) << setfill( '0' ) << int( ch ) << dec << setfill( ' ' );
+                else
+                    o << ch;
+        }
+    }
+    o << '"';
+}
+
+/** Parsed JSON value: just enough to read requests of JSON-based protocols. Writing is done straight into ostream (see write_json_string()).*/
+struct Json {
+    enum KIND {
+        NUL,
+        BOOLEAN,
+        NUMBER,
+        STRING,
+        ARRAY,
+        OBJECT,
+    };
+    KIND kind = NUL;
+    bool boolean = false;
+    double number = 0;
+    string text;
+    vector< Json > items;
+    map< string, Json > fields;
+
+    /** Field of OBJECT or null if there is no such field (or it's not an OBJECT), so nested fields are looked up without checks.*/
+    const Json & operator []( const string & name ) const {
+        static const Json null;
+        const auto found = fields.find( name );
+        return found == fields.end() ? null : found->second;
+    }
+    const Json & operator []( const size_t index ) const {
+        static const Json null;
+        return index < items.size() ? items[ index ] : null;
+    }
+    bool is_null() const {
+        return kind == NUL;
+    }
+    int64_t integer() const {
+        return int64_t( number );
+    }
+
+    /** Throws runtime_error if json is malformed.*/
+    static Json parse( const string_view json ) {
+        size_t caret = 0;
+        auto value = parse_value( json, caret, 0 );
+        skip_whitespace( json, caret );
+        if ( caret != json.size() )
+            fail( "trailing characters", caret );
+        return value;
+    }
+
+    void write( ostream & o ) const {
+        switch ( kind ) {
+            case NUL: o << "null"; break;
+            case BOOLEAN: o << ( boolean ? "true" : "false" ); break;
+            case NUMBER:
+                //identifiers are integers mostly:
+                if ( number > -1e15 && number < 1e15 && number == double( int64_t( number ) ) )
+                    o << int64_t( number );
+                else
+                    o << setprecision( 17 ) << number << setprecision( 6 );
+                break;
+            case STRING: write_json_string( o, text ); break;
+            case ARRAY: {
+                o << '[';
+                for ( size_t i = 0; i < items.size(); ++ i ) {
+                    if ( i > 0 )
+                        o << ',';
+                    items[ i ].write( o );
+                }
+                o << ']';
+                break;
+            }
+            case OBJECT: {
+                o << '{';
+                bool first = true;
+                for ( const auto & field : fields ) {
+                    if ( ! first )
+                        o << ',';
+                    first = false;
+                    write_json_string( o, field.first );
+                    o << ':';
+                    field.second.write( o );
+                }
+                o << '}';
+                break;
+            }
+        }
+    }
+
+private:
+    /** Deeper values are rejected, so malformed input cannot exhaust the stack.*/
+    static constexpr size_t MaxDepth = 256;
+
+    [[noreturn]] static void fail( const string & reason, const size_t caret ) {
+        throw runtime_error( "ERROR: malformed JSON: " + reason + " at " + to_string( caret ) );
+    }
+    static void skip_whitespace( const string_view json, size_t & caret ) {
+        while ( caret < json.size() && ( json[ caret ] == ' ' || json[ caret ] == '\t' || json[ caret ] == '\n' || json[ caret ] == '\r' ) )
+            ++ caret;
+    }
+    static void expect( const string_view json, size_t & caret, const string_view literal ) {
+        if ( json.substr( caret, literal.size() ) != literal )
+            fail( "unexpected character", caret );
+        caret += literal.size();
+    }
+
+    static Json parse_value( const string_view json, size_t & caret, const size_t depth ) {
+        if ( depth > MaxDepth )
+            fail( "too deep", caret );
+        skip_whitespace( json, caret );
+        if ( caret >= json.size() )
+            fail( "unexpected end", caret );
+        Json value;
+        switch ( json[ caret ] ) {
+            case 'n': expect( json, caret, "null" ); break;
+            case 't': expect( json, caret, "true" ); value.kind = BOOLEAN; value.boolean = true; break;
+            case 'f': expect( json, caret, "false" ); value.kind = BOOLEAN; break;
+            case '"': value.kind = STRING; value.text = parse_string( json, caret ); break;
+            case '[': {
+                value.kind = ARRAY;
+                ++ caret;
+                skip_whitespace( json, caret );
+                if ( caret < json.size() && json[ caret ] == ']' ) {
+                    ++ caret;
+                    break;
+                }
+                while ( true ) {
+                    value.items.push_back( parse_value( json, caret, depth + 1 ) );
+                    skip_whitespace( json, caret );
+                    if ( caret < json.size() && json[ caret ] == ',' ) {
+                        ++ caret;
+                        continue;
+                    }
+                    expect( json, caret, "]" );
+                    break;
+                }
+                break;
+            }
+            case '{': {
+                value.kind = OBJECT;
+                ++ caret;
+                skip_whitespace( json, caret );
+                if ( caret < json.size() && json[ caret ] == '}' ) {
+                    ++ caret;
+                    break;
+                }
+                while ( true ) {
+                    skip_whitespace( json, caret );
+                    if ( caret >= json.size() || json[ caret ] != '"' )
+                        fail( "field name expected", caret );
+                    auto name = parse_string( json, caret );
+                    skip_whitespace( json, caret );
+                    expect( json, caret, ":" );
+                    value.fields[ move( name ) ] = parse_value( json, caret, depth + 1 );
+                    skip_whitespace( json, caret );
+                    if ( caret < json.size() && json[ caret ] == ',' ) {
+                        ++ caret;
+                        continue;
+                    }
+                    expect( json, caret, "}" );
+                    break;
+                }
+                break;
+            }
+            default: {
+                const auto start = caret;
+                while ( caret < json.size() && ( isdigit( json[ caret ] ) || json[ caret ] == '-' || json[ caret ] == '+' || json[ caret ] == '.' || json[ caret ] == 'e' || json[ caret ] == 'E' ) )
+                    ++ caret;
+                const string number( json.substr( start, caret - start ) );
+                char * tail = nullptr;
+                value.number = strtod( number.c_str(), & tail );
+                if ( number.empty() || tail != number.c_str() + number.size() )
+                    fail( "unexpected character", start );
+                value.kind = NUMBER;
+            }
+        }
+        return value;
+    }
+
+    static uint32_t parse_hex( const string_view json, size_t & caret ) {
+        if ( caret + 4 > json.size() )
+            fail( "short escape", caret );
+        uint32_t code = 0;
+        for ( size_t i = 0; i < 4; ++ i ) {
+            const char ch = json[ caret ++ ];
+            code <<= 4;
+            if ( ch >= '0' && ch <= '9' )
+                code |= ch - '0';
+            else if ( ch >= 'a' && ch <= 'f' )
+                code |= ch - 'a' + 10;
+            else if ( ch >= 'A' && ch <= 'F' )
+                code |= ch - 'A' + 10;
+            else
+                fail( "malformed escape", caret - 1 );
+        }
+        return code;
+    }
+    /** Escaped characters are decoded into UTF-8.*/
+    static string parse_string( const string_view json, size_t & caret ) {
+        string result;
+        ++ caret;
+        while ( true ) {
+            if ( caret >= json.size() )
+                fail( "unterminated string", caret );
+            const char ch = json[ caret ++ ];
+            if ( ch == '"' )
+                return result;
+            if ( ch != '\\' ) {
+                result += ch;
+                continue;
+            }
+            if ( caret >= json.size() )
+                fail( "unterminated string", caret );
+            switch ( json[ caret ++ ] ) {
+                case '"': result += '"'; break;
+                case '\\': result += '\\'; break;
+                case '/': result += '/'; break;
+                case 'b': result += '\b'; break;
+                case 'f': result += '\f'; break;
+                case 'n': result += '\n'; break;
+                case 'r': result += '\r'; break;
+                case 't': result += '\t'; break;
+                case 'u': {
+                    uint32_t code = parse_hex( json, caret );
+                    //surrogate pair:
+                    if ( code >= 0xd800 && code < 0xdc00 && json.substr( caret, 2 ) == "\\u" ) {
+                        caret += 2;
+                        const auto low = parse_hex( json, caret );
+                        code = 0x10000 + ( ( code - 0xd800 ) << 10 ) + ( low - 0xdc00 );
+                    }
+                    if ( code < 0x80 )
+                        result += char( code );
+                    else if ( code < 0x800 ) {
+                        result += char( 0xc0 | ( code >> 6 ) );
+                        result += char( 0x80 | ( code & 0x3f ) );
+                    }
+                    else if ( code < 0x10000 ) {
+                        result += char( 0xe0 | ( code >> 12 ) );
+                        result += char( 0x80 | ( ( code >> 6 ) & 0x3f ) );
+                        result += char( 0x80 | ( code & 0x3f ) );
+                    }
+                    else {
+                        result += char( 0xf0 | ( code >> 18 ) );
+                        result += char( 0x80 | ( ( code >> 12 ) & 0x3f ) );
+                        result += char( 0x80 | ( ( code >> 6 ) & 0x3f ) );
+                        result += char( 0x80 | ( code & 0x3f ) );
+                    }
+                    break;
+                }
+                default:
+                    fail( "malformed escape", caret - 1 );
+            }
+        }
+    }
+};
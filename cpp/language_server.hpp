@@ -0,0 +1,466 @@
+#pragma once
+
+#include "document.hpp"
+#include "semantic.hpp"
+#include "json.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <regex>
+#include <thread>
+
+/**
+Language Server Protocol over a pair of streams (stdin/stdout of the daemon): every open source is kept parsed (see Document) in memory, so edits are applied incrementally and syntax diagnostics are published right away. Merging and evaluation of the whole source are deferred until hover or references need them or until the client sends nothing for a quiet period, so typing doesn't analyze the source on every keystroke.
+Positions are counted in bytes rather than UTF-16 code units the protocol specifies, which differs only for non-ASCII lines.
+*/
+
+/** Reads single message of LSP base protocol: headers, empty line and JSON body of Content-Length bytes. Returns false once input ends.*/
+inline bool read_lsp_message( istream & in, string & body ) {
+    size_t length = 0;
+    bool has_length = false;
+    string header;
+    while ( getline( in, header ) ) {
+        if ( ! header.empty() && header.back() == '\r' )
+            header.pop_back();
+        if ( header.empty() ) {
+            if ( ! has_length )
+                continue;
+            body.resize( length );
+            in.read( body.data(), length );
+            return size_t( in.gcount() ) == length;
+        }
+        const string Length = "Content-Length:";
+        if ( header.compare( 0, Length.size(), Length ) == 0 ) {
+            length = strtoull( header.c_str() + Length.size(), nullptr, 10 );
+            has_length = true;
+        }
+    }
+    return false;
+}
+inline void write_lsp_message( ostream & out, const string & body ) {
+    out << "Content-Length: " << body.size() << "\r\n\r\n" << body << flush;
+}
+
+/** File name of "file://" URI. Other URIs are used as they are.*/
+inline string path_of_uri( const string & uri ) {
+    const string File = "file://";
+    if ( uri.compare( 0, File.size(), File ) != 0 )
+        return uri;
+    string path;
+    for ( size_t i = File.size(); i < uri.size(); ++ i ) {
+        if ( uri[ i ] == '%' && i + 2 < uri.size() && isxdigit( uri[ i + 1 ] ) && isxdigit( uri[ i + 2 ] ) ) {
+            path += char( stoi( uri.substr( i + 1, 2 ), nullptr, 16 ) );
+            i += 2;
+        }
+        else
+            path += uri[ i ];
+    }
+    return path;
+}
+
+/** Merged and evaluated copy of Document's graph: Document's own graph stays unmerged, so it can be edited further.*/
+struct Analysis {
+    /** Merged copy.*/
+    Node * root = nullptr;
+    /** Everything evaluated without any inputs.*/
+    Layer layer;
+    /** Merged TERMs by their names.*/
+    map< string, Node * > terms;
+    /** Nodes of Document's graph by their copies, besides TERMs (which are merged).*/
+    map< Node *, Node * > originals;
+    /** Why the copy couldn't be merged or evaluated if so.*/
+    string error;
+
+    Analysis( const Document & document ): document( document ) {
+        map< Node *, Node * > copies;
+        root = document.clone( & copies );
+        for ( const auto & [ original, copy ] : copies ) {
+            if ( ! copy->type( TYPE::TERM ) )
+                originals[ copy ] = original;
+        }
+        try {
+            merge_occurences( root );
+            pulse( root, [&]( Node * node ) {
+                if ( node->type( TYPE::TERM ) && ! node->type( TYPE::NUMBER ) )
+                    terms[ node->content ] = node;
+            } );
+            evaluate_layer( root, layer );
+        }
+        catch ( const exception & e ) {
+            error = e.what();
+        }
+    }
+    Analysis( const Analysis & ) = delete;
+    Analysis & operator =( const Analysis & ) = delete;
+    ~Analysis() {
+        destroy_graph( root );
+    }
+
+    /** Positions of all the occurences of merged TERM: the occurence it was merged into and those within all the EXPRESSIONs referencing it.*/
+    set< SourcePos > occurences( Node * term ) const {
+        set< SourcePos > result = { term->source_pos };
+        for ( auto expr : term->refd ) {
+            const auto original = originals.find( expr );
+            if ( original == originals.end() )
+                continue;
+            for ( auto ref : original->second->refs ) {
+                if ( ref->type( TYPE::TERM ) && ref->content == term->content )
+                    result.insert( document.position( ref ) );
+            }
+        }
+        return result;
+    }
+
+private:
+    const Document & document;
+};
+
+/** Serves LSP requests (initialize, shutdown, textDocument/hover and textDocument/references) and notifications (initialized, exit, textDocument/didOpen, didChange and didClose) one by one, publishing diagnostics of every source once it's changed.*/
+struct LanguageServer {
+    /** @param quiet_period since the last message after which edited sources are analyzed without being asked to.*/
+    LanguageServer( istream & in, ostream & out, ThreadPool & pool = default_pool(), const chrono::milliseconds quiet_period = chrono::milliseconds( 500 ) ):
+        in( in ), out( out ), pool( pool ), quiet_period( quiet_period ) {}
+
+    /** Serves until exit notification or the end of input. Returns exit code of the daemon.*/
+    int run() {
+        //messages are read by a thread of their own, so waiting for them might time out:
+        thread reader( [&]{ read_messages(); } );
+        while ( true ) {
+            Incoming incoming;
+            {
+                unique_lock< mutex > lock( incoming_guard );
+                const auto & arrived = [&]{ return ! received.empty() || input_ended; };
+                if ( any_pending() ) {
+                    if ( ! incoming_arrived.wait_for( lock, quiet_period, arrived ) ) {
+                        lock.unlock();
+                        analyze_pending();
+                        continue;
+                    }
+                }
+                else
+                    incoming_arrived.wait( lock, arrived );
+                if ( received.empty() )
+                    break;
+                incoming = move( received.front() );
+                received.pop_front();
+            }
+            if ( ! incoming.error.empty() ) {
+                respond_error( Json(), -32700, incoming.error );
+                continue;
+            }
+            const auto & message = incoming.message;
+            if ( message[ "method" ].text == "exit" )
+                break;
+            try {
+                handle( message );
+            }
+            catch ( const exception & e ) {
+                TRACE( DRIVER, ERROR ) << "ERROR: " << message[ "method" ].text << " failed: " << e.what();
+                if ( ! message[ "id" ].is_null() )
+                    respond_error( message[ "id" ], -32603, e.what() );
+            }
+        }
+        //reading stops at exit notification as well:
+        reader.join();
+        return shutting_down ? 0 : 1;
+    }
+
+private:
+    /** Open source along with it's semantics.*/
+    struct Source {
+        unique_ptr< Document > document;
+        /** Absent until requested since the last edit.*/
+        unique_ptr< Analysis > analysis;
+    };
+
+    /** Message as it's read or why it couldn't be parsed.*/
+    struct Incoming {
+        Json message;
+        string error;
+    };
+
+    istream & in;
+    ostream & out;
+    ThreadPool & pool;
+    const chrono::milliseconds quiet_period;
+    map< string, Source > sources;
+    bool shutting_down = false;
+
+    mutex incoming_guard;
+    condition_variable incoming_arrived;
+    deque< Incoming > received;
+    bool input_ended = false;
+
+    /** Queues messages until exit notification or the end of input.*/
+    void read_messages() {
+        string body;
+        bool exiting = false;
+        while ( ! exiting && read_lsp_message( in, body ) ) {
+            Incoming incoming;
+            try {
+                incoming.message = Json::parse( body );
+                exiting = incoming.message[ "method" ].text == "exit";
+            }
+            catch ( const exception & e ) {
+                incoming.error = e.what();
+            }
+            lock_guard< mutex > lock( incoming_guard );
+            received.push_back( move( incoming ) );
+            incoming_arrived.notify_one();
+        }
+        lock_guard< mutex > lock( incoming_guard );
+        input_ended = true;
+        incoming_arrived.notify_one();
+    }
+
+    void handle( const Json & message ) {
+        const auto & method = message[ "method" ].text;
+        const auto & id = message[ "id" ];
+        const auto & params = message[ "params" ];
+        if ( method == "initialize" ) {
+            respond( id, "{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,\"change\":2},\"hoverProvider\":true,\"referencesProvider\":true},\"serverInfo\":{\"name\":\"recumpose\"}}" );
+        }
+        else if ( method == "shutdown" ) {
+            shutting_down = true;
+            respond( id, "null" );
+        }
+        else if ( method == "textDocument/didOpen" )
+            open( params[ "textDocument" ][ "uri" ].text, params[ "textDocument" ][ "text" ].text );
+        else if ( method == "textDocument/didChange" )
+            change( params[ "textDocument" ][ "uri" ].text, params[ "contentChanges" ] );
+        else if ( method == "textDocument/didClose" ) {
+            const auto & uri = params[ "textDocument" ][ "uri" ].text;
+            sources.erase( uri );
+            publish_diagnostics( uri );
+        }
+        else if ( method == "textDocument/hover" )
+            respond( id, hover( params ) );
+        else if ( method == "textDocument/references" )
+            respond( id, references( params ) );
+        //requests must be answered, while unknown notifications are just ignored:
+        else if ( ! id.is_null() )
+            respond_error( id, -32601, "method " + method + " is not supported" );
+    }
+
+    void respond( const Json & id, const string & result ) {
+        ostringstream body;
+        body << "{\"jsonrpc\":\"2.0\",\"id\":";
+        id.write( body );
+        body << ",\"result\":" << result << "}";
+        write_lsp_message( out, body.str() );
+    }
+    void respond_error( const Json & id, const int code, const string & error ) {
+        ostringstream body;
+        body << "{\"jsonrpc\":\"2.0\",\"id\":";
+        id.write( body );
+        body << ",\"error\":{\"code\":" << code << ",\"message\":";
+        write_json_string( body, error );
+        body << "}}";
+        write_lsp_message( out, body.str() );
+    }
+    void notify( const string & method, const string & params ) {
+        ostringstream body;
+        body << "{\"jsonrpc\":\"2.0\",\"method\":";
+        write_json_string( body, method );
+        body << ",\"params\":" << params << "}";
+        write_lsp_message( out, body.str() );
+    }
+
+    static vector< string > split_lines( const string & text ) {
+        vector< string > lines;
+        istringstream stream( text );
+        string line;
+        while ( getline( stream, line ) ) {
+            if ( ! line.empty() && line.back() == '\r' )
+                line.pop_back();
+            lines.push_back( line );
+        }
+        return lines;
+    }
+
+    void open( const string & uri, const string & text ) {
+        auto & source = sources[ uri ];
+        source.analysis.reset();
+        //malformed statements are left out of the graph, so the document is kept even if it's malformed:
+        source.document = make_unique< Document >( path_of_uri( uri ), "", pool );
+        edit( source, { 1, 0, split_lines( text ) } );
+        publish_diagnostics( uri );
+    }
+
+    /** Applies edits of didChange: ranged ones are converted into replacements of the lines they touch, while those without range replace the whole text.*/
+    void change( const string & uri, const Json & changes ) {
+        const auto found = sources.find( uri );
+        if ( found == sources.end() )
+            throw runtime_error( "ERROR: " + uri + " is changed while it's not open" );
+        auto & source = found->second;
+        auto & document = * source.document;
+        for ( const auto & change : changes.items ) {
+            const auto & range = change[ "range" ];
+            if ( range.is_null() ) {
+                edit( source, { 1, int32_t( document.lines() ), split_lines( change[ "text" ].text ) } );
+                continue;
+            }
+            const auto lines = int32_t( document.lines() );
+            const auto start_line = int32_t( range[ "start" ][ "line" ].integer() );
+            const auto end_line = int32_t( range[ "end" ][ "line" ].integer() );
+            if ( start_line < 0 || end_line < start_line || start_line > lines )
+                throw out_of_range( "ERROR: change of " + uri + " is out of text" );
+            //the line past the last one is the empty one after the last line break:
+            const auto & line_at = [&]( const int32_t line ) {
+                return line < lines ? document.line( line ) : string();
+            };
+            const auto & start = line_at( start_line );
+            const auto & end = line_at( end_line );
+            const auto text =
+                start.substr( 0, min( size_t( max< int64_t >( 0, range[ "start" ][ "character" ].integer() ) ), start.size() ) )
+                + change[ "text" ].text
+                + end.substr( min( size_t( max< int64_t >( 0, range[ "end" ][ "character" ].integer() ) ), end.size() ) );
+            const auto removed = min( end_line, lines - 1 ) - start_line + 1;
+            //the line after the last line break is a line of it's own unless it's past the last line:
+            auto inserted = split_lines( text );
+            if ( end_line < lines && ( text.empty() || text.back() == '\n' ) )
+                inserted.push_back( "" );
+            edit( source, { start_line + 1, max( 0, removed ), inserted } );
+        }
+        source.analysis.reset();
+        publish_diagnostics( uri );
+    }
+
+    /** Malformed edits are reported by diagnostics.*/
+    void edit( Source & source, const LineEdit & e ) {
+        try {
+            source.document->edit( e );
+        }
+        catch ( const runtime_error & ) {
+        }
+    }
+
+    /** Analysis of the source as it's edited so far. Diagnostics are published again once it finds a semantic error, since those published on edit contain syntax errors only.*/
+    const Analysis & analysis_of( const string & uri, Source & source ) {
+        if ( ! source.analysis ) {
+            source.analysis = make_unique< Analysis >( * source.document );
+            if ( ! source.analysis->error.empty() )
+                publish_diagnostics( uri );
+        }
+        return * source.analysis;
+    }
+    bool any_pending() const {
+        for ( const auto & source : sources ) {
+            if ( ! source.second.analysis )
+                return true;
+        }
+        return false;
+    }
+    void analyze_pending() {
+        for ( auto & [ uri, source ] : sources )
+            analysis_of( uri, source );
+    }
+
+    void publish_diagnostics( const string & uri ) {
+        ostringstream params;
+        params << "{\"uri\":";
+        write_json_string( params, uri );
+        params << ",\"diagnostics\":[";
+        bool first = true;
+        const auto & diagnostic = [&]( const int32_t start_line, const int32_t start_char, const int32_t end_line, const int32_t end_char, const string & message ) {
+            if ( ! first )
+                params << ',';
+            first = false;
+            params << "{\"range\":{\"start\":{\"line\":" << start_line << ",\"character\":" << start_char << "},\"end\":{\"line\":" << end_line << ",\"character\":" << end_char << "}},\"severity\":1,\"source\":\"recumpose\",\"message\":";
+            write_json_string( params, message );
+            params << '}';
+        };
+        const auto found = sources.find( uri );
+        if ( found != sources.end() ) {
+            for ( const auto & error : found->second.document->errors() )
+                diagnostic( error.first, 0, error.end, 0, error.message );
+            if ( found->second.analysis && ! found->second.analysis->error.empty() ) {
+                //semantic errors are positioned as the nodes they're about:
+                const auto & error = found->second.analysis->error;
+                smatch position;
+                if ( regex_search( error, position, regex( "\\{\"[^\"]*\":(\\d+):(\\d+)-(\\d+)\\}" ) ) ) {
+                    const auto line = max( 0, stoi( position[ 1 ] ) - 1 );
+                    diagnostic( line, max( 0, stoi( position[ 2 ] ) - 1 ), line, stoi( position[ 3 ] ), error );
+                }
+                else
+                    diagnostic( 0, 0, 0, 0, error );
+            }
+        }
+        params << "]}";
+        notify( "textDocument/publishDiagnostics", params.str() );
+    }
+
+    /** TERM at position of request (if any) along with the source it's within.*/
+    pair< Source *, Node * > term_at( const Json & params ) {
+        const auto found = sources.find( params[ "textDocument" ][ "uri" ].text );
+        if ( found == sources.end() )
+            return { nullptr, nullptr };
+        const auto & document = * found->second.document;
+        for ( auto node : document.at(
+            int32_t( params[ "position" ][ "line" ].integer() ) + 1,
+            int32_t( params[ "position" ][ "character" ].integer() ) + 1
+        ) ) {
+            if ( node->type( TYPE::TERM ) )
+                return { & found->second, node };
+        }
+        return { & found->second, nullptr };
+    }
+
+    static void write_range( ostream & o, const SourcePos & pos ) {
+        o << "{\"start\":{\"line\":" << pos.line - 1 << ",\"character\":" << pos.char_start - 1 << "},\"end\":{\"line\":" << pos.line - 1 << ",\"character\":" << pos.char_end << "}}";
+    }
+
+    /** Evaluated value of TERM under the cursor.*/
+    string hover( const Json & params ) {
+        const auto [ source, term ] = term_at( params );
+        if ( term == nullptr )
+            return "null";
+        const auto & analysis = analysis_of( params[ "textDocument" ][ "uri" ].text, * source );
+        ostringstream text;
+        text << term->content;
+        if ( term->type( TYPE::NUMBER ) )
+            text << " = " << string_to_int( term->content );
+        else {
+            const auto merged = analysis.terms.find( term->content );
+            const double * value = merged == analysis.terms.end() ? nullptr : analysis.layer.values.find( merged->second );
+            if ( value != nullptr )
+                text << " = " << * value;
+            else
+                text << " is not evaluated";
+        }
+        ostringstream result;
+        result << "{\"contents\":{\"kind\":\"plaintext\",\"value\":";
+        write_json_string( result, text.str() );
+        result << "},\"range\":";
+        write_range( result, source->document->position( term ) );
+        result << '}';
+        return result.str();
+    }
+
+    /** All the occurences of TERM under the cursor.*/
+    string references( const Json & params ) {
+        const auto [ source, term ] = term_at( params );
+        if ( term == nullptr )
+            return "null";
+        const auto & analysis = analysis_of( params[ "textDocument" ][ "uri" ].text, * source );
+        const auto merged = analysis.terms.find( term->content );
+        const auto occurences = merged == analysis.terms.end() ? set{ source->document->position( term ) } : analysis.occurences( merged->second );
+        ostringstream result;
+        result << '[';
+        bool first = true;
+        for ( const auto & pos : occurences ) {
+            if ( ! first )
+                result << ',';
+            first = false;
+            result << "{\"uri\":";
+            write_json_string( result, params[ "textDocument" ][ "uri" ].text );
+            result << ",\"range\":";
+            write_range( result, pos );
+            result << '}';
+        }
+        result << ']';
+        return result.str();
+    }
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+using namespace std;
+
+/** Bounded map which evicts the least recently used entries once capacity is exceeded. Might be used from multiple threads simultaneously.*/
+template< typename Key, typename Value >
+struct LruCache {
+    atomic< uint64_t > hits = 0;
+    atomic< uint64_t > misses = 0;
+    atomic< uint64_t > evictions = 0;
+
+    LruCache( const size_t capacity ): capacity( capacity ) {}
+    LruCache( const LruCache & ) = delete;
+    LruCache & operator =( const LruCache & ) = delete;
+
+    /** Copies value of key into value and marks it as the most recently used. Returns false (counting a miss) if there is no such key.*/
+    bool find( const Key & key, Value & value ) {
+        lock_guard< mutex > lock( guard );
+        const auto found = index.find( key );
+        if ( found == index.end() ) {
+            ++ misses;
+            return false;
+        }
+        ++ hits;
+        entries.splice( entries.begin(), entries, found->second );
+        value = found->second->second;
+        return true;
+    }
+
+    void put( const Key & key, const Value & value ) {
+        lock_guard< mutex > lock( guard );
+        const auto found = index.find( key );
+        if ( found != index.end() ) {
+            found->second->second = value;
+            entries.splice( entries.begin(), entries, found->second );
+            return;
+        }
+        entries.emplace_front( key, value );
+        index.emplace( key, entries.begin() );
+        while ( entries.size() > capacity ) {
+            index.erase( entries.back().first );
+            entries.pop_back();
+            ++ evictions;
+        }
+    }
+
+    size_t size() {
+        lock_guard< mutex > lock( guard );
+        return entries.size();
+    }
+    void clear() {
+        lock_guard< mutex > lock( guard );
+        entries.clear();
+        index.clear();
+    }
+
+private:
+    const size_t capacity;
+    mutex guard;
+    /** The most recently used go first.*/
+    list< pair< Key, Value > > entries;
+    unordered_map< Key, typename list< pair< Key, Value > >::iterator > index;
+};
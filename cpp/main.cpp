@@ -1,6 +1,17 @@
 
 #include "syntactic.hpp"
 #include "semantic.hpp"
+#include "graph_cache.hpp"
+#include "language_server.hpp"
+#include "watch.hpp"
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
 
 /** Compiled strictly typed non-deterministic programming language based on lambda-calculus, reactive programming, homotopy type theory and fractal growth to easily handle composition.*/
 
@@ -12,24 +23,383 @@ These entities are like reactive outputs: only resulting value on single entity
 struct Entity {};
 */
 
-auto process( const string & source_name )
-{
-    auto root = syntactic( source_name );
+/** What to do with every compiled source.*/
+struct Options {
+    bool plot = false;
+    GRAPH_FORMAT plot_format = GRAPH_FORMAT::DOT;
+    GRAPH_SPLIT plot_split = GRAPH_SPLIT::WHOLE;
+    bool evaluate = false;
+    bool stats = false;
+    /** Where to write Chrome trace event timeline of all the compilations if not empty.*/
+    string timeline;
+    /** Limits of branches exploration of every source.*/
+    BranchBudget budget;
+    /** Directory of precompiled graphs of unchanged sources if not empty.*/
+    string graph_cache;
+    /** Directory where branch state of every source is resumed from and stored into if not empty.*/
+    string branch_state;
+    /** Serve Language Server Protocol over stdin/stdout instead of compiling sources.*/
+    bool lsp = false;
+    /** Compile sources again every time any of their files changes.*/
+    bool watch = false;
+    size_t jobs = max( 1u, thread::hardware_concurrency() );
+    vector< string > sources;
+};
 
+/** Writes both views of the graph of single source (semantics and expressions) within single traversal.*/
+void plot_program( Node * root, const string & source_name, const GRAPH_FORMAT format, const GRAPH_SPLIT split )
+{
     const auto target_name = source_caption( source_name );
-    cout << "Plotting to " << target_name << endl;
-    plot( root, set{ TYPE::EXPRESSION, TYPE::TERM, TYPE::NONABELIAN }, target_name + "_semantics" );
-    plot( root, set{ TYPE::EXPRESSION, TYPE::TERM, TYPE::ENTITY, TYPE::NONABELIAN }, target_name + "_expressions" );
+    TRACE( DRIVER, INFO ) << "Plotting to " << target_name;
+    export_graph( root, {
+        { target_name + "_semantics", { TYPE::EXPRESSION, TYPE::TERM, TYPE::NONABELIAN }, format, true },
+        { target_name + "_expressions", { TYPE::EXPRESSION, TYPE::TERM, TYPE::ENTITY, TYPE::NONABELIAN }, format, true },
+    }, split );
+}
+
+/** Compiles parsed graph of single source (which is destroyed then). Returns values of it's declared outputs if evaluation was requested.*/
+map< string, double > process_graph( Node * root, const string & source_name, const Options & options )
+{
+    map< string, double > outputs;
+    try {
+        if ( options.plot )
+            plot_program( root, source_name, options.plot_format, options.plot_split );
+        if ( options.evaluate ) {
+            const auto layer = semantic(
+                root,
+                options.budget,
+                options.branch_state.empty() ? "" : ( filesystem::path( options.branch_state ) / ( source_caption( source_name ) + ".branches" ) ).string()
+            );
+            const auto & on_outputs = [&]( Node * node ) {
+                if ( ! node->type( TYPE::OUTPUTS ) )
+                    return;
+                for ( auto term : node->refs ) {
+                    if ( ! term->type( TYPE::TERM ) )
+                        continue;
+                    if ( const auto value = layer.values.find( term ) )
+                        outputs[ term->content ] = * value;
+                }
+            };
+            pulse( root, on_outputs );
+        }
+        count_types( root );
+    }
+    catch ( ... ) {
+        destroy_graph( root );
+        throw;
+    }
+    destroy_graph( root );
+
+    if ( TRACING( DRIVER, INFO ) ) {
+        if ( const auto stats = current_stats() ) {
+            TRACE( DRIVER, INFO ) << "Memory (live/peak bytes):";
+            for ( size_t m = 0; m < MemorySubsystems; ++ m )
+                TRACE( DRIVER, INFO ) << "    " << MemoryNames[ m ] << ": " << stats->live_bytes[ m ] << " / " << stats->peak_bytes[ m ];
+            TRACE( DRIVER, INFO ) << "Nodes (edges) per type:";
+            for ( const auto & type : stats->type_counts() )
+                TRACE( DRIVER, INFO ) << "    " << type.type << ": " << type.nodes << " (" << type.edges << ")";
+        }
+    }
+
+    TRACE( DRIVER, INFO ) << "Done.";
+    return outputs;
+}
+
+/** Compiles single source. Returns values of it's declared outputs if evaluation was requested.*/
+auto process( const string & source_name, const Options & options, ThreadPool & pool )
+{
+    auto root = options.graph_cache.empty() ? syntactic( source_name, pool ) : cached_parse_program( source_name, options.graph_cache, pool );
+    if ( root == nullptr )
+        throw runtime_error( string( "ERROR: empty source " ) + source_name );
+    return process_graph( root, source_name, options );
+}
+
+/** Compiles every source and then compiles it again every time any of it's files changes, until interrupted. Files are kept parsed in between (see WatchedProgram), so only the changed statements are parsed again. Graphs are plotted in the background.*/
+int watch( const Options & options, ThreadPool & pool ) {
+    //writes of single save come in bursts:
+    const auto Quiet = chrono::milliseconds( 100 );
 
-    semantic( root );
+    FileWatcher watcher;
+    vector< unique_ptr< WatchedProgram > > programs( options.sources.size() );
+    auto quiet_options = options;
+    quiet_options.plot = false;
+    //plots of the same source must not be written simultaneously:
+    auto plot_guard = make_shared< mutex >();
 
-    cout << "Done." << endl;
+    const auto & compile = [&]( const size_t i, const set< string > & changed ) {
+        auto & program = programs[ i ];
+        const auto & source = options.sources[ i ];
+        ostringstream result;
+        Stats stats;
+        {
+            StatsScope scope( & stats );
+            try {
+                if ( ! program ) {
+                    Phase phase( "parse" );
+                    program = make_unique< WatchedProgram >( source, pool );
+                }
+                else {
+                    Phase phase( "reparse" );
+                    program->update( changed );
+                }
+                Node * root = nullptr;
+                {
+                    Phase phase( "link" );
+                    root = program->link();
+                }
+                if ( options.plot ) {
+                    Node * copy = nullptr;
+                    {
+                        //plotted copy isn't accounted within compilation:
+                        StatsScope unaccounted( nullptr );
+                        copy = clone_graph( root );
+                    }
+                    pool.submit( [ copy, source, plot_guard, format = options.plot_format, split = options.plot_split ]{
+                        lock_guard< mutex > lock( * plot_guard );
+                        try {
+                            plot_program( copy, source, format, split );
+                        }
+                        catch ( const exception & e ) {
+                            TRACE( DRIVER, ERROR ) << "ERROR: cannot plot " << source << ": " << e.what();
+                        }
+                        destroy_graph( copy );
+                    } );
+                }
+                const auto outputs = process_graph( root, source, quiet_options );
+                result << "OK " << source << endl;
+                for ( const auto & output : outputs )
+                    result << "    " << output.first << " = " << output.second << endl;
+            }
+            catch ( const exception & e ) {
+                result << "FAILED " << source << ": " << e.what() << endl;
+            }
+        }
+        for ( const auto & phase : stats.phase_times() )
+            result << "    " << phase.name << ": " << phase.seconds * 1000 << " ms" << endl;
+        //files might be included or not anymore:
+        if ( program ) {
+            for ( const auto & file : program->files() ) {
+                try {
+                    watcher.watch( file );
+                }
+                catch ( const exception & e ) {
+                    result << "    " << e.what() << endl;
+                }
+            }
+        }
+        flush_traces();
+        cout << result.str() << flush;
+    };
+
+    for ( size_t i = 0; i < programs.size(); ++ i )
+        compile( i, {} );
+    cout << "Watching " << options.sources.size() << " sources." << endl;
+    while ( true ) {
+        const auto changed = watcher.wait( chrono::hours( 1 ), Quiet );
+        for ( size_t i = 0; i < programs.size(); ++ i ) {
+            const auto files = programs[ i ] ? programs[ i ]->files() : set< string >{};
+            if ( ranges::any_of( changed, [&]( const string & file ) { return files.contains( file ); } ) )
+                compile( i, changed );
+        }
+    }
+}
+
+void print_usage( ostream & out ) {
+    out << "Usage: recumpose [options] <source.rcl | directory>..." << endl;
+    out << "Compiles every specified source (directories are searched for *.rcl recursively) concurrently." << endl;
+    out << "    -j, --jobs N    number of worker threads" << endl;
+    out << "    --plot          plot graphs of every source with Graphviz" << endl;
+    out << "    --plot-format F write plots as dot (rendered with Graphviz), json (adjacency lists) or graphml" << endl;
+    out << "    --plot-split S  write plots whole, per source file (\"file\") or per entity (\"entity\")" << endl;
+    out << "    --verbose       print all the compilation traces" << endl;
+    out << "    --trace SPEC    trace level for all categories (\"debug\") or single one (\"lexer=verbose\")," << endl;
+    out << "                    levels: error, info, debug, verbose; categories: lexer, parser, semantic, evaluation, driver" << endl;
+    out << "    --evaluate      run semantic analysis and print evaluated outputs" << endl;
+    out << "    --stats         print phase timings and counters of every compilation as single line of JSON" << endl;
+    out << "    --timeline FILE write timeline of all the compilation phases on all the threads to FILE (view with chrome://tracing or ui.perfetto.dev)" << endl;
+    out << "    --max-branches N      solve at most N branches of every source (the cheapest first), dropping the rest" << endl;
+    out << "    --max-branch-memory MB  drop the most expensive pending branches once branches of single source take more memory" << endl;
+    out << "    --graph-cache DIR     load graphs of unchanged sources (along with their includes) from DIR instead of parsing them, store parsed ones there" << endl;
+    out << "    --branch-state DIR    resume branches of every source from DIR and store them there, so the rest of them is solved by the next run" << endl;
+    out << "    --watch         compile sources again every time any of their files changes, parsing only the changed statements" << endl;
+    out << "    --lsp           run as language server over stdin/stdout, keeping every open source parsed in memory and evaluating it on demand" << endl;
+}
+
+/** Parses positive decimal number which is the whole text. Returns false if it's malformed, out of range or zero.*/
+bool parse_count( const string & text, size_t & value ) {
+    size_t parsed = 0;
+    const auto end = text.data() + text.size();
+    const auto [ ptr, error ] = from_chars( text.data(), end, parsed );
+    if ( error != errc() || ptr != end || parsed == 0 )
+        return false;
+    value = parsed;
+    return true;
+}
+
+/** Returns false if arguments are malformed.*/
+bool parse_arguments( const int argc, char * argv[], Options & options ) {
+    for ( int i = 1; i < argc; ++ i ) {
+        const string arg = argv[ i ];
+        if ( arg == "--plot" )
+            options.plot = true;
+        else if ( arg == "--plot-format" ) {
+            if ( ++ i >= argc )
+                return false;
+            const string format = argv[ i ];
+            if ( format == "dot" )
+                options.plot_format = GRAPH_FORMAT::DOT;
+            else if ( format == "json" )
+                options.plot_format = GRAPH_FORMAT::JSON;
+            else if ( format == "graphml" )
+                options.plot_format = GRAPH_FORMAT::GRAPHML;
+            else
+                return false;
+        }
+        else if ( arg == "--plot-split" ) {
+            if ( ++ i >= argc )
+                return false;
+            const string split = argv[ i ];
+            if ( split == "whole" )
+                options.plot_split = GRAPH_SPLIT::WHOLE;
+            else if ( split == "file" )
+                options.plot_split = GRAPH_SPLIT::PER_SOURCE_FILE;
+            else if ( split == "entity" )
+                options.plot_split = GRAPH_SPLIT::PER_ENTITY;
+            else
+                return false;
+        }
+        else if ( arg == "--verbose" )
+            set_trace_level( TRACE_LEVEL::VERBOSE );
+        else if ( arg == "--trace" ) {
+            if ( ++ i >= argc || ! set_trace_level( string( argv[ i ] ) ) )
+                return false;
+        }
+        else if ( arg == "--evaluate" )
+            options.evaluate = true;
+        else if ( arg == "--stats" )
+            options.stats = true;
+        else if ( arg == "--timeline" ) {
+            if ( ++ i >= argc )
+                return false;
+            options.timeline = argv[ i ];
+        }
+        else if ( arg == "--max-branches" ) {
+            if ( ++ i >= argc || ! parse_count( argv[ i ], options.budget.branches ) )
+                return false;
+        }
+        else if ( arg == "--max-branch-memory" ) {
+            size_t megabytes = 0;
+            if ( ++ i >= argc || ! parse_count( argv[ i ], megabytes ) || megabytes > ( size_t( INT64_MAX ) >> 20 ) )
+                return false;
+            options.budget.bytes = int64_t( megabytes ) << 20;
+        }
+        else if ( arg == "--graph-cache" ) {
+            if ( ++ i >= argc )
+                return false;
+            options.graph_cache = argv[ i ];
+        }
+        else if ( arg == "--branch-state" ) {
+            if ( ++ i >= argc )
+                return false;
+            options.branch_state = argv[ i ];
+        }
+        else if ( arg == "--lsp" )
+            options.lsp = true;
+        else if ( arg == "--watch" )
+            options.watch = true;
+        else if ( arg == "-j" || arg == "--jobs" ) {
+            if ( ++ i >= argc || ! parse_count( argv[ i ], options.jobs ) )
+                return false;
+        }
+        else if ( arg.starts_with( "-" ) )
+            return false;
+        else if ( filesystem::is_directory( arg ) ) {
+            vector< string > found;
+            for ( const auto & entry : filesystem::recursive_directory_iterator( arg ) ) {
+                if ( entry.is_regular_file() && entry.path().extension() == ".rcl" )
+                    found.push_back( entry.path().string() );
+            }
+            sort( found.begin(), found.end() );
+            options.sources.insert( options.sources.end(), found.begin(), found.end() );
+        }
+        else
+            options.sources.push_back( arg );
+    }
+    return options.lsp || ! options.sources.empty();
 }
 
-int main() {
-    //process( "../samples/program_1.rcl" );
-    process( "../samples/falcon.rcl" );
-    //process( "../samples/square_equation.rcl" );
+int main( int argc, char * argv[] ) {
+    Options options;
+    if ( ! parse_arguments( argc, argv, options ) ) {
+        print_usage( cerr );
+        return 2;
+    }
+
+    if ( options.lsp ) {
+        //stdout carries the protocol:
+        trace_sink().redirect( cerr );
+        ThreadPool pool( options.jobs );
+        return LanguageServer( cin, cout, pool ).run();
+    }
+
+    if ( ! options.timeline.empty() )
+        timeline().enabled = true;
+    if ( ! options.branch_state.empty() )
+        filesystem::create_directories( options.branch_state );
+
+    if ( options.watch ) {
+        ThreadPool pool( options.jobs );
+        return watch( options, pool );
+    }
+
+    mutex out_guard;
+    atomic< size_t > failed = 0;
+    ThreadPool pool( options.jobs );
+    //every source is compiled into it's own isolated graph:
+    pool.parallel_for( options.sources.size(), [&]( const size_t i ) {
+        const auto & source = options.sources[ i ];
+        ostringstream result;
+        Stats stats;
+        StatsScope scope( & stats );
+        TimelineSpan span( source );
+        bool ok = false;
+        try {
+            const auto outputs = process( source, options, pool );
+            ok = true;
+            result << "OK " << source << endl;
+            for ( const auto & output : outputs )
+                result << "    " << output.first << " = " << output.second << endl;
+        }
+        catch ( const exception & e ) {
+            ++ failed;
+            result << "FAILED " << source << ": " << e.what() << endl;
+        }
+        if ( options.stats ) {
+            result << "{\"source\":";
+            write_json_string( result, source );
+            result << ",\"ok\":" << ( ok ? "true" : "false" ) << ",\"stats\":";
+            stats.write_json( result );
+            result << "}" << endl;
+        }
+        lock_guard< mutex > lock( out_guard );
+        flush_traces();
+        cout << result.str() << flush;
+    } );
+
+    //plots are rendered in the background meanwhile:
+    render_jobs().wait();
+    flush_traces();
+    cout << options.sources.size() - failed << " of " << options.sources.size() << " sources compiled." << endl;
+
+    if ( ! options.timeline.empty() ) {
+        timeline().enabled = false;
+        ofstream target( options.timeline );
+        timeline().write_json( target );
+        if ( ! target ) {
+            cerr << "ERROR: failed to write timeline to " << options.timeline << endl;
+            return 1;
+        }
+    }
 
     //every composition needs to be reversible (so to define sqrt() function you'll have to define complex numbers and thus recompose (+),(-),(*), etc)
 
@@ -37,7 +407,7 @@ int main() {
 
     //the resulting graph might get shrunk to the lowest possible size (although can get functionized if properly represented with lie-groups on data-types (which are algebraic since compositions are reversible)) and outputed as is or directly executed as regular functional program
 
-    return 0;
+    return failed > 0 ? 1 : 0;
 }
 
 /**
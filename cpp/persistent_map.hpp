@@ -0,0 +1,227 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "stats.hpp"
+
+using namespace std;
+
+/** Hash array mapped trie: copying is O(1) since copies share the whole trie, while every change copies only the path (of at most 64 / Bits tries) to the changed entry, so copies pay only for what they change. Tries owned by single map are changed in place. Memory of tries is accounted to specified MEMORY subsystem.*/
+template< typename Key, typename Value, MEMORY Memory >
+struct PersistentMap {
+    /** Hash bits consumed by every level of the trie.*/
+    static constexpr uint32_t Bits = 5;
+    static constexpr uint64_t Mask = ( 1u << Bits ) - 1;
+
+    size_t size() const {
+        return count;
+    }
+    bool empty() const {
+        return count == 0;
+    }
+
+    /** Returns nullptr if there is no such key.*/
+    const Value * find( const Key & key ) const {
+        const auto hash = hash_of( key );
+        const Trie * trie = root.get();
+        for ( uint32_t shift = 0; trie != nullptr; shift += Bits ) {
+            if ( shift >= 64 ) {
+                for ( const auto & slot : trie->slots ) {
+                    if ( slot.key == key )
+                        return & slot.value;
+                }
+                return nullptr;
+            }
+            const uint32_t bit = 1u << ( ( hash >> shift ) & Mask );
+            if ( ! ( trie->bitmap & bit ) )
+                return nullptr;
+            const auto & slot = trie->slots[ popcount( trie->bitmap & ( bit - 1 ) ) ];
+            if ( slot.child ) {
+                trie = slot.child.get();
+                continue;
+            }
+            return slot.key == key ? & slot.value : nullptr;
+        }
+        return nullptr;
+    }
+    bool contains( const Key & key ) const {
+        return find( key ) != nullptr;
+    }
+    const Value & at( const Key & key ) const {
+        const auto value = find( key );
+        if ( value == nullptr )
+            throw out_of_range( "PersistentMap::at(): no such key" );
+        return * value;
+    }
+
+    /** Inserts or replaces the value of key.*/
+    void set( const Key & key, const Value & value ) {
+        if ( insert( root, 0, hash_of( key ), key, value ) )
+            ++ count;
+    }
+
+    /** Bytes of tries owned by this map alone: released once it's destroyed (or replaced), while tries shared with copies stay.*/
+    int64_t owned_bytes() const {
+        return root.use_count() == 1 ? owned( * root ) : 0;
+    }
+
+    /** Calls func( key, value ) for every entry in unspecified (yet deterministic for the same keys) order.*/
+    template< typename Func >
+    void for_each( const Func & func ) const {
+        if ( root )
+            visit( * root, func );
+    }
+
+    /** Calls func( key, value ) for every entry which is absent in base or has another value there. Tries shared with base are skipped as a whole, so diffing a copy against the map it was copied from costs only as much as the copy changed.*/
+    template< typename Func >
+    void for_each_difference( const PersistentMap & base, const Func & func ) const {
+        if ( root )
+            difference( * root, base.root.get(), 0, base, func );
+    }
+
+private:
+    struct Trie;
+    using Child = shared_ptr< Trie >;
+
+    /** Either entry or subtrie (if child is set).*/
+    struct Slot {
+        uint64_t hash = 0;
+        Key key{};
+        Value value{};
+        Child child;
+    };
+
+    /** Slots are ordered by their bit within bitmap. The deepest tries (without hash bits left) hold colliding entries unordered.*/
+    struct Trie {
+        uint32_t bitmap = 0;
+        vector< Slot > slots;
+        int64_t charged = 0;
+
+        Trie() {
+            account();
+        }
+        Trie( const Trie & other ): bitmap( other.bitmap ), slots( other.slots ) {
+            account();
+        }
+        Trie & operator =( const Trie & ) = delete;
+        ~Trie() {
+            charge_memory( Memory, - charged );
+        }
+
+        void account() {
+            const int64_t bytes = sizeof( Trie ) + slots.capacity() * sizeof( Slot );
+            charge_memory( Memory, bytes - charged );
+            charged = bytes;
+        }
+    };
+
+    Child root;
+    size_t count = 0;
+
+    /** Pointers and integers are hashed as they are, so they're mixed (bijectively) to spread over the trie.*/
+    static uint64_t hash_of( const Key & key ) {
+        uint64_t h = std::hash< Key >{}( key );
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebull;
+        h ^= h >> 31;
+        return h;
+    }
+
+    /** Copies trie if it's shared. Returns true if key was added.*/
+    static bool insert( Child & trie, const uint32_t shift, const uint64_t hash, const Key & key, const Value & value ) {
+        if ( ! trie )
+            trie = make_shared< Trie >();
+        else if ( trie.use_count() > 1 )
+            trie = make_shared< Trie >( * trie );
+
+        if ( shift >= 64 ) {
+            for ( auto & slot : trie->slots ) {
+                if ( slot.key == key ) {
+                    slot.value = value;
+                    return false;
+                }
+            }
+            trie->slots.push_back( { hash, key, value, nullptr } );
+            trie->account();
+            return true;
+        }
+
+        const uint32_t bit = 1u << ( ( hash >> shift ) & Mask );
+        const auto index = popcount( trie->bitmap & ( bit - 1 ) );
+        if ( ! ( trie->bitmap & bit ) ) {
+            trie->bitmap |= bit;
+            trie->slots.insert( trie->slots.begin() + index, { hash, key, value, nullptr } );
+            trie->account();
+            return true;
+        }
+
+        auto & slot = trie->slots[ index ];
+        if ( slot.child )
+            return insert( slot.child, shift + Bits, hash, key, value );
+        if ( slot.key == key ) {
+            slot.value = value;
+            return false;
+        }
+        //entry is pushed down into subtrie along with the new one:
+        Child child;
+        insert( child, shift + Bits, slot.hash, slot.key, slot.value );
+        insert( child, shift + Bits, hash, key, value );
+        slot.key = Key{};
+        slot.value = Value{};
+        slot.child = move( child );
+        return true;
+    }
+
+    static int64_t owned( const Trie & trie ) {
+        auto bytes = trie.charged;
+        for ( const auto & slot : trie.slots ) {
+            if ( slot.child && slot.child.use_count() == 1 )
+                bytes += owned( * slot.child );
+        }
+        return bytes;
+    }
+
+    template< typename Func >
+    static void visit( const Trie & trie, const Func & func ) {
+        for ( const auto & slot : trie.slots ) {
+            if ( slot.child )
+                visit( * slot.child, func );
+            else
+                func( slot.key, slot.value );
+        }
+    }
+
+    /** Compares trie against the trie at the same position of base (if any).*/
+    template< typename Func >
+    static void difference( const Trie & trie, const Trie * other, const uint32_t shift, const PersistentMap & base, const Func & func ) {
+        if ( & trie == other )
+            return;
+        const auto & differs = [&]( const Key & key, const Value & value ) {
+            const auto found = base.find( key );
+            if ( found == nullptr || ! ( * found == value ) )
+                func( key, value );
+        };
+        if ( other == nullptr || shift >= 64 ) {
+            visit( trie, differs );
+            return;
+        }
+        uint32_t bitmap = trie.bitmap;
+        for ( const auto & slot : trie.slots ) {
+            const uint32_t bit = bitmap & ( ~ bitmap + 1 );
+            bitmap &= bitmap - 1;
+            const Slot * counterpart = other->bitmap & bit ? & other->slots[ popcount( other->bitmap & ( bit - 1 ) ) ] : nullptr;
+            if ( slot.child && counterpart != nullptr && counterpart->child )
+                difference( * slot.child, counterpart->child.get(), shift + Bits, base, func );
+            else if ( slot.child )
+                visit( * slot.child, differs );
+            else
+                differs( slot.key, slot.value );
+        }
+    }
+};
@@ -4,20 +4,28 @@
 #include <set>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <memory>
+#include <algorithm>
 #include <cstdlib>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "syntax_tree.hpp"
+#include "trace.hpp"
+#include "json.hpp"
 using namespace std;
 
 /** Should return source name's caption i.e. "falcon" from "../samples/falcon.rcl", etc..*/
-string source_caption( const string & source_name ) {
-    auto start_pos = source_name.find_last_of( '/' );
-    if ( start_pos != string::npos )
-        ++ start_pos;
-    if ( start_pos >= source_name.size() )
-        start_pos = string::npos;
+inline string source_caption( const string & source_name ) {
+    const auto slash = source_name.find_last_of( '/' );
+    const auto start_pos = slash == string::npos ? 0 : slash + 1;
 
     const auto last_pos = source_name.find_last_of( '.' );
     const auto len =
-        last_pos == string::npos || start_pos == string::npos
+        last_pos == string::npos || last_pos < start_pos
         ?
         string::npos
         :
@@ -27,83 +35,420 @@ string source_caption( const string & source_name ) {
     return source_name.substr( start_pos,  len );
 }
 
-/** DOT language output utility.*/
-struct Plot {
-    enum TYPE {
-        UNDIRECTED,
-        DIRECTED,
-    };
-    TYPE type;
+/** Renders DOT files with Graphviz on background threads, so compilation never waits for it. Pending renders are completed on destruction.*/
+struct RenderJobs {
+    RenderJobs( const size_t threads_count = 2 ) {
+        for ( size_t i = 0; i < threads_count; ++ i )
+            threads.emplace_back( [ this ]{ work(); } );
+    }
+    RenderJobs( const RenderJobs & ) = delete;
+    RenderJobs & operator =( const RenderJobs & ) = delete;
+    ~RenderJobs() {
+        {
+            lock_guard< mutex > lock( guard );
+            stopping = true;
+        }
+        wake.notify_all();
+        for ( auto & t : threads )
+            t.join();
+    }
 
-    ofstream o;
-    string name;
+    /** Enqueues rendering of name.dot into name.png.*/
+    void render( const string & name ) {
+        {
+            lock_guard< mutex > lock( guard );
+            pending.push_back( name );
+        }
+        wake.notify_one();
+    }
+    /** Blocks until all the enqueued renders are completed.*/
+    void wait() {
+        unique_lock< mutex > lock( guard );
+        done.wait( lock, [&]{ return pending.empty() && running == 0; } );
+    }
+
+private:
+    mutex guard;
+    condition_variable wake;
+    condition_variable done;
+    deque< string > pending;
+    size_t running = 0;
+    bool stopping = false;
+    vector< thread > threads;
 
-    Plot(
-        TYPE type = TYPE::DIRECTED,
-        const string & name = string( "graph" )
-    ): type(type), name(name) {
-        o.open( name + ".dot" );
-        o << ( type == TYPE::DIRECTED ? "digraph " : "graph " ) << name << " {" << endl;
+    void work() {
+        unique_lock< mutex > lock( guard );
+        while ( true ) {
+            wake.wait( lock, [&]{ return ! pending.empty() || stopping; } );
+            if ( pending.empty() )
+                return;
+            const auto name = move( pending.front() );
+            pending.pop_front();
+            ++ running;
+            lock.unlock();
+            const string command = string( "dot -Tpng \"" ) + name + ".dot\" -o \"" + name + ".png\"";
+            if ( system( command.c_str() ) != 0 ) {
+                TRACE( DRIVER, ERROR ) << "ERROR: failed to render " << name << ".dot";
+            }
+            lock.lock();
+            -- running;
+            if ( pending.empty() && running == 0 )
+                done.notify_all();
+        }
     }
+};
+/** Process-wide renders: completed once the process exits at last.*/
+inline RenderJobs & render_jobs() {
+    static RenderJobs jobs;
+    return jobs;
+}
 
-    void relation( const auto & from, const auto & to ) {
-        o << "    " << from << f() << to << ";" << endl;
+/** DOT string literal.*/
+inline string dot_quoted( const string & s ) {
+    string result = "\"";
+    for ( const auto ch : s ) {
+        if ( ch == '"' || ch == '\\' )
+            result += '\\';
+        if ( ch == '\n' )
+            result += "\\n";
+        else
+            result += ch;
     }
-    /** Redefine displayed name of id node.*/
-    void label( const auto & id, const auto & name ) {
-        o << "    " << id << " [label=\"" << name << "\"];" << endl;
+    return result + "\"";
+}
+/** XML attribute value or text.*/
+inline string xml_escaped( const string & s ) {
+    string result;
+    for ( const auto ch : s ) {
+        switch ( ch ) {
+            case '&': result += "&amp;"; break;
+            case '<': result += "&lt;"; break;
+            case '>': result += "&gt;"; break;
+            case '"': result += "&quot;"; break;
+            default: result += ch;
+        }
     }
+    return result;
+}
+
+/** Orders nodes as they appear in source (ties are broken by contents, TYPEs and numbers of references), which is the same for the same graph whatever nodes addresses are.*/
+inline bool content_order( Node * left, Node * right ) {
+    if ( left->source_pos != right->source_pos )
+        return left->source_pos < right->source_pos;
+    if ( left->content != right->content )
+        return left->content < right->content;
+    if ( left->types != right->types )
+        return left->types < right->types;
+    return pair( left->refs.size(), left->refd.size() ) < pair( right->refs.size(), right->refd.size() );
+}
 
-    ~Plot() {
-        o << "}" << endl;
-        const string command = string( "dot -Tpng " ) + name + ".dot" + " -o " + name + ".png";
-        system( command.c_str() );
+/** How many steps away adjacents of nodes equal by content_order() are compared by structure_compare().*/
+constexpr size_t StructureDepth = 2;
+
+/** Compares nodes by content_order() and then by their references and referrers (ordered the same way) compared recursively up to depth steps away. Returns negative, zero or positive as strcmp() does.*/
+inline int structure_compare( Node * left, Node * right, const size_t depth ) {
+    if ( content_order( left, right ) )
+        return -1;
+    if ( content_order( right, left ) )
+        return 1;
+    if ( depth == 0 )
+        return 0;
+    const auto & sorted = [&]( const set< Node * > & nodes ) {
+        vector< Node * > result( nodes.begin(), nodes.end() );
+        stable_sort( result.begin(), result.end(), [&]( Node * l, Node * r ) {
+            return structure_compare( l, r, depth - 1 ) < 0;
+        } );
+        return result;
+    };
+    //numbers of references are equal by content_order():
+    for ( const auto adjacents : { & Node::refs, & Node::refd } ) {
+        const auto l = sorted( left->*adjacents );
+        const auto r = sorted( right->*adjacents );
+        for ( size_t i = 0; i < l.size(); ++ i ) {
+            if ( const auto order = structure_compare( l[ i ], r[ i ], depth - 1 ) )
+                return order;
+        }
     }
-    auto f() {
-        return type == TYPE::DIRECTED ? " -> " : " -- ";
+    return 0;
+}
+
+/** Numbers every node reachable from root in the order it's first discovered going breadth first (as pulse() does), with adjacents of every node taken in structure_compare() order, so nodes equal by content_order() are told apart by their place in the graph.
+Adjacents of the same node which are equal even by structure_compare() (symmetric within StructureDepth steps) are left in the order of their addresses: only graphs with such nodes might be numbered differently between runs.*/
+inline unordered_map< Node *, size_t > discovery_order( Node * root ) {
+    unordered_map< Node *, size_t > discovered = { { root, 0 } };
+    vector< Node * > queue = { root };
+    vector< Node * > adjacents;
+    for ( size_t i = 0; i < queue.size(); ++ i ) {
+        adjacents.clear();
+        for ( auto array : { & queue[ i ]->refs, & queue[ i ]->refd } ) {
+            for ( auto next : * array ) {
+                if ( ! discovered.contains( next ) )
+                    adjacents.push_back( next );
+            }
+        }
+        stable_sort( adjacents.begin(), adjacents.end(), []( Node * left, Node * right ) {
+            return structure_compare( left, right, StructureDepth ) < 0;
+        } );
+        for ( auto next : adjacents ) {
+            if ( discovered.emplace( next, discovered.size() ).second )
+                queue.push_back( next );
+        }
     }
+    count_stat( & Stats::pulses );
+    count_stat( & Stats::nodes_visited, queue.size() );
+    return discovered;
+}
+
+/** Orders nodes in content_order() and the rest by discovery_order(), so ids assigned in this order are the same for the same graph (see discovery_order() for the exception).*/
+inline bool stable_order( Node * left, Node * right, const unordered_map< Node *, size_t > & discovered ) {
+    if ( content_order( left, right ) )
+        return true;
+    if ( content_order( right, left ) )
+        return false;
+    return discovered.at( left ) < discovered.at( right );
+}
+
+inline string plot_label( Node * node ) {
+    if ( node->type( TYPE::LINE ) )
+        return string( "line " ) + to_string( node->source_pos.line );
+    else
+        return node->content;
+}
+
+enum GRAPH_FORMAT {
+    /** Graphviz: name.dot, rendered into name.png if requested.*/
+    DOT,
+    /** Adjacency lists: name.json of nodes along with ids of nodes they reference.*/
+    JSON,
+    /** name.graphml*/
+    GRAPHML,
+};
+/** How large graphs are split into separate outputs, so tools can open them.*/
+enum GRAPH_SPLIT {
+    WHOLE,
+    /** name_<caption>: nodes positioned within every source file.*/
+    PER_SOURCE_FILE,
+    /** name_<entity>: nodes reachable from every ENTITY (through anything but other ENTITYs) which aren't reachable from the previous ones; nodes outside of ENTITYs go into name itself.*/
+    PER_ENTITY,
 };
 
-auto name( Node * node ) {
-    return (uint64_t) (void const *) node;
+/** Single output of export_graph(): nodes of specified TYPEs and edges among them.*/
+struct ExportView {
+    /** Output file name without extension.*/
+    string name;
+    set< TYPE > types;
+    GRAPH_FORMAT format = GRAPH_FORMAT::DOT;
+    /** Whether DOT output is rendered (see render_jobs()) once it's written.*/
+    bool render = false;
 };
 
-template< typename PlotTypes >
-auto plot(
-    Node * root,
-    const PlotTypes & plot_types = {},
-    const auto & graph_name = "graph"
-) {
-    Plot p( Plot::TYPE::DIRECTED, graph_name );
-    map< uint64_t, string > labels;
+/** Writes single output in any of GRAPH_FORMATs: buffered and written in big chunks, nodes are written along with all their edges at once. Nodes referenced from the output but not written into it (those of other clusters) are declared at the end, so every edge has both ends.*/
+struct GraphWriter {
+    GraphWriter( const string & name, const GRAPH_FORMAT format, const bool render ): name( name ), format( format ), render( render ) {
+        static const char * Extensions[] = { ".dot", ".json", ".graphml" };
+        file_name = name + Extensions[ format ];
+        o.open( file_name );
+        switch ( format ) {
+            case GRAPH_FORMAT::DOT:
+                buffer = "digraph " + dot_quoted( source_caption( name ) ) + " {\n";
+                break;
+            case GRAPH_FORMAT::JSON:
+                buffer = "{\"nodes\":[";
+                break;
+            case GRAPH_FORMAT::GRAPHML:
+                buffer =
+                    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                    "<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\">\n"
+                    "  <key id=\"label\" for=\"node\" attr.name=\"label\" attr.type=\"string\"/>\n"
+                    "  <key id=\"types\" for=\"node\" attr.name=\"types\" attr.type=\"string\"/>\n"
+                    "  <key id=\"position\" for=\"node\" attr.name=\"position\" attr.type=\"string\"/>\n"
+                    "  <graph id=\"G\" edgedefault=\"directed\">\n";
+                break;
+        }
+    }
+    GraphWriter( const GraphWriter & ) = delete;
+    GraphWriter & operator =( const GraphWriter & ) = delete;
+    ~GraphWriter() {
+        for ( const auto & [ id, node ] : external ) {
+            if ( ! written.contains( id ) )
+                write_node( id, node, {} );
+        }
+        switch ( format ) {
+            case GRAPH_FORMAT::DOT: buffer += "}\n"; break;
+            case GRAPH_FORMAT::JSON: buffer += "]}\n"; break;
+            case GRAPH_FORMAT::GRAPHML: buffer += "  </graph>\n</graphml>\n"; break;
+        }
+        o.write( buffer.data(), buffer.size() );
+        o.close();
+        if ( ! o ) {
+            TRACE( DRIVER, ERROR ) << "ERROR: failed to write " << file_name;
+        }
+        else if ( render && format == GRAPH_FORMAT::DOT )
+            render_jobs().render( name );
+    }
 
-    const auto & should_plot = [&]( Node * node ) {
-        return node->type( plot_types );
-    };
-    const auto & label = [&]( Node * node ) {
-        if ( node->type( TYPE::LINE ) )
-            return string( "line " ) + to_string( node->source_pos.line );
-        else
-            return node->content;
-    };
+    /** Writes node along with edges to the nodes it references.*/
+    void node( const size_t id, Node * node, const vector< pair< size_t, Node * > > & refs ) {
+        written.insert( id );
+        write_node( id, node, refs );
+        for ( const auto & ref : refs )
+            external.emplace( ref.first, ref.second );
+        if ( buffer.size() >= Chunk ) {
+            o.write( buffer.data(), buffer.size() );
+            buffer.clear();
+        }
+    }
+
+    const string & written_file() const {
+        return file_name;
+    }
+
+private:
+    static constexpr size_t Chunk = 1 << 20;
 
-    const auto & on_node = [&]( Node * node ) {
-        if ( ! should_plot( node ) )
-            return;
-        for ( const auto & ref : node->refs ) {
-            if ( ! should_plot( ref ) )
+    const string name;
+    const GRAPH_FORMAT format;
+    const bool render;
+    string file_name;
+    ofstream o;
+    string buffer;
+    bool first = true;
+    set< size_t > written;
+    /** Nodes edges lead to.*/
+    map< size_t, Node * > external;
+
+    void write_node( const size_t id, Node * node, const vector< pair< size_t, Node * > > & refs ) {
+        ostringstream types;
+        for ( const auto & type : node->types )
+            types << ( types.tellp() > 0 ? " " : "" ) << type;
+        ostringstream position;
+        position << node->source_pos;
+        switch ( format ) {
+            case GRAPH_FORMAT::DOT: {
+                buffer += "    n" + to_string( id ) + " [label=" + dot_quoted( plot_label( node ) ) + "];\n";
+                for ( const auto & ref : refs )
+                    buffer += "    n" + to_string( id ) + " -> n" + to_string( ref.first ) + ";\n";
+                break;
+            }
+            case GRAPH_FORMAT::JSON: {
+                ostringstream json;
+                json << ( first ? "\n" : ",\n" ) << "{\"id\":" << id << ",\"label\":";
+                write_json_string( json, plot_label( node ) );
+                json << ",\"types\":";
+                write_json_string( json, types.str() );
+                json << ",\"file\":";
+                write_json_string( json, node->source_pos.file );
+                json << ",\"line\":" << node->source_pos.line << ",\"refs\":[";
+                for ( size_t r = 0; r < refs.size(); ++ r )
+                    json << ( r > 0 ? "," : "" ) << refs[ r ].first;
+                json << "]}";
+                buffer += json.str();
+                break;
+            }
+            case GRAPH_FORMAT::GRAPHML: {
+                buffer += "    <node id=\"n" + to_string( id ) + "\"><data key=\"label\">" + xml_escaped( plot_label( node ) ) + "</data><data key=\"types\">" + xml_escaped( types.str() ) + "</data><data key=\"position\">" + xml_escaped( position.str() ) + "</data></node>\n";
+                for ( const auto & ref : refs )
+                    buffer += "    <edge source=\"n" + to_string( id ) + "\" target=\"n" + to_string( ref.first ) + "\"/>\n";
+                break;
+            }
+        }
+        first = false;
+    }
+};
+
+/** Cluster (see GRAPH_SPLIT) of every node: suffix of output names, empty for nodes of the whole graph.*/
+inline unordered_map< Node *, string > graph_clusters( const vector< Node * > & nodes, const GRAPH_SPLIT split ) {
+    unordered_map< Node *, string > clusters;
+    clusters.reserve( nodes.size() );
+    if ( split == GRAPH_SPLIT::PER_SOURCE_FILE ) {
+        for ( auto node : nodes )
+            clusters.emplace( node, "_" + source_caption( node->source_pos.file ) );
+    }
+    else if ( split == GRAPH_SPLIT::PER_ENTITY ) {
+        map< string, size_t > names;
+        for ( auto entity : nodes ) {
+            if ( ! entity->type( TYPE::ENTITY ) || clusters.contains( entity ) )
                 continue;
-            
-            p.relation( name( node ), name( ref ) );
-            
-            labels[ name( node ) ] = label( node );
-            labels[ name( ref  ) ] = label( ref  );
+            //named after the TERM it's composed on:
+            string name = entity->content.substr( 0, entity->content.find( ' ' ) );
+            for ( auto & ch : name ) {
+                if ( ! isalnum( ch ) )
+                    ch = '_';
+            }
+            const auto index = names[ name ] ++;
+            const auto cluster = "_" + name + ( index > 0 ? "_" + to_string( index ) : "" );
+            pulse< true, false >( entity, [&]( Node * node ) {
+                clusters.emplace( node, cluster );
+            }, false, set{ TYPE::ENTITY, TYPE::SOURCE_FILE, TYPE::LINE, TYPE::INCLUDE } );
         }
-    };
-    pulse( root, on_node );
+        for ( auto node : nodes )
+            clusters.emplace( node, "" );
+    }
+    else {
+        for ( auto node : nodes )
+            clusters.emplace( node, "" );
+    }
+    return clusters;
+}
+
+/** Writes every view of the graph (along with every cluster of it if split) within single traversal: every node is visited once and written into every view it belongs to. Nodes are numbered in stable_order() across all the views, so the same node has the same id within every output.
+@return names of written files.*/
+inline vector< string > export_graph( Node * root, const vector< ExportView > & views, const GRAPH_SPLIT split = GRAPH_SPLIT::WHOLE ) {
+    //nodes of any view:
+    const auto discovered = discovery_order( root );
+    vector< Node * > nodes;
+    for ( const auto & [ node, order ] : discovered ) {
+        for ( const auto & view : views ) {
+            if ( node->type( view.types ) ) {
+                nodes.push_back( node );
+                break;
+            }
+        }
+    }
+    sort( nodes.begin(), nodes.end(), [&]( Node * left, Node * right ) {
+        return stable_order( left, right, discovered );
+    } );
+    unordered_map< Node *, size_t > ids;
+    ids.reserve( nodes.size() );
+    for ( auto node : nodes )
+        ids.emplace( node, ids.size() );
+    const auto clusters = graph_clusters( nodes, split );
 
-    for ( const auto & label : labels ) {
-        p.label( label.first, label.second );
+    //by view and cluster:
+    map< pair< size_t, string >, unique_ptr< GraphWriter > > writers;
+    vector< string > written;
+    vector< pair< size_t, Node * > > refs;
+    for ( auto node : nodes ) {
+        const auto & cluster = clusters.at( node );
+        for ( size_t v = 0; v < views.size(); ++ v ) {
+            const auto & view = views[ v ];
+            if ( ! node->type( view.types ) )
+                continue;
+            refs.clear();
+            for ( auto ref : node->refs ) {
+                const auto id = ids.find( ref );
+                if ( id != ids.end() && ref->type( view.types ) )
+                    refs.emplace_back( id->second, ref );
+            }
+            sort( refs.begin(), refs.end() );
+            auto & writer = writers[ { v, cluster } ];
+            if ( ! writer ) {
+                writer = make_unique< GraphWriter >( view.name + cluster, view.format, view.render );
+                written.push_back( writer->written_file() );
+            }
+            writer->node( ids.at( node ), node, refs );
+        }
     }
+    return written;
 }
 
+/** Writes graph_name.dot of nodes of specified TYPEs (and edges among them) and renders it in the background (see render_jobs()).*/
+template< typename PlotTypes >
+auto plot(
+    Node * root,
+    const PlotTypes & plot_types = {},
+    const string & graph_name = "graph",
+    const bool render = true
+) {
+    export_graph( root, { { graph_name, set< TYPE >( begin( plot_types ), end( plot_types ) ), GRAPH_FORMAT::DOT, render } } );
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "syntax_tree.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <tuple>
+
+/** Nodes of single line by the characters they span. Nodes might overlap (like EXPRESSIONs positioned as their OPERATORs), so lookups consider nodes starting up to ShortSpan characters before the queried ones, while wider nodes (like LINEs spanning everything) are kept apart and checked all: lookups stay logarithmic within lines of any length.*/
+struct LineIndex {
+    /** Widest span of nodes looked up by their start.*/
+    static constexpr int32_t ShortSpan = 64;
+
+    struct Entry {
+        int32_t char_start;
+        int32_t char_end;
+        Node * node;
+
+        auto operator <=>( const Entry & ) const = default;
+    };
+
+    void insert( Node * node ) {
+        const Entry entry{ node->source_pos.char_start, node->source_pos.char_end, node };
+        entries_of( entry ).insert( entry );
+    }
+    /** Node must be positioned as it was once inserted.*/
+    void erase( Node * node ) {
+        const Entry entry{ node->source_pos.char_start, node->source_pos.char_end, node };
+        entries_of( entry ).erase( entry );
+    }
+
+    bool empty() const {
+        return entries.empty() && wide.empty();
+    }
+    size_t size() const {
+        return entries.size() + wide.size();
+    }
+
+    /** Calls func( node ) for every node spanning any of the characters [char_start, char_end] in syntactic order. Stops once func returns false.*/
+    template< typename Func >
+    void overlapping( const int32_t char_start, const int32_t char_end, const Func & func ) const {
+        const auto from = entries.lower_bound( { char_start > INT32_MIN + ShortSpan ? char_start - ShortSpan : INT32_MIN, INT32_MIN, nullptr } );
+        const auto to = entries.upper_bound( { char_end, INT32_MAX, nullptr } );
+        merge( from, to, wide.begin(), wide.upper_bound( { char_end, INT32_MAX, nullptr } ), [&]( const Entry & entry ) {
+            if ( entry.char_end < char_start )
+                return true;
+            if constexpr ( is_same_v< invoke_result_t< Func, Node * >, bool > )
+                return func( entry.node );
+            else {
+                func( entry.node );
+                return true;
+            }
+        } );
+    }
+    bool intersects( const SourcePos & source_pos ) const {
+        bool found = false;
+        overlapping( source_pos.char_start, source_pos.char_end, [&]( Node * ) {
+            found = true;
+            return false;
+        } );
+        return found;
+    }
+
+    /** Calls func( node ) for every node in syntactic order.*/
+    template< typename Func >
+    void for_each( const Func & func ) const {
+        merge( entries.begin(), entries.end(), wide.begin(), wide.end(), [&]( const Entry & entry ) {
+            func( entry.node );
+            return true;
+        } );
+    }
+
+private:
+    /** Spanning at most ShortSpan characters.*/
+    set< Entry > entries;
+    /** Spanning more, a few per line.*/
+    set< Entry > wide;
+
+    set< Entry > & entries_of( const Entry & entry ) {
+        return entry.char_end - entry.char_start > ShortSpan ? wide : entries;
+    }
+
+    /** Calls func( entry ) for entries of both ranges in order until it returns false.*/
+    template< typename Iterator, typename Func >
+    static void merge( Iterator a, const Iterator a_end, Iterator b, const Iterator b_end, const Func & func ) {
+        while ( a != a_end || b != b_end ) {
+            auto & next = b == b_end || ( a != a_end && * a < * b ) ? a : b;
+            if ( ! func( * next ++ ) )
+                return;
+        }
+    }
+};
+
+/** Nodes by their SourcePos, per file and per line: point and range lookups take logarithmic time and iteration goes in syntactic order (the same order SourcePos are compared in).*/
+struct PositionIndex {
+    PositionIndex() = default;
+    /** Indexes every node reachable from root.*/
+    explicit PositionIndex( Node * root ) {
+        pulse( root, [&]( Node * node ) {
+            insert( node );
+        } );
+    }
+
+    void insert( Node * node ) {
+        files[ node->source_pos.file ][ node->source_pos.line ].insert( node );
+        ++ count;
+    }
+    /** Node must be positioned as it was once inserted.*/
+    void erase( Node * node ) {
+        const auto file = files.find( node->source_pos.file );
+        if ( file == files.end() )
+            return;
+        const auto line = file->second.find( node->source_pos.line );
+        if ( line == file->second.end() )
+            return;
+        const auto size = line->second.size();
+        line->second.erase( node );
+        count -= size - line->second.size();
+        if ( line->second.empty() )
+            file->second.erase( line );
+        if ( file->second.empty() )
+            files.erase( file );
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    /** Nodes spanning specified character (1-based numbered as it is in text editors) in syntactic order.*/
+    vector< Node * > at( const string & file_name, const int32_t line, const int32_t column ) const {
+        return overlapping( SourcePos( line, column, column, file_name ) );
+    }
+    /** Nodes spanning any of the characters of source_pos in syntactic order.*/
+    vector< Node * > overlapping( const SourcePos & source_pos ) const {
+        vector< Node * > result;
+        if ( const auto line = find_line( source_pos.file, source_pos.line ) )
+            line->overlapping( source_pos.char_start, source_pos.char_end, [&]( Node * node ) { result.push_back( node ); } );
+        return result;
+    }
+    bool intersects( const SourcePos & source_pos ) const {
+        const auto line = find_line( source_pos.file, source_pos.line );
+        return line != nullptr && line->intersects( source_pos );
+    }
+    /** Calls func( node ) for every node of the line in syntactic order.*/
+    template< typename Func >
+    void for_each_on_line( const string & file_name, const int32_t line, const Func & func ) const {
+        if ( const auto found = find_line( file_name, line ) )
+            found->for_each( func );
+    }
+    /** Calls func( node ) for every node in syntactic order.*/
+    template< typename Func >
+    void for_each( const Func & func ) const {
+        for ( const auto & file : files ) {
+            for ( const auto & line : file.second )
+                line.second.for_each( func );
+        }
+    }
+
+    /** Nodes in syntactic order.*/
+    template< typename Nodes >
+    static vector< Node * > sorted( const Nodes & nodes ) {
+        vector< Node * > result( begin( nodes ), end( nodes ) );
+        sort( result.begin(), result.end(), []( Node * left, Node * right ) {
+            const auto & l = left->source_pos;
+            const auto & r = right->source_pos;
+            return tie( l.file, l.line, l.char_start, l.char_end, left ) < tie( r.file, r.line, r.char_start, r.char_end, right );
+        } );
+        return result;
+    }
+
+private:
+    map< string, map< int32_t, LineIndex > > files;
+    size_t count = 0;
+
+    const LineIndex * find_line( const string & file_name, const int32_t line ) const {
+        const auto file = files.find( file_name );
+        if ( file == files.end() )
+            return nullptr;
+        const auto found = file->second.find( line );
+        return found == file->second.end() ? nullptr : & found->second;
+    }
+};
@@ -1,25 +1,33 @@
+#pragma once
+
 #include <iostream>
 #include <set>
 #include "syntax_tree.hpp"
+#include "trace.hpp"
 using namespace std;
 
 void print_evaluation( const auto & layer, Node * root ) {
-    cout << "Topo evaluation has stopped due to lock or exhaustion. Nodes evaluated: " << layer.evaluated.size() << ":" << endl;
-    cout << "    facts:" << endl;
-    for ( const auto & e : layer.evaluated )
-        cout << "        " << e << endl;
-    cout << "    values:" << endl;
-    for ( const auto & v : layer.values )
-        cout << "        " << v.first << " : " << v.second << endl;
+    if ( ! TRACING( EVALUATION, DEBUG ) )
+        return;
+
+    TRACE( EVALUATION, DEBUG ) << "Topo evaluation has stopped due to lock or exhaustion. Nodes evaluated: " << layer.evaluated.size() << ":";
+    TRACE( EVALUATION, DEBUG ) << "    facts:";
+    layer.evaluated.for_each( [&]( Node * e, bool ) {
+        TRACE( EVALUATION, DEBUG ) << "        " << e;
+    } );
+    TRACE( EVALUATION, DEBUG ) << "    values:";
+    layer.values.for_each( [&]( Node * node, const double value ) {
+        TRACE( EVALUATION, DEBUG ) << "        " << node << " : " << value;
+    } );
     
     set< Node * > needs_evaluation;
     const auto & on_ev = [&]( Node * ev ) {
-        if ( ev->type( set{ TYPE::EXPRESSION, TYPE::TERM } ) && layer.evaluated.find( ev ) == layer.evaluated.end() )
+        if ( ev->type( set{ TYPE::EXPRESSION, TYPE::TERM } ) && ! layer.evaluated.contains( ev ) )
             needs_evaluation.insert( ev );
     };
     pulse( root, on_ev );
-    cout << "    " << needs_evaluation.size() << " need to be evaluated:" << endl;
+    TRACE( EVALUATION, DEBUG ) << "    " << needs_evaluation.size() << " need to be evaluated:";
     for ( const auto & e : needs_evaluation ) {
-        cout << "        " << e << endl;
+        TRACE( EVALUATION, DEBUG ) << "        " << e;
     }
 }
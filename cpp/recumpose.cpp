@@ -0,0 +1,94 @@
+#include "recumpose.hpp"
+#include "syntactic.hpp"
+#include "semantic.hpp"
+
+#include <sstream>
+
+Program::Program( Node * root, const string & name, shared_ptr< Stats > stats ): name(name), stats(stats), compile_stats(stats), root(root) {
+    const auto & on_node = [&]( Node * node ) {
+        if ( node->type( TYPE::TERM ) && ! node->type( TYPE::NUMBER ) )
+            terms[ node->content ] = node;
+
+        //declared inputs and outputs:
+        vector< string > * declared = nullptr;
+        if ( node->type( TYPE::INPUTS ) )
+            declared = & inputs;
+        else if ( node->type( TYPE::OUTPUTS ) )
+            declared = & outputs;
+        if ( declared == nullptr )
+            return;
+        for ( const auto & ref : node->refs ) {
+            if ( ref->type( TYPE::TERM ) )
+                declared->push_back( ref->content );
+        }
+    };
+    pulse( root, on_node );
+}
+
+Program::~Program() {
+    StatsScope scope( compile_stats.get() );
+    destroy_graph( root );
+}
+
+Values Program::evaluate( const Values & input_values, Stats * evaluation_stats ) const {
+    StatsScope scope( evaluation_stats );
+    Layer layer;
+    for ( const auto & input : input_values ) {
+        const auto term = terms.find( input.first );
+        if ( term == terms.end() )
+            throw runtime_error( string( "ERROR: program " ) + name + " has no term " + input.first + " to take input value" );
+        layer.assign( term->second, input.second );
+    }
+
+    evaluate_layer( root, layer );
+
+    Values result;
+    const auto & take = [&]( const string & term_name ) {
+        const auto term = terms.find( term_name );
+        if ( term == terms.end() )
+            return;
+        if ( const auto value = layer.values.find( term->second ) )
+            result[ term_name ] = * value;
+    };
+    if ( outputs.empty() ) {
+        for ( const auto & term : terms )
+            take( term.first );
+    }
+    else {
+        for ( const auto & output : outputs )
+            take( output );
+    }
+    return result;
+}
+
+/** Expects current thread to count into specified stats.*/
+shared_ptr< const Program > compile( Node * root, const string & name, shared_ptr< Stats > stats ) {
+    if ( root == nullptr )
+        throw runtime_error( string( "ERROR: empty source " ) + name );
+    try {
+        Phase phase( "merge_occurences" );
+        merge_occurences( root );
+    }
+    catch ( ... ) {
+        destroy_graph( root );
+        throw;
+    }
+    count_types( root );
+    return shared_ptr< const Program >( new Program( root, name, stats ) );
+}
+
+shared_ptr< const Program > compile_file( const string & file_name ) {
+    ifstream file( file_name );
+    if ( ! file )
+        throw runtime_error( string( "ERROR: cannot read source file " ) + file_name );
+    auto stats = make_shared< Stats >();
+    StatsScope scope( stats.get() );
+    return compile( parse_program( file, file_name ), file_name, stats );
+}
+
+shared_ptr< const Program > compile_source( const string & source, const string & name ) {
+    istringstream buffer( source );
+    auto stats = make_shared< Stats >();
+    StatsScope scope( stats.get() );
+    return compile( parse_program( buffer, name ), name, stats );
+}
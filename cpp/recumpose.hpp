@@ -0,0 +1,52 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "stats.hpp"
+
+using namespace std;
+
+struct Node;
+
+/** Values of named TERMs: inputs supplied for evaluation or outputs it produced.*/
+using Values = map< string, double >;
+
+/** Program compiled once (parsed with all occurences merged) to be evaluated many times against different inputs.*/
+struct Program {
+    /** Name of compiled source: file name or caption of in-memory buffer.*/
+    string name;
+    /** Names of TERMs declared with "inputs" operator.*/
+    vector< string > inputs;
+    /** Names of TERMs declared with "outputs" operator.*/
+    vector< string > outputs;
+    /** Phase timings, counters and memory of this Program's compilation; memory of compiled graph stays accounted here until the Program is destroyed.*/
+    shared_ptr< const Stats > stats;
+
+    Program( const Program & ) = delete;
+    Program & operator =( const Program & ) = delete;
+    ~Program();
+
+    /** Evaluates the program against specified input values. Returns values of declared outputs or of all evaluated TERMs if program declares no outputs. Compiled graph is never modified here, so it's safe to evaluate the same Program from multiple threads simultaneously.
+    @param evaluation_stats where to count evaluation attempts if specified.*/
+    Values evaluate( const Values & input_values = {}, Stats * evaluation_stats = nullptr ) const;
+
+private:
+    Program( Node * root, const string & name, shared_ptr< Stats > stats );
+
+    /** The same as stats, but graph's memory is released into it.*/
+    shared_ptr< Stats > compile_stats;
+    /** Compiled graph owned by this Program.*/
+    Node * root;
+    /** Merged TERMs by their names.*/
+    map< string, Node * > terms;
+
+    friend shared_ptr< const Program > compile( Node * root, const string & name, shared_ptr< Stats > stats );
+};
+
+/** Compiles source file (along with all the files it includes) into reusable Program. Throws runtime_error if file cannot be read or source is semantically malformed.*/
+shared_ptr< const Program > compile_file( const string & file_name );
+/** Compiles in-memory source into reusable Program.
+@param name used as file name within source positions of compiled nodes and to resolve relative includes.*/
+shared_ptr< const Program > compile_source( const string & source, const string & name = "buffer" );
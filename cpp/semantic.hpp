@@ -1,9 +1,23 @@
+#pragma once
+
 #include "syntax_tree.hpp"
+#include "binary.hpp"
+#include "interval.hpp"
+#include "lru_cache.hpp"
+#include "persistent_map.hpp"
 #include "print.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+#include <cmath>
+#include <filesystem>
+#include <optional>
+#include <tuple>
+#include <unordered_map>
 
 /** All yet syntactically the same TERMs should merge into a single TERM (all EXPRESSIONs references need to repoint) and those dropped are removed.*/
-void merge_occurences( Node * root ) {
-    set< Node * > remove;
+inline void merge_occurences( Node * root ) {
+    GraphMutation mutation;
     map< string, Node * > terms;
 
     const auto & on_term = [&]( Node * term ) {
@@ -17,30 +31,36 @@ void merge_occurences( Node * root ) {
         }
 
         //move all expressions that reference one of these occurences into another one:
-        cout << "Merge occurence " << term << " into " << existing << endl;
-        for ( auto expr : term->refd ) {
-            if ( expr->type( set{ TYPE::EXPRESSION, TYPE::NONABELIAN } ) ) {
-                cout << "    " << expr << " -> " << existing << endl;
-                expr->ref( existing );
-            }
-        }
-        remove.insert( term );
+        TRACE( SEMANTIC, DEBUG ) << "Merge occurence " << term << " into " << existing;
+        mutation.redirect( term, existing, { TYPE::EXPRESSION, TYPE::NONABELIAN } );
+        mutation.kill( term );
     };
     pulse( root, on_term );
 
-    for ( auto & r : remove )
-        delete r;
+    mutation.commit();
 }
 
-double string_to_int( const string & content ) {
+inline double string_to_int( const string & content ) {
     char * tail;
     return strtoll( content.c_str(), & tail, 0 );
 }
 
+/** Evaluated values shared by forked Layers.*/
+using LayerValues = PersistentMap< Node *, double, MEMORY::LAYERS >;
+
+/** Returns nullptr if node wasn't evaluated.*/
+inline const double * find_value( const map< Node *, double > & values, Node * node ) {
+    const auto value = values.find( node );
+    return value == values.end() ? nullptr : & value->second;
+}
+inline const double * find_value( const LayerValues & values, Node * node ) {
+    return values.find( node );
+}
+
 /** Obtain the result of evaluation of specified node and return true if successfully obtained.*/
-bool try_use(
+inline bool try_use(
     Node * node,
-    const map< Node *, double > & evaluated,
+    const auto & evaluated,
     double & result
 ) {
     if ( node->type( TYPE::TERM ) ) {
@@ -50,15 +70,15 @@ bool try_use(
         }
     }
     //other expression or variables:
-    auto ev = evaluated.find( node );
-    if ( ev == evaluated.end() )
+    const auto ev = find_value( evaluated, node );
+    if ( ev == nullptr )
         return false;
-    result = ev->second;
+    result = * ev;
     return true;
 }
 
 /** Extract left and right nodes of specified EXPRESSION.*/
-void extract( Node * expr, Node * op, Node *& left, Node *& right ) {
+inline void extract( Node * expr, Node * op, Node *& left, Node *& right ) {
     const auto Operand = Operands.at( op->content );
     left = nullptr;
     right = nullptr;
@@ -84,16 +104,16 @@ void extract( Node * expr, Node * op, Node *& left, Node *& right ) {
             if ( left == nullptr || right == nullptr ) {
                 stringstream s;
                 s << "ERROR: couldn't resolve left and right operands of " << expr;
-                cout << s.str() << endl;
-                cout << "    it's refs:" << endl;
+                TRACE( EVALUATION, ERROR ) << s.str();
+                TRACE( EVALUATION, ERROR ) << "    it's refs:";
                 for ( auto & ref : expr->refs )
-                    cout << "        " << ref << endl;
+                    TRACE( EVALUATION, ERROR ) << "        " << ref;
                 throw runtime_error( s.str() );
             }
             if ( left == right ) {
                 stringstream s;
                 s << "ERROR: left and right operands of " << expr << " are the same; something is wrong";
-                cout << s.str() << endl;
+                TRACE( EVALUATION, ERROR ) << s.str();
                 throw runtime_error( s.str() );
             }
             break;
@@ -109,7 +129,7 @@ void extract( Node * expr, Node * op, Node *& left, Node *& right ) {
         default:
             stringstream s;
             s << "ERROR: unresolved operand type of operator " << op;
-            cout << s.str() << endl;
+            TRACE( EVALUATION, ERROR ) << s.str();
             throw runtime_error( s.str() );
     }
 }
@@ -119,18 +139,67 @@ auto apply_operator( Node * op, const auto & left, const auto & right )
     if ( op->content == "/"  )
         return left / right;
     if ( op->content == "+"  )
-        return left / right;
+        return left + right;
     if ( op->content == "-"  )
         return left - right;
     if ( op->content == "*"  )
         return left * right;
     if ( op->content == "@+" )
         return left + right;
+
+    //comparisons are true (1) or false (0):
+    if ( op->content == "<"  )
+        return double( left < right );
+    if ( op->content == ">"  )
+        return double( left > right );
+    if ( op->content == "<=" )
+        return double( left <= right );
+    if ( op->content == ">=" )
+        return double( left >= right );
+    if ( op->content == "==" )
+        return double( left == right );
+    //unary operators have just the left operand:
+    if ( op->content == "not" )
+        return double( left == 0 );
+    if ( op->content == "if" || op->content == "then" || op->content == "else" )
+        return left;
     
     throw runtime_error( string( "ERROR: undefined yet operator: " ) + op->content );
 }
 
-void assert_bidirectional_op(
+/** Extract parts of conditional EXPRESSION merged by merge_ifs(): "if", "then" and (optional) "else" EXPRESSIONs. Returns false if it's not a conditional.*/
+inline bool extract_conditional( Node * expr, Node *& if_expr, Node *& then_expr, Node *& else_expr ) {
+    if_expr = nullptr;
+    then_expr = nullptr;
+    else_expr = nullptr;
+    if ( ! expr->type( TYPE::EXPRESSION ) )
+        return false;
+
+    Node * if_then = expr;
+    if ( expr->content == "if-then-else expression" ) {
+        if_then = nullptr;
+        for ( auto ref : expr->refs ) {
+            if ( ref->content == "if-then expression" )
+                if_then = ref;
+            else if ( ref->content == "else expression" )
+                else_expr = ref;
+        }
+        if ( if_then == nullptr )
+            return false;
+    }
+    else if ( expr->content != "if-then expression" )
+        return false;
+
+    for ( auto ref : if_then->refs ) {
+        if ( ref->content == "if expression" )
+            if_expr = ref;
+        else if ( ref->content == "then expression" )
+            then_expr = ref;
+    }
+    return if_expr != nullptr && then_expr != nullptr;
+}
+
+inline void assert_bidirectional_op(
     const Node * op,
     const bool can_left,
     const bool can_right,
@@ -140,22 +209,22 @@ void assert_bidirectional_op(
     if ( can_left && can_right ) {
         stringstream s;
         s << "ERROR: both left and right operands of " << op << " are already evaluated: shouldn't evaluate it on top; something is wrong.";
-        cout << s.str() << endl;
-        throw new runtime_error( s.str() );
+        TRACE( EVALUATION, ERROR ) << s.str();
+        throw runtime_error( s.str() );
     }
 
     if ( left == nullptr && right == nullptr ) {
         stringstream s;
         s << "ERROR: bidirectional operator " << op << " requires both left and right operands.";
-        cout << s.str() << endl;
-        throw new runtime_error( s.str() );
+        TRACE( EVALUATION, ERROR ) << s.str();
+        throw runtime_error( s.str() );
     }
 }
 
 /**
 @param destination where the result of evaluation should go. Is set to any non-null value only if goes into one of OPERATOR's TERMs (like "=", "<-" ...).
 */
-bool try_evaluate(
+inline bool try_evaluate(
     Node * expr,
     const map< Node *, double > & values,
     double & value,
@@ -171,13 +240,25 @@ bool try_evaluate(
     if ( expr->type( TYPE::TERM ) )
         return false;
 
+    //conditional takes the value of the branch chosen by condition:
+    Node * if_expr;
+    Node * then_expr;
+    Node * else_expr;
+    if ( extract_conditional( expr, if_expr, then_expr, else_expr ) ) {
+        double condition;
+        if ( ! try_use( if_expr, values, condition ) )
+            return false;
+        const auto taken = condition != 0 ? then_expr : else_expr;
+        return taken != nullptr && try_use( taken, values, value );
+    }
+
     auto op = find_types( expr->refs, TYPE::OPERATOR );
     if ( op == nullptr ) {
         stringstream s;
         s << "ERROR: couldn't find an OPERATOR within expr " << expr << " refs:";
         for ( const auto & ref : expr->refs )
             s << "    " << ref << endl;
-        cout << s.str() << endl;
+        TRACE( EVALUATION, ERROR ) << s.str();
         throw runtime_error( s.str() );
     }
     
@@ -192,13 +273,17 @@ bool try_evaluate(
     bool can_right = right != nullptr && try_use( right, values, right_v );
 
     if ( ! can_left && ! can_right ) {
-        cout << "        cannot evaluate " << expr << " because none of it's both references are evaluated. It's references:" << endl;
-        for ( const auto & ref : expr->refs )
-            cout << "            " << ref << endl;
-        if ( left != nullptr )
-            cout << "        left: " << left << endl;
-        if ( right != nullptr )
-            cout << "        right: " << right << endl;
+        if ( TRACING( EVALUATION, VERBOSE ) ) {
+            TRACE( EVALUATION, VERBOSE ) << "        cannot evaluate " << expr << " because none of it's both references are evaluated. It's references:";
+            for ( const auto & ref : expr->refs )
+                TRACE( EVALUATION, VERBOSE ) << "            " << ref;
+            if ( left != nullptr ) {
+                TRACE( EVALUATION, VERBOSE ) << "        left: " << left;
+            }
+            if ( right != nullptr ) {
+                TRACE( EVALUATION, VERBOSE ) << "        right: " << right;
+            }
+        }
         return false;
     }
 
@@ -239,11 +324,11 @@ bool try_evaluate(
     }
 
     if ( left != nullptr && ! can_left ) {
-        cout << "        left operand of " << expr << " is specified but cannot be evaluated yet." << endl;
+        TRACE( EVALUATION, VERBOSE ) << "        left operand of " << expr << " is specified but cannot be evaluated yet.";
         return false;
     }
     if ( right != nullptr && ! can_right ) {
-        cout << "        right operand of " << expr << " is specified but cannot be evaluated yet." << endl;
+        TRACE( EVALUATION, VERBOSE ) << "        right operand of " << expr << " is specified but cannot be evaluated yet.";
         return false;
     }
     
@@ -252,49 +337,666 @@ bool try_evaluate(
     return true;
 }
 
-/** Single attempt of evaluating all the TERMs and EXPRESSIONs.*/
+/** Single attempt of evaluating all the TERMs and EXPRESSIONs. Copying (forking for another Branch) is O(1): copies share everything but what they change afterwards.*/
 struct Layer {
     /** some EXPRESSIONs require just the flag that it was evaluated, but some require the value.*/
-    set< Node * > evaluated;
+    PersistentMap< Node *, bool, MEMORY::LAYERS > evaluated;
     //TODO: debug mode ofc, until evaluation is sufficiently abstract:
-    map< Node *, double > values;
+    LayerValues values;
+
+    /** Evaluates node into value.*/
+    void assign( Node * node, const double value ) {
+        values.set( node, value );
+        evaluated.set( node, true );
+    }
+    /** Bytes released once this Layer is dropped (see PersistentMap::owned_bytes()).*/
+    int64_t owned_bytes() const {
+        return evaluated.owned_bytes() + values.owned_bytes();
+    }
+    /** Value of node or fallback if it wasn't evaluated.*/
+    double value_or( Node * node, const double fallback = 0 ) const {
+        const auto value = values.find( node );
+        return value == nullptr ? fallback : * value;
+    }
 };
 
-void try_evaluate_all( Node * root, Layer & layer )
-{
-    //everything pulses once:
+/** Evaluation dependencies among all the EXPRESSIONs and TERMs: node can be evaluated only after the nodes it depends on got their chance.*/
+struct Dependencies {
+    /** In order of discovery.*/
+    vector< Node * > nodes;
+    unordered_map< Node *, size_t > index;
+    /** Indices of nodes every node depends on.*/
+    vector< vector< size_t > > on;
+};
+
+/** Expression depends on it's operands, while operands it might assign (with "=", "<-" or "->") depend on the expression, so every such assignment is a (tiny) knot.*/
+inline Dependencies evaluation_dependencies( Node * root ) {
+    Dependencies deps;
+    const auto & on_node = [&]( Node * node ) {
+        if ( ! node->type( set{ TYPE::EXPRESSION, TYPE::TERM } ) )
+            return;
+        deps.index.emplace( node, deps.nodes.size() );
+        deps.nodes.push_back( node );
+    };
+    pulse( root, on_node );
+    deps.on.resize( deps.nodes.size() );
+
+    const auto & depend = [&]( Node * dependent, Node * on ) {
+        const auto d = deps.index.find( dependent );
+        const auto o = deps.index.find( on );
+        if ( d != deps.index.end() && o != deps.index.end() )
+            deps.on[ d->second ].push_back( o->second );
+    };
+    for ( auto expr : deps.nodes ) {
+        if ( expr->type( TYPE::TERM ) )
+            continue;
+        //conditional depends on all of it's (nested) parts:
+        Node * if_expr;
+        Node * then_expr;
+        Node * else_expr;
+        if ( extract_conditional( expr, if_expr, then_expr, else_expr ) ) {
+            for ( auto part : { if_expr, then_expr, else_expr } ) {
+                if ( part != nullptr )
+                    depend( expr, part );
+            }
+            continue;
+        }
+        //malformed expression will be reported once it's tried to be evaluated:
+        auto op = find_types( expr->refs, TYPE::OPERATOR );
+        if ( op == nullptr )
+            continue;
+        Node * left = nullptr;
+        Node * right = nullptr;
+        extract( expr, op, left, right );
+
+        for ( auto operand : { left, right } ) {
+            if ( operand == nullptr )
+                continue;
+            depend( expr, operand );
+            const auto assigns =
+                op->content == "="
+                ||
+                ( op->content == "<-" && operand == left )
+                ||
+                ( op->content == "->" && operand == right )
+            ;
+            if ( assigns )
+                depend( operand, expr );
+        }
+    }
+    return deps;
+}
+
+/** Tarjan's strongly connected components of dependencies graph. Components are returned in order of evaluation: every component goes after all the components it depends on.*/
+inline vector< vector< size_t > > strongly_connected( const vector< vector< size_t > > & on ) {
+    const size_t Unvisited = SIZE_MAX;
+    vector< size_t > index( on.size(), Unvisited );
+    vector< size_t > lowlink( on.size(), 0 );
+    vector< bool > on_stack( on.size(), false );
+    vector< size_t > stack;
+    vector< vector< size_t > > components;
+    size_t next_index = 0;
+
+    //iterative to handle arbitrary long chains of dependencies; every frame is node along with it's next dependency to visit:
+    vector< pair< size_t, size_t > > frames;
+    for ( size_t start = 0; start < on.size(); ++ start ) {
+        if ( index[ start ] != Unvisited )
+            continue;
+        frames.push_back( { start, 0 } );
+        while ( ! frames.empty() ) {
+            auto & [ v, next ] = frames.back();
+            if ( next == 0 ) {
+                index[ v ] = lowlink[ v ] = next_index ++;
+                stack.push_back( v );
+                on_stack[ v ] = true;
+            }
+            if ( next < on[ v ].size() ) {
+                const auto w = on[ v ][ next ++ ];
+                if ( index[ w ] == Unvisited )
+                    frames.push_back( { w, 0 } );
+                else if ( on_stack[ w ] )
+                    lowlink[ v ] = min( lowlink[ v ], index[ w ] );
+                continue;
+            }
+
+            const auto done = v;
+            frames.pop_back();
+            if ( ! frames.empty() ) {
+                const auto parent = frames.back().first;
+                lowlink[ parent ] = min( lowlink[ parent ], lowlink[ done ] );
+            }
+            if ( lowlink[ done ] != index[ done ] )
+                continue;
+            vector< size_t > component;
+            size_t w;
+            do {
+                w = stack.back();
+                stack.pop_back();
+                on_stack[ w ] = false;
+                component.push_back( w );
+            } while ( w != done );
+            components.push_back( move( component ) );
+        }
+    }
+    return components;
+}
+
+/** Values and nodes evaluated while solving single knot, to be merged into Layer.*/
+struct KnotResult {
+    vector< pair< Node *, double > > values;
+    vector< Node * > evaluated;
+};
+
+/** Tries to evaluate members of single strongly connected component over and over until nothing more can be evaluated. Everything the knot depends on is expected to be already evaluated within the layer (as far as possible).*/
+inline void solve_knot(
+    const vector< size_t > & members,
+    const Dependencies & deps,
+    const Layer & layer,
+    KnotResult & result
+) {
+    //only the knot's members and their dependencies are ever read:
+    map< Node *, double > values;
+    set< Node * > evaluated;
+    for ( const auto m : members ) {
+        for ( const auto d : deps.on[ m ] ) {
+            if ( const auto value = layer.values.find( deps.nodes[ d ] ) )
+                values.emplace( deps.nodes[ d ], * value );
+        }
+        const auto node = deps.nodes[ m ];
+        if ( const auto value = layer.values.find( node ) )
+            values.emplace( node, * value );
+        if ( layer.evaluated.contains( node ) )
+            evaluated.insert( node );
+    }
+
     bool moved = true;
     while ( moved ) {
-        cout << "Trying to evaluate any of expressions ..." << endl;
         moved = false;
-        const auto & on_expr = [&]( Node * expr ) {
-            if ( ! expr->type( set{ TYPE::EXPRESSION, TYPE::TERM } ) )
-                return;
-            
+        for ( const auto m : members ) {
+            const auto expr = deps.nodes[ m ];
             //if was already evaluated within current propagation:
-            if ( layer.evaluated.find( expr ) != layer.evaluated.end() )
-                return;
-            
-            cout << "    trying to evaluate " << expr << endl;
-            
+            if ( evaluated.find( expr ) != evaluated.end() )
+                continue;
+
+            TRACE( EVALUATION, VERBOSE ) << "    trying to evaluate " << expr;
+
             double value = 0;
             Node * destination;
-            if ( ! try_evaluate( expr, layer.values, value, destination ) )
-                return;
-            cout << "    expression " << expr << " got evaluated." << endl;
+            count_stat( & Stats::evaluation_attempts );
+            if ( ! try_evaluate( expr, values, value, destination ) )
+                continue;
+            count_stat( & Stats::evaluation_successes );
+            TRACE( EVALUATION, DEBUG ) << "    expression " << expr << " got evaluated.";
             moved = true;
-            layer.values[ destination ] = value;
-            layer.evaluated.insert( destination );
-            if ( expr != destination )
-                layer.evaluated.insert( expr );
-        };
-        pulse( root, on_expr );
+            values[ destination ] = value;
+            result.values.push_back( { destination, value } );
+            evaluated.insert( destination );
+            result.evaluated.push_back( destination );
+            if ( expr != destination ) {
+                evaluated.insert( expr );
+                result.evaluated.push_back( expr );
+            }
+        }
+        //single node without dependency on itself cannot be evaluated by another attempt:
+        if ( members.size() == 1 )
+            break;
+    }
+}
+
+/** Evaluates strongly connected components of dependencies graph in topological order: acyclic majority is evaluated with a single attempt per node while only knots of mutual dependencies are iterated. Independent knots of the same level are solved concurrently.*/
+inline void try_evaluate_all( Node * root, Layer & layer, ThreadPool & pool = default_pool() )
+{
+    //not worth scheduling for less knots:
+    const size_t MinChunk = 64;
+
+    const auto deps = evaluation_dependencies( root );
+    const auto components = strongly_connected( deps.on );
+
+    //level of component is the length of the longest chain of components it depends on:
+    vector< size_t > component_of( deps.nodes.size() );
+    for ( size_t c = 0; c < components.size(); ++ c ) {
+        for ( const auto m : components[ c ] )
+            component_of[ m ] = c;
+    }
+    vector< vector< size_t > > levels;
+    vector< size_t > level_of( components.size(), 0 );
+    for ( size_t c = 0; c < components.size(); ++ c ) {
+        for ( const auto m : components[ c ] ) {
+            for ( const auto d : deps.on[ m ] ) {
+                if ( component_of[ d ] != c )
+                    level_of[ c ] = max( level_of[ c ], level_of[ component_of[ d ] ] + 1 );
+            }
+        }
+        if ( level_of[ c ] >= levels.size() )
+            levels.resize( level_of[ c ] + 1 );
+        levels[ level_of[ c ] ].push_back( c );
+    }
+    TRACE( EVALUATION, DEBUG ) << "Evaluating " << deps.nodes.size() << " nodes within " << components.size() << " knots of " << levels.size() << " levels ...";
+
+    const auto stats = current_stats();
+    for ( const auto & level : levels ) {
+        vector< KnotResult > results( level.size() );
+        const auto chunk = max( MinChunk, level.size() / ( pool.size() * 4 ) + 1 );
+        pool.parallel_for( ( level.size() + chunk - 1 ) / chunk, [&]( const size_t c ) {
+            StatsScope scope( stats );
+            const auto end = min( level.size(), ( c + 1 ) * chunk );
+            for ( auto k = c * chunk; k < end; ++ k )
+                solve_knot( components[ level[ k ] ], deps, layer, results[ k ] );
+        } );
+
+        for ( const auto & result : results ) {
+            for ( const auto & [ node, value ] : result.values )
+                layer.values.set( node, value );
+            for ( const auto node : result.evaluated )
+                layer.evaluated.set( node, true );
+        }
     }
 
     //every node should be evaluated by now because we're topologically locked (knotted?) ...
     print_evaluation( layer, root );
 }
 
+/** Single linear equation: sum of coefficients times unknowns equals rhs.*/
+struct LinearRow {
+    map< size_t, double > coefs;
+    double rhs = 0;
+};
+
+/** Sparse system of linear equations over nodes which couldn't be evaluated by propagation.*/
+struct LinearSystem {
+    vector< Node * > unknowns;
+    unordered_map< Node *, size_t > index;
+    vector< LinearRow > rows;
+
+    /** Adds coef * node into row: into rhs if node's value is known, as unknown otherwise.*/
+    void add( LinearRow & row, Node * node, const double coef, const Layer & layer ) {
+        double value;
+        if ( try_use( node, layer.values, value ) ) {
+            row.rhs -= coef * value;
+            return;
+        }
+        auto existing = index.find( node );
+        if ( existing == index.end() ) {
+            existing = index.emplace( node, unknowns.size() ).first;
+            unknowns.push_back( node );
+        }
+        row.coefs[ existing->second ] += coef;
+    }
+};
+
+/** Collects linear relations ("=", "+", "-", multiplication and division by known value) which still have unknowns in them.*/
+inline LinearSystem linear_system( Node * root, const Layer & layer ) {
+    LinearSystem system;
+    const auto & known = [&]( Node * node, double & value ) {
+        return try_use( node, layer.values, value );
+    };
+    const auto & on_expr = [&]( Node * expr ) {
+        if ( ! expr->type( TYPE::EXPRESSION ) )
+            return;
+        auto op = find_types( expr->refs, TYPE::OPERATOR );
+        if ( op == nullptr )
+            return;
+        static const set< string > Linear = { "=", "+", "-", "*", "/" };
+        if ( Linear.find( op->content ) == Linear.end() )
+            return;
+        Node * left = nullptr;
+        Node * right = nullptr;
+        extract( expr, op, left, right );
+        if ( left == nullptr || right == nullptr )
+            return;
+
+        double left_v, right_v, expr_v;
+        const bool known_left = known( left, left_v );
+        const bool known_right = known( right, right_v );
+        if ( op->content == "=" ) {
+            if ( known_left && known_right )
+                return;
+            LinearRow row;
+            system.add( row, left, 1, layer );
+            system.add( row, right, -1, layer );
+            system.rows.push_back( move( row ) );
+            return;
+        }
+        if ( known_left && known_right && known( expr, expr_v ) )
+            return;
+
+        LinearRow row;
+        system.add( row, expr, 1, layer );
+        if ( op->content == "+" || op->content == "-" ) {
+            system.add( row, left, -1, layer );
+            system.add( row, right, op->content == "+" ? -1 : 1, layer );
+        }
+        else if ( op->content == "*" ) {
+            //product of unknowns isn't linear:
+            if ( known_left )
+                system.add( row, right, - left_v, layer );
+            else if ( known_right )
+                system.add( row, left, - right_v, layer );
+            else
+                return;
+        }
+        else {
+            if ( ! known_right || right_v == 0 )
+                return;
+            system.add( row, left, - 1 / right_v, layer );
+        }
+        system.rows.push_back( move( row ) );
+    };
+    pulse( root, on_expr );
+    return system;
+}
+
+/** Gauss-Jordan elimination over sparse rows. Pivot row is the one with the least unknowns and pivot within it is the unknown present in the least rows (among those not too small for numerical stability), so elimination keeps the system sparse. Returns values of all the unknowns which are uniquely determined.*/
+inline map< size_t, double > solve_sparse( vector< LinearRow > rows, const size_t unknowns ) {
+    const double Epsilon = 1e-12;
+    //pivot should be at least that fraction of the largest coefficient within it's row:
+    const double Threshold = 0.1;
+
+    vector< set< size_t > > rows_of( unknowns );
+    set< pair< size_t, size_t > > by_size;
+    for ( size_t r = 0; r < rows.size(); ++ r ) {
+        for ( const auto & [ u, coef ] : rows[ r ].coefs )
+            rows_of[ u ].insert( r );
+        by_size.insert( { rows[ r ].coefs.size(), r } );
+    }
+
+    vector< pair< size_t, size_t > > pivots;
+    while ( ! by_size.empty() ) {
+        const auto r = by_size.begin()->second;
+        by_size.erase( by_size.begin() );
+        auto & row = rows[ r ];
+        if ( row.coefs.empty() ) {
+            if ( abs( row.rhs ) > Epsilon ) {
+                TRACE( EVALUATION, INFO ) << "Inconsistent linear equation dropped: 0 = " << row.rhs;
+            }
+            continue;
+        }
+
+        double largest = 0;
+        for ( const auto & [ u, coef ] : row.coefs )
+            largest = max( largest, abs( coef ) );
+        size_t pivot = SIZE_MAX;
+        for ( const auto & [ u, coef ] : row.coefs ) {
+            if ( abs( coef ) >= Threshold * largest && ( pivot == SIZE_MAX || rows_of[ u ].size() < rows_of[ pivot ].size() ) )
+                pivot = u;
+        }
+
+        const auto scale = row.coefs.at( pivot );
+        for ( auto & [ u, coef ] : row.coefs )
+            coef /= scale;
+        row.rhs /= scale;
+        pivots.push_back( { r, pivot } );
+
+        //eliminate pivot from all the other rows (including previous pivot rows):
+        const auto others = rows_of[ pivot ];
+        for ( const auto q : others ) {
+            if ( q == r )
+                continue;
+            auto & other = rows[ q ];
+            const auto factor = other.coefs.at( pivot );
+            const auto pending = by_size.erase( { other.coefs.size(), q } ) > 0;
+            for ( const auto & [ u, coef ] : row.coefs ) {
+                auto & target = other.coefs[ u ];
+                target -= factor * coef;
+                if ( u == pivot || abs( target ) < Epsilon ) {
+                    other.coefs.erase( u );
+                    rows_of[ u ].erase( q );
+                }
+                else
+                    rows_of[ u ].insert( q );
+            }
+            other.rhs -= factor * row.rhs;
+            if ( pending )
+                by_size.insert( { other.coefs.size(), q } );
+        }
+    }
+
+    map< size_t, double > solution;
+    for ( const auto & [ r, u ] : pivots ) {
+        //pivot row still referencing other unknowns means they're free, so it's not determined:
+        if ( rows[ r ].coefs.size() == 1 )
+            solution[ u ] = rows[ r ].rhs;
+    }
+    return solution;
+}
+
+/** Solves linear relations left unevaluated by propagation (like simultaneous equations) and writes determined values into the layer. Returns how many nodes got evaluated.*/
+inline size_t solve_linear( Node * root, Layer & layer ) {
+    const auto system = linear_system( root, layer );
+    if ( system.unknowns.empty() )
+        return 0;
+    TRACE( EVALUATION, DEBUG ) << "Solving " << system.rows.size() << " linear equations of " << system.unknowns.size() << " unknowns ...";
+
+    const auto solution = solve_sparse( system.rows, system.unknowns.size() );
+    for ( const auto & [ u, value ] : solution ) {
+        const auto node = system.unknowns[ u ];
+        TRACE( EVALUATION, DEBUG ) << "    solved " << node << " = " << value;
+        layer.assign( node, value );
+    }
+    return solution.size();
+}
+
+/** Evaluates everything possible: propagates values, then solves what's left as linear system and propagates solved values further.*/
+inline void evaluate_layer( Node * root, Layer & layer ) {
+    {
+        Phase phase( "try_evaluate_all" );
+        try_evaluate_all( root, layer );
+    }
+    Phase phase( "solve_linear" );
+    if ( solve_linear( root, layer ) > 0 )
+        try_evaluate_all( root, layer );
+}
+
+/** Ranges of values of nodes which couldn't be evaluated exactly.*/
+using Ranges = map< Node *, Interval >;
+
+inline Interval range_of( Node * node, const Ranges & ranges, const Layer & layer ) {
+    double value;
+    if ( try_use( node, layer.values, value ) )
+        return Interval::point( value );
+    const auto range = ranges.find( node );
+    return range == ranges.end() ? Interval::whole() : range->second;
+}
+
+/** Applies OPERATOR to ranges of it's operands. Returns false if operator isn't defined over ranges.*/
+inline bool apply_range( Node * op, const Interval & left, const Interval & right, Interval & result ) {
+    const auto & name = op->content;
+    if ( name == "+" || name == "@+" )
+        result = left + right;
+    else if ( name == "-" )
+        result = left - right;
+    else if ( name == "*" )
+        result = left * right;
+    else if ( name == "/" )
+        result = left / right;
+    else if ( name == "<" )
+        result = truth_less( left, right );
+    else if ( name == "<=" )
+        result = truth_less_equal( left, right );
+    else if ( name == ">" )
+        result = truth_less( right, left );
+    else if ( name == ">=" )
+        result = truth_less_equal( right, left );
+    else if ( name == "==" )
+        result = truth_equal( left, right );
+    else if ( name == "not" )
+        result = truth_not( left );
+    else if ( name == "if" || name == "then" || name == "else" )
+        result = left;
+    else
+        return false;
+    return true;
+}
+
+/** Top-level comparisons of variable with known value (like "x >= 0" or "10 > x") constrain the range of that variable.*/
+inline void apply_constraints( Node * root, const Layer & layer, Ranges & ranges ) {
+    static const set< string > Comparisons = { "<", ">", "<=", ">=", "==" };
+    const auto & on_expr = [&]( Node * expr ) {
+        if ( ! expr->type( TYPE::EXPRESSION ) || find_types( expr->refd, TYPE::EXPRESSION ) != nullptr )
+            return;
+        auto op = find_types( expr->refs, TYPE::OPERATOR );
+        if ( op == nullptr || Comparisons.find( op->content ) == Comparisons.end() )
+            return;
+        Node * left = nullptr;
+        Node * right = nullptr;
+        extract( expr, op, left, right );
+
+        double known;
+        Node * variable = nullptr;
+        //whether variable is at the left:
+        bool at_left = true;
+        if ( left->type( TYPE::TERM ) && ! try_use( left, layer.values, known ) && try_use( right, layer.values, known ) )
+            variable = left;
+        else if ( right->type( TYPE::TERM ) && ! try_use( right, layer.values, known ) && try_use( left, layer.values, known ) ) {
+            variable = right;
+            at_left = false;
+        }
+        if ( variable == nullptr )
+            return;
+
+        auto constraint = Interval::point( known );
+        if ( op->content != "==" ) {
+            const auto below = ( op->content[ 0 ] == '<' ) == at_left;
+            constraint = below ? Interval{ - numeric_limits< double >::infinity(), known } : Interval{ known, numeric_limits< double >::infinity() };
+        }
+        const auto existing = ranges.find( variable );
+        const auto narrowed = existing == ranges.end() ? constraint : intersect( existing->second, constraint );
+        TRACE( EVALUATION, DEBUG ) << "    constraint " << expr << " narrows " << variable << " to " << narrowed;
+        ranges[ variable ] = narrowed;
+    };
+    pulse( root, on_expr );
+}
+
+/** Propagates ranges of values through everything which couldn't be evaluated exactly (starting with constraints of unknown inputs). Knots are narrowed at most MaxSweeps times since narrowing might converge infinitely slowly.*/
+inline Ranges evaluate_ranges( Node * root, const Layer & layer ) {
+    const size_t MaxSweeps = 16;
+
+    Ranges ranges;
+    apply_constraints( root, layer, ranges );
+
+    const auto & range = [&]( Node * node ) {
+        return range_of( node, ranges, layer );
+    };
+    bool moved = false;
+    const auto & narrow = [&]( Node * node, const Interval & to ) {
+        if ( node == nullptr )
+            return;
+        const auto current = range( node );
+        const auto narrowed = intersect( current, to );
+        if ( narrowed.is_empty() ) {
+            TRACE( EVALUATION, DEBUG ) << "    range " << to << " contradicts " << current << " of " << node;
+            return;
+        }
+        if ( narrowed == current )
+            return;
+        ranges[ node ] = narrowed;
+        moved = true;
+    };
+    const auto & narrow_by = [&]( Node * expr ) {
+        Node * if_expr;
+        Node * then_expr;
+        Node * else_expr;
+        if ( extract_conditional( expr, if_expr, then_expr, else_expr ) ) {
+            const auto condition = range( if_expr );
+            if ( condition == Interval::point( 1 ) )
+                narrow( expr, range( then_expr ) );
+            else if ( condition == Interval::point( 0 ) ) {
+                if ( else_expr != nullptr )
+                    narrow( expr, range( else_expr ) );
+            }
+            else if ( else_expr != nullptr )
+                narrow( expr, hull( range( then_expr ), range( else_expr ) ) );
+            return;
+        }
+
+        auto op = find_types( expr->refs, TYPE::OPERATOR );
+        if ( op == nullptr )
+            return;
+        Node * left = nullptr;
+        Node * right = nullptr;
+        extract( expr, op, left, right );
+        if ( op->content == "=" ) {
+            const auto both = intersect( range( left ), range( right ) );
+            narrow( left, both );
+            narrow( right, both );
+        }
+        else if ( op->content == "<-" )
+            narrow( left, range( right ) );
+        else if ( op->content == "->" )
+            narrow( right, range( left ) );
+        else if ( left != nullptr ) {
+            Interval result;
+            if ( apply_range( op, range( left ), right == nullptr ? Interval::whole() : range( right ), result ) )
+                narrow( expr, result );
+        }
+    };
+
+    const auto deps = evaluation_dependencies( root );
+    for ( const auto & component : strongly_connected( deps.on ) ) {
+        for ( size_t sweep = 0; sweep < MaxSweeps; ++ sweep ) {
+            moved = false;
+            for ( const auto m : component ) {
+                if ( deps.nodes[ m ]->type( TYPE::EXPRESSION ) )
+                    narrow_by( deps.nodes[ m ] );
+            }
+            if ( ! moved || component.size() == 1 )
+                break;
+        }
+    }
+
+    if ( TRACING( EVALUATION, DEBUG ) ) {
+        TRACE( EVALUATION, DEBUG ) << "Ranges of variables:";
+        for ( const auto & [ node, interval ] : ranges ) {
+            if ( node->type( TYPE::TERM ) ) {
+                TRACE( EVALUATION, DEBUG ) << "    " << node << " in " << interval;
+            }
+        }
+    }
+    return ranges;
+}
+
+/** Conditions decided by ranges are folded into the layer, while branches which can never be taken are collected (along with everything within them) into pruned. Returns the number of folded conditions.*/
+inline size_t fold_conditions( Node * root, const Ranges & ranges, Layer & layer, set< Node * > & pruned ) {
+    size_t folded = 0;
+    const auto & on_expr = [&]( Node * expr ) {
+        Node * if_expr;
+        Node * then_expr;
+        Node * else_expr;
+        if ( ! extract_conditional( expr, if_expr, then_expr, else_expr ) )
+            return;
+        const auto condition = range_of( if_expr, ranges, layer );
+        if ( ! condition.is_point() )
+            return;
+
+        if ( ! layer.values.contains( if_expr ) ) {
+            TRACE( EVALUATION, DEBUG ) << "    condition " << if_expr << " folded into " << condition.low;
+            layer.assign( if_expr, condition.low );
+            count_stat( & Stats::conditions_folded );
+            ++ folded;
+        }
+        const auto never = condition.low != 0 ? else_expr : then_expr;
+        if ( never == nullptr || pruned.find( never ) != pruned.end() )
+            return;
+        TRACE( EVALUATION, DEBUG ) << "    branch " << never << " is never taken";
+        count_stat( & Stats::branches_pruned );
+        pulse< true, false >( never, [&]( Node * node ) { pruned.insert( node ); }, set{ TYPE::EXPRESSION, TYPE::OPERATOR, TYPE::NONABELIAN } );
+    };
+    pulse( root, on_expr );
+    return folded;
+}
+
+enum class BRANCH {
+    PENDING,
+    SOLVED,
+    /** Has no solutions.*/
+    COLLAPSED,
+    /** Depends on collapsed (or cancelled, or dropped) branch, so was never solved.*/
+    CANCELLED,
+    /** Wasn't solved to stay within BranchBudget.*/
+    DROPPED,
+};
+const vector< string > BranchStates = { "pending", "solved", "collapsed", "cancelled", "dropped" };
+
 struct Branch {
     string name;
     /** Requires to know the results of execution of these other Branches: */
@@ -302,22 +1004,128 @@ struct Branch {
     /** Results of execution of this Branch referenced by: */
     set< Branch * > refd;
 
+    /** Solves this Branch once all the Branches it refs are solved. Returns false if this Branch collapsed.*/
+    function< bool( Branch & ) > solve;
+    /** Applies value to the own layer once it's known (whether solved or taken from the cache).*/
+    function< void( Branch & ) > apply;
+    /** Canonical description of everything solve() depends on: identical keys are solved only once (see BranchCache). Not cached if empty.*/
+    string key;
+    /** Estimated cost of solving, set by whoever spawns the Branch: the cheapest ready Branches are solved first.*/
+    double cost = 0;
+    /** Length of the longest chain of refs below this Branch (set once scheduled), added to cost.*/
+    size_t depth = 0;
+    double value = 0;
+    atomic< BRANCH > state = BRANCH::PENDING;
+    /** Number of refs which are not complete yet while scheduled.*/
+    atomic< size_t > pending = 0;
+    /** Set once any of refs collapses or gets cancelled.*/
+    atomic< bool > doomed = false;
+    /** Own view of evaluated values, forked from the Layer this Branch was spawned from.*/
+    Layer layer;
+
+    /** Both ends of single dependency.*/
+    static constexpr int64_t EdgeBytes = 2 * tree_node_bytes( sizeof( Branch * ) );
+
+    Branch() {
+        charge_memory( MEMORY::BRANCHES, sizeof( Branch ) );
+    }
+    Branch( const Branch & ) = delete;
+    Branch & operator =( const Branch & ) = delete;
+    ~Branch() {
+        charge_memory( MEMORY::BRANCHES, - int64_t( sizeof( Branch ) ) - EdgeBytes * int64_t( refs.size() + refd.size() ) );
+        for ( auto & ref : refs )
+            ref->refd.erase( this );
+        for ( auto & red : refd )
+            red->refs.erase( this );
+    }
+
     void ref( Branch * other ) {
-        this->refs.insert( other );
+        if ( this->refs.insert( other ).second )
+            charge_memory( MEMORY::BRANCHES, EdgeBytes );
         other->refd.insert( this );
     }
 };
 
-auto branch_compositions( Node * root, Layer & previous /*, array of Layers here? */ ) {
+/** Outcome of solved Branch to be reused by identical Branches.*/
+struct BranchResult {
+    BRANCH state;
+    double value;
+};
+using BranchCache = LruCache< string, BranchResult >;
+/** Process-wide cache shared by all the programs (and their executions).*/
+inline BranchCache & default_branch_cache() {
+    static BranchCache cache( 1 << 16 );
+    return cache;
+}
+
+/** Appends structure of composition to key regardless of addresses or syntactic order of operands where it doesn't matter (abelian operators).*/
+inline void canonical_composition( Node * node, string & key ) {
+    if ( node->type( TYPE::TERM ) ) {
+        key += node->content;
+        return;
+    }
+    auto op = find_types( node->refs, TYPE::OPERATOR );
+    vector< string > operands;
+    if ( op != nullptr && find_types( node->refs, TYPE::NONABELIAN ) != nullptr ) {
+        Node * left = nullptr;
+        Node * right = nullptr;
+        extract( node, op, left, right );
+        operands = { "", "" };
+        canonical_composition( left, operands[ 0 ] );
+        canonical_composition( right, operands[ 1 ] );
+    }
+    else {
+        for ( auto ref : node->refs ) {
+            if ( ! ref->type( set{ TYPE::EXPRESSION, TYPE::TERM } ) )
+                continue;
+            operands.emplace_back();
+            canonical_composition( ref, operands.back() );
+        }
+        sort( operands.begin(), operands.end() );
+    }
+
+    key += "(";
+    key += op == nullptr ? node->content : op->content;
+    for ( const auto & operand : operands )
+        key += " " + operand;
+    key += ")";
+}
+
+/** Canonical key of Branch solving specified composition: it's structure along with values bound to all of it's variables.*/
+inline string composition_key( const string & role, Node * composition, const Layer & layer ) {
+    string key = role + " ";
+    canonical_composition( composition, key );
+
+    map< string, Node * > variables;
+    pulse< true, false >( composition, [&]( Node * node ) {
+        if ( node->type( TYPE::TERM ) && ! node->type( TYPE::NUMBER ) )
+            variables[ node->content ] = node;
+    }, set{ TYPE::EXPRESSION, TYPE::TERM } );
+    ostringstream bindings;
+    bindings << setprecision( 17 );
+    for ( const auto & [ name, variable ] : variables ) {
+        bindings << " " << name << "=";
+        if ( const auto value = layer.values.find( variable ) )
+            bindings << * value;
+        else
+            bindings << "?";
+    }
+    return key + bindings.str();
+}
+
+/**
+@param pruned nodes within branches which can never be taken, so they don't spawn anything.
+*/
+inline auto branch_compositions( Node * root, Layer & previous /*, array of Layers here? */, const set< Node * > & pruned = {} ) {
     vector< Branch * > branches;
 
     const auto & on_op = [&]( Node * op ) {
-        if ( ! op->type( TYPE::OPERATOR ) )
+        if ( ! op->type( TYPE::OPERATOR ) || pruned.find( op ) != pruned.end() )
             return;
         
         auto expr = find_types( op->refd, TYPE::EXPRESSION );
         if ( expr == nullptr )
-            throw new runtime_error( "ERROR: operator must be referenced by an EXPRESSION" );
+            throw runtime_error( "ERROR: operator must be referenced by an EXPRESSION" );
 
         Node * left = nullptr;
         Node * right = nullptr;
@@ -327,14 +1135,30 @@ auto branch_compositions( Node * root, Layer & previous /*, array of Layers here
         if ( op->content == "@+" ) {
             auto left_branch = new Branch;
             branches.push_back( left_branch );
-            left_branch->name = left->content + " = " + to_string( previous.values[ left ] ) + " and consumes right with +:";
+            left_branch->name = left->content + " = " + to_string( previous.value_or( left ) ) + " and consumes right with +:";
+            left_branch->layer = previous;
 
             auto right_branch = new Branch;
             branches.push_back( right_branch );
             stringstream s;
-            s << "= " << previous.values[ right ] << " and requires further execution as " << right;
+            s << "= " << previous.value_or( right ) << " and requires further execution as " << right;
             right_branch->name = s.str();
+            right_branch->layer = previous;
 
+            right_branch->solve = [ right ]( Branch & branch ) {
+                branch.value = branch.layer.value_or( right );
+                return true;
+            };
+            right_branch->key = composition_key( "@+ right", right, previous );
+            left_branch->solve = [ left, right_branch ]( Branch & branch ) {
+                branch.value = branch.layer.value_or( left ) + right_branch->value;
+                return true;
+            };
+            left_branch->apply = [ left ]( Branch & branch ) {
+                branch.layer.assign( left, branch.value );
+            };
+            //sum depends on everything right branch does:
+            left_branch->key = composition_key( "@+ left", expr, previous );
             left_branch->ref( right_branch );
         }
         //not exactly sure, but I guess it should spawn all the possible (for current step only left/right branch would suffice, but to completely solve it needs to be the whole space, yes) branches of left and right operands and choose those intersections which equal to each other?
@@ -347,19 +1171,545 @@ auto branch_compositions( Node * root, Layer & previous /*, array of Layers here
     return branches;
 }
 
-auto semantic( Node * root ) {
-    cout << "SEMANTIC:" << endl;
-    merge_occurences( root );
+/** Limits of branches exploration (zero stands for unlimited) since some compositions (like "@+") might spawn Branches infinitely.*/
+struct BranchBudget {
+    /** How many Branches might be solved at most.*/
+    size_t branches = 0;
+    /** Bytes of Branches along with their Layers within current Stats.*/
+    int64_t bytes = 0;
+};
+
+/** Solves every Branch as soon as all the Branches it refs are solved: ready Branches are executed concurrently on the pool in order of priority (the cheapest first), while every completed Branch decrements pending counters of Branches depending on it. Once the budget is exhausted the most expensive ready Branches are dropped: just enough of them for their Layers to get the memory back within the budget. Shared by all the scheduled tasks, so it outlives the last one of them.*/
+struct BranchScheduler: enable_shared_from_this< BranchScheduler > {
+    ThreadPool & pool;
+    BranchCache & cache;
+    const BranchBudget budget;
+    Stats * stats;
+    /** Branches not complete yet.*/
+    atomic< size_t > remaining;
+    /** Set once any Branch throws, so no more Branches are started.*/
+    atomic< bool > cancelled = false;
+    mutex guard;
+    condition_variable done;
+    exception_ptr error;
+
+    BranchScheduler( ThreadPool & pool, BranchCache & cache, const BranchBudget & budget, const size_t branches ):
+        pool( pool ), cache( cache ), budget( budget ), stats( current_stats() ), remaining( branches ) {}
+
+    /** Every scheduled Branch is accompanied by single task which executes the cheapest ready one. Branches becoming ready simultaneously are scheduled at once, so their priorities are respected.*/
+    void schedule( const vector< Branch * > & branches ) {
+        {
+            lock_guard< mutex > lock( ready_guard );
+            for ( auto branch : branches )
+                ready.insert( { branch->cost + branch->depth, sequence ++, branch } );
+        }
+        for ( size_t i = 0; i < branches.size(); ++ i )
+            pool.submit( [ self = shared_from_this() ]{ self->execute_next(); } );
+    }
+
+    /** Helps with pending tasks until all the Branches complete. Rethrows the first exception thrown by any Branch.*/
+    void wait() {
+        while ( remaining.load( memory_order_acquire ) > 0 ) {
+            if ( pool.run_pending() )
+                continue;
+            unique_lock< mutex > lock( guard );
+            done.wait_for( lock, chrono::milliseconds( 1 ), [&]{ return remaining.load() == 0; } );
+        }
+        if ( error )
+            rethrow_exception( error );
+    }
+
+private:
+    mutex ready_guard;
+    /** Ready Branches by priority and then by order of readiness.*/
+    set< tuple< double, uint64_t, Branch * > > ready;
+    uint64_t sequence = 0;
+    /** Branches started to be solved (or taken from the cache) in order of priority.*/
+    size_t explored = 0;
+
+    /** Bytes of Layers of dropped Branches which are not released yet.*/
+    int64_t releasing = 0;
+
+    /** Bytes above the memory budget (not counting those being released already), zero if within it.*/
+    int64_t memory_excess() const {
+        if ( budget.bytes <= 0 || stats == nullptr )
+            return 0;
+        const auto used = stats->live_bytes[ size_t( MEMORY::BRANCHES ) ] + stats->live_bytes[ size_t( MEMORY::LAYERS ) ] - releasing;
+        return max< int64_t >( 0, used - budget.bytes );
+    }
+
+    void execute_next() {
+        StatsScope scope( stats );
+        Branch * branch;
+        vector< pair< Branch *, int64_t > > dropped;
+        bool exhausted;
+        {
+            lock_guard< mutex > lock( ready_guard );
+            //Branch of this task might have been dropped already:
+            if ( ready.empty() )
+                return;
+            branch = get< 2 >( * ready.begin() );
+            ready.erase( ready.begin() );
+            //stalled most expensive ones are given up first while there are cheaper ones to be solved, but only as many as it takes to release the excess (those releasing nothing are kept):
+            auto excess = memory_excess();
+            for ( auto it = ready.end(); excess > 0 && it != ready.begin(); ) {
+                -- it;
+                const auto d = get< 2 >( * it );
+                const auto bytes = d->layer.owned_bytes();
+                if ( bytes <= 0 )
+                    continue;
+                dropped.push_back( { d, bytes } );
+                releasing += bytes;
+                excess -= bytes;
+                it = ready.erase( it );
+            }
+            exhausted = ! branch->doomed && ! cancelled && ( ( budget.branches > 0 && explored ++ >= budget.branches ) || excess > 0 );
+        }
+        //tasks of dropped Branches will find something else to do (or nothing):
+        for ( const auto & [ d, bytes ] : dropped ) {
+            complete( d, BRANCH::DROPPED );
+            lock_guard< mutex > lock( ready_guard );
+            releasing -= bytes;
+        }
+
+        if ( branch->doomed || cancelled )
+            complete( branch, BRANCH::CANCELLED );
+        else if ( exhausted )
+            complete( branch, BRANCH::DROPPED );
+        else
+            complete( branch, solve( branch ) );
+    }
 
+    BRANCH solve( Branch * branch ) {
+        TimelineSpan span( "branch " + branch->name );
+        try {
+            auto state = BRANCH::SOLVED;
+            BranchResult cached;
+            if ( ! branch->key.empty() && cache.find( branch->key, cached ) ) {
+                count_stat( & Stats::branch_cache_hits );
+                state = cached.state;
+                branch->value = cached.value;
+            }
+            else {
+                if ( ! branch->key.empty() )
+                    count_stat( & Stats::branch_cache_misses );
+                state = ! branch->solve || branch->solve( * branch ) ? BRANCH::SOLVED : BRANCH::COLLAPSED;
+                if ( ! branch->key.empty() )
+                    cache.put( branch->key, { state, branch->value } );
+            }
+            if ( state == BRANCH::SOLVED && branch->apply )
+                branch->apply( * branch );
+            return state;
+        }
+        catch ( ... ) {
+            lock_guard< mutex > lock( guard );
+            if ( ! error )
+                error = current_exception();
+            cancelled = true;
+            return BRANCH::CANCELLED;
+        }
+    }
+
+    /** Collapse (or cancellation, or drop) of Branch cancels all the Branches depending on it.*/
+    void complete( Branch * branch, const BRANCH state ) {
+        branch->state = state;
+        if ( state == BRANCH::SOLVED )
+            count_stat( & Stats::branches_solved );
+        else if ( state == BRANCH::COLLAPSED )
+            count_stat( & Stats::branches_collapsed );
+        else if ( state == BRANCH::DROPPED )
+            count_stat( & Stats::branches_dropped );
+        else
+            count_stat( & Stats::branches_cancelled );
+        if ( state == BRANCH::SOLVED ) {
+            TRACE( SEMANTIC, DEBUG ) << "    branch " << branch->name << " solved: " << branch->value;
+        }
+        else {
+            TRACE( SEMANTIC, DEBUG ) << "    branch " << branch->name << " " << BranchStates[ size_t( state ) ];
+            //nothing is going to read it anymore:
+            branch->layer = Layer();
+        }
+
+        vector< Branch * > became_ready;
+        for ( auto red : branch->refd ) {
+            if ( state != BRANCH::SOLVED )
+                red->doomed = true;
+            //the last completed ref makes dependent ready:
+            if ( red->pending.fetch_sub( 1, memory_order_acq_rel ) == 1 )
+                became_ready.push_back( red );
+        }
+        schedule( became_ready );
+        if ( remaining.fetch_sub( 1, memory_order_acq_rel ) == 1 ) {
+            lock_guard< mutex > lock( guard );
+            done.notify_all();
+        }
+    }
+};
+
+/** Solves all the Branches on the pool, each one once all the Branches it refs complete, within the budget. Branches already solved (with the same key) are taken from the cache.*/
+inline void solve_branches(
+    const vector< Branch * > & branches,
+    ThreadPool & pool = default_pool(),
+    BranchCache & cache = default_branch_cache(),
+    const BranchBudget & budget = {}
+) {
+    if ( branches.empty() )
+        return;
+
+    //every Branch is scheduled only once all of it's refs complete, so mutual dependencies would never be scheduled:
+    {
+        map< Branch *, size_t > waiting;
+        vector< Branch * > ready;
+        for ( auto branch : branches ) {
+            branch->depth = 0;
+            waiting[ branch ] = branch->refs.size();
+            if ( branch->refs.empty() )
+                ready.push_back( branch );
+        }
+        size_t reached = 0;
+        while ( ! ready.empty() ) {
+            auto branch = ready.back();
+            ready.pop_back();
+            ++ reached;
+            for ( auto red : branch->refd ) {
+                red->depth = max( red->depth, branch->depth + 1 );
+                if ( -- waiting[ red ] == 0 )
+                    ready.push_back( red );
+            }
+        }
+        if ( reached != branches.size() )
+            throw runtime_error( "ERROR: branches depend on each other cyclically" );
+    }
+
+    for ( auto branch : branches ) {
+        branch->state = BRANCH::PENDING;
+        branch->pending = branch->refs.size();
+        branch->doomed = false;
+    }
+    auto scheduler = make_shared< BranchScheduler >( pool, cache, budget, branches.size() );
+    vector< Branch * > ready;
+    for ( auto branch : branches ) {
+        if ( branch->refs.empty() )
+            ready.push_back( branch );
+    }
+    scheduler->schedule( ready );
+    scheduler->wait();
+}
+
+/**
+Branch-state file: Branches pending in the middle of Program execution along with everything they were spawned from, to be collapsed later (maybe by another process) once more inputs arrive. Everything is used right within the mapped file (see BinaryFile).
+*/
+struct BranchStateFormat {
+    static constexpr const char * Magic = "RCLBRNCH";
+    static constexpr uint32_t Version = 1;
+
+    enum SECTION : uint32_t {
+        /** Interned contents and file names of nodes, names and keys of Branches (see SymbolTable).*/
+        SYMBOL_OFFSETS,
+        SYMBOL_CHARS,
+        NODES,
+        VALUES,
+        LAYERS,
+        BRANCHES,
+        /** Refs of all the Branches as indices of Branches.*/
+        EDGES,
+        SECTIONS,
+    };
+
+    /** Identifies node of the graph compiled from the same source.*/
+    struct Node {
+        uint32_t content;
+        uint32_t file;
+        int32_t line;
+        int32_t char_start;
+        int32_t char_end;
+        /** Bit per TYPE.*/
+        uint32_t types;
+    };
+    struct Value {
+        /** Index within NODES.*/
+        uint32_t node;
+        /** Some nodes are just flagged as evaluated.*/
+        uint32_t has_value;
+        double value;
+    };
+    /** Range within VALUES: the Layer the Branches were spawned from goes first, then changes made on top of it by every Branch.*/
+    struct Layer {
+        uint32_t values_begin;
+        uint32_t values_end;
+    };
+    struct Branch {
+        uint32_t name;
+        uint32_t key;
+        /** BRANCH.*/
+        uint32_t state;
+        uint32_t depth;
+        double cost;
+        double value;
+        /** Range within EDGES.*/
+        uint32_t refs_begin;
+        uint32_t refs_end;
+    };
+};
+
+/** Writes the Layer Branches were spawned from along with all the Branches into branch-state file. Layers of Branches are stored as changes against the base Layer, so the file grows only with what Branches changed. Branches which weren't solved don't keep their Layers, so they're restored with the base one.*/
+inline void save_branch_state( const string & path, const Layer & base, const vector< Branch * > & branches ) {
+    using Format = BranchStateFormat;
+    SymbolTable symbols;
+    unordered_map< Node *, uint32_t > indices;
+    vector< Format::Node > nodes;
+    vector< Format::Value > values;
+    vector< Format::Layer > layers;
+
+    const auto & index_of = [&]( Node * node ) {
+        const auto [ found, inserted ] = indices.emplace( node, nodes.size() );
+        if ( inserted ) {
+            uint32_t types = 0;
+            for ( const auto type : node->types )
+                types |= 1u << type;
+            nodes.push_back( {
+                symbols.intern( node->content ),
+                symbols.intern( node->source_pos.file ),
+                node->source_pos.line,
+                node->source_pos.char_start,
+                node->source_pos.char_end,
+                types,
+            } );
+        }
+        return found->second;
+    };
+    //evaluated nodes are a superset of those having values:
+    const auto & write_layer = [&]( const Layer & layer, const Layer * against ) {
+        const uint32_t begin = values.size();
+        const auto & on_evaluated = [&]( Node * node, bool ) {
+            const auto value = layer.values.find( node );
+            values.push_back( { index_of( node ), value != nullptr, value == nullptr ? 0. : * value } );
+        };
+        const auto & on_value = [&]( Node * node, double ) {
+            //new evaluated nodes are written already:
+            if ( against->evaluated.contains( node ) )
+                on_evaluated( node, true );
+        };
+        if ( against == nullptr )
+            layer.evaluated.for_each( on_evaluated );
+        else {
+            layer.evaluated.for_each_difference( against->evaluated, on_evaluated );
+            layer.values.for_each_difference( against->values, on_value );
+        }
+        layers.push_back( { begin, uint32_t( values.size() ) } );
+    };
+
+    write_layer( base, nullptr );
+    unordered_map< Branch *, uint32_t > branch_indices;
+    for ( size_t i = 0; i < branches.size(); ++ i )
+        branch_indices[ branches[ i ] ] = i;
+    vector< Format::Branch > records;
+    vector< uint32_t > edges;
+    for ( auto branch : branches ) {
+        write_layer( branch->layer, & base );
+        Format::Branch record{
+            symbols.intern( branch->name ),
+            symbols.intern( branch->key ),
+            uint32_t( branch->state.load() ),
+            uint32_t( branch->depth ),
+            branch->cost,
+            branch->value,
+            uint32_t( edges.size() ),
+            0,
+        };
+        for ( auto ref : branch->refs ) {
+            const auto found = branch_indices.find( ref );
+            if ( found == branch_indices.end() )
+                throw runtime_error( "ERROR: branch " + branch->name + " refs branch which isn't stored" );
+            edges.push_back( found->second );
+        }
+        record.refs_end = edges.size();
+        records.push_back( record );
+    }
+
+    BinaryWriter writer( Format::Magic, Format::Version, Format::SECTIONS );
+    symbols.write( writer, Format::SYMBOL_OFFSETS, Format::SYMBOL_CHARS );
+    writer.section( Format::NODES, nodes );
+    writer.section( Format::VALUES, values );
+    writer.section( Format::LAYERS, layers );
+    writer.section( Format::BRANCHES, records );
+    writer.section( Format::EDGES, edges );
+    writer.save( path );
+}
+
+/** Mapped branch-state file: only bounds of ranges are validated on load, everything is read right from the mapping.*/
+struct BranchStateView {
+    using Format = BranchStateFormat;
+
+    BinaryFile file;
+    SymbolsView symbols;
+    span< const Format::Node > nodes;
+    span< const Format::Value > values;
+    span< const Format::Layer > layers;
+    span< const Format::Branch > branches;
+    span< const uint32_t > edges;
+
+    BranchStateView( const string & path ):
+        file( path, Format::Magic, Format::Version, Format::SECTIONS ),
+        symbols( file, Format::SYMBOL_OFFSETS, Format::SYMBOL_CHARS ),
+        nodes( file.section< Format::Node >( Format::NODES ) ),
+        values( file.section< Format::Value >( Format::VALUES ) ),
+        layers( file.section< Format::Layer >( Format::LAYERS ) ),
+        branches( file.section< Format::Branch >( Format::BRANCHES ) ),
+        edges( file.section< uint32_t >( Format::EDGES ) )
+    {
+        if ( layers.size() != branches.size() + 1 )
+            throw runtime_error( "ERROR: branch state " + path + " has no layer for every branch" );
+        for ( const auto & layer : layers ) {
+            if ( layer.values_begin > layer.values_end || layer.values_end > values.size() )
+                throw runtime_error( "ERROR: branch state " + path + " has layer out of bounds" );
+        }
+        for ( const auto & branch : branches ) {
+            if ( branch.refs_begin > branch.refs_end || branch.refs_end > edges.size() || branch.state > uint32_t( BRANCH::DROPPED ) )
+                throw runtime_error( "ERROR: branch state " + path + " has malformed branch" );
+        }
+    }
+
+    string_view name( const size_t branch ) const {
+        return symbols[ branches[ branch ].name ];
+    }
+    string_view key( const size_t branch ) const {
+        return symbols[ branches[ branch ].key ];
+    }
+    BRANCH state( const size_t branch ) const {
+        return BRANCH( branches[ branch ].state );
+    }
+    /** Indices of Branches the branch refs.*/
+    span< const uint32_t > refs( const size_t branch ) const {
+        return edges.subspan( branches[ branch ].refs_begin, branches[ branch ].refs_end - branches[ branch ].refs_begin );
+    }
+};
+
+/** Finds nodes of stored branch state within the graph compiled from the same source: TERMs (merged by name) are matched by their content, the rest by content, types and position. Throws runtime_error if any of them is missing or ambiguous.*/
+inline vector< Node * > bind_nodes( const BranchStateView & view, Node * root ) {
+    const auto & identity = []( const string_view content, const uint32_t types, const string_view file, const int32_t line, const int32_t char_start, const int32_t char_end ) {
+        ostringstream s;
+        if ( types & ( 1u << TYPE::TERM ) )
+            s << "term " << content;
+        else
+            s << types << " " << content << " " << file << ":" << line << ":" << char_start << "-" << char_end;
+        return s.str();
+    };
+    map< string, Node * > graph;
+    pulse( root, [&]( Node * node ) {
+        uint32_t types = 0;
+        for ( const auto type : node->types )
+            types |= 1u << type;
+        const auto [ found, inserted ] = graph.emplace( identity( node->content, types, node->source_pos.file, node->source_pos.line, node->source_pos.char_start, node->source_pos.char_end ), node );
+        if ( ! inserted )
+            found->second = nullptr;
+    } );
+
+    vector< Node * > bound;
+    bound.reserve( view.nodes.size() );
+    for ( const auto & node : view.nodes ) {
+        const auto id = identity( view.symbols[ node.content ], node.types, view.symbols[ node.file ], node.line, node.char_start, node.char_end );
+        const auto found = graph.find( id );
+        if ( found == graph.end() || found->second == nullptr )
+            throw runtime_error( "ERROR: branch state doesn't match the program: " + string( found == graph.end() ? "no" : "ambiguous" ) + " node " + id );
+        bound.push_back( found->second );
+    }
+    return bound;
+}
+
+/** Restores Layer of specified Branch (or the base Layer all the Branches were spawned from if branch isn't specified).
+@param nodes as bound by bind_nodes().*/
+inline Layer restore_layer( const BranchStateView & view, const vector< Node * > & nodes, const optional< size_t > branch = {} ) {
     Layer layer;
-    try_evaluate_all( root, layer );
+    const auto & apply = [&]( const BranchStateFormat::Layer & range ) {
+        for ( const auto & value : view.values.subspan( range.values_begin, range.values_end - range.values_begin ) ) {
+            if ( value.node >= nodes.size() )
+                throw runtime_error( "ERROR: branch state value refers to unknown node" );
+            if ( value.has_value )
+                layer.assign( nodes[ value.node ], value.value );
+            else
+                layer.evaluated.set( nodes[ value.node ], true );
+        }
+    };
+    apply( view.layers[ 0 ] );
+    if ( branch ) {
+        if ( * branch >= view.branches.size() )
+            throw out_of_range( "restore_layer(): no such branch" );
+        apply( view.layers[ * branch + 1 ] );
+    }
+    return layer;
+}
 
-    auto branches = branch_compositions( root, layer );
-    cout << "Should spawn " << branches.size() << " branches:" << endl;
-    for ( const auto & branch : branches )
-        cout << "    branch " << branch->name << endl;
+/** Feeds outcomes of solved (and collapsed) Branches of branch state into cache, so only the rest of them gets solved when the same Branches are spawned again. Returns number of outcomes fed.*/
+inline size_t resume_branches( const BranchStateView & view, BranchCache & cache ) {
+    size_t fed = 0;
+    for ( size_t i = 0; i < view.branches.size(); ++ i ) {
+        const auto state = view.state( i );
+        if ( view.key( i ).empty() || ( state != BRANCH::SOLVED && state != BRANCH::COLLAPSED ) )
+            continue;
+        cache.put( string( view.key( i ) ), { state, view.branches[ i ].value } );
+        ++ fed;
+    }
+    return fed;
+}
+
+/**
+@param branch_state file to resume branches from (if it exists) and to store them into once they're solved (within the budget) if specified.*/
+inline auto semantic( Node * root, const BranchBudget & budget = {}, const string & branch_state = "" ) {
+    TRACE( SEMANTIC, INFO ) << "SEMANTIC:";
+    {
+        Phase phase( "merge_occurences" );
+        merge_occurences( root );
+    }
+
+    Layer layer;
+    evaluate_layer( root, layer );
+
+    //unknown inputs still might be constrained enough to decide some conditions, which in turn might decide further ones:
+    set< Node * > pruned;
+    for ( ;; ) {
+        size_t folded;
+        {
+            Phase phase( "evaluate_ranges" );
+            folded = fold_conditions( root, evaluate_ranges( root, layer ), layer, pruned );
+        }
+        if ( folded == 0 )
+            break;
+        evaluate_layer( root, layer );
+    }
+
+    vector< Branch * > branches;
+    {
+        Phase phase( "branch_compositions" );
+        branches = branch_compositions( root, layer, pruned );
+    }
+    TRACE( SEMANTIC, INFO ) << "Should spawn " << branches.size() << " branches:";
+    try {
+        if ( ! branch_state.empty() && filesystem::exists( branch_state ) ) {
+            Phase phase( "resume_branches" );
+            const auto resumed = resume_branches( BranchStateView( branch_state ), default_branch_cache() );
+            TRACE( SEMANTIC, INFO ) << "Resumed " << resumed << " branches from " << branch_state;
+        }
+        {
+            Phase phase( "solve_branches" );
+            solve_branches( branches, default_pool(), default_branch_cache(), budget );
+        }
+        if ( ! branch_state.empty() ) {
+            Phase phase( "save_branch_state" );
+            save_branch_state( branch_state, layer, branches );
+        }
+    }
+    catch ( ... ) {
+        for ( auto branch : branches )
+            delete branch;
+        throw;
+    }
+    for ( auto branch : branches )
+        delete branch;
     
     //here the spawned branches might get "turned inside-out" (or "rotated" from branches-spawning axis to "leafs"/"leaves" axis) and then all the branches must be solved pair-wise. When any branch in pair-wise solution generation has dependencies on some other branch, then solutions must be generated for every dependency (when such solutions generate SPACEs). When variable's value (or it's ranges) isn't known at the stage of solution generation, then the branch must be prolonged into solution generate state (program state) so that possible future value supply will generate the solution (thus program execution action might require to perform branching again as well).
 
     //as the process of Program execution there might spawn Branches. Branches might get collapsed into each other if some additional set of input values is provided, thus such state can be interpreted as something intermediate and even stored into file, leaving "dirt" footprint with semantics of what those branches are (which are eager to get collapsed when fed with proper additional inputs). Such "branch-state" can be deduced and thus give us the notion of "arrays": something that has plural instances of the same type: must be evaluated just straight into Branches.
+
+    return layer;
 }
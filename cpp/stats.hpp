@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "json.hpp"
+#include "timeline.hpp"
+
+using namespace std;
+
+/** Subsystems which memory is accounted separately.*/
+enum class MEMORY {
+    /** SOURCE_FILEs, LINEs and INCLUDEs.*/
+    LINES,
+    /** TERMs and OPERATORs.*/
+    TOKENS,
+    /** EXPRESSIONs and everything else composed of tokens.*/
+    EXPRESSIONS,
+    /** Evaluated values.*/
+    LAYERS,
+    BRANCHES,
+};
+const size_t MemorySubsystems = size_t( MEMORY::BRANCHES ) + 1;
+const vector< string > MemoryNames = { "lines", "tokens", "expressions", "layers", "branches" };
+
+/** Approximate size of single element of std::set or std::map: red-black tree node header (color and 3 pointers) along with the value.*/
+constexpr int64_t tree_node_bytes( const size_t value_size ) {
+    return 4 * sizeof( void * ) + value_size;
+}
+/** Bytes allocated by string on heap (short strings are stored inline).*/
+inline int64_t heap_bytes( const string & s ) {
+    return s.capacity() > string().capacity() ? s.capacity() + 1 : 0;
+}
+
+/** Phase timings and counters of single compilation. Might be updated from multiple threads simultaneously.*/
+struct Stats {
+    atomic< uint64_t > nodes_created = 0;
+    atomic< uint64_t > nodes_deleted = 0;
+    atomic< uint64_t > edges_added = 0;
+    atomic< uint64_t > pulses = 0;
+    atomic< uint64_t > nodes_visited = 0;
+    atomic< uint64_t > evaluation_attempts = 0;
+    atomic< uint64_t > evaluation_successes = 0;
+    atomic< uint64_t > conditions_folded = 0;
+    atomic< uint64_t > branches_pruned = 0;
+    atomic< uint64_t > branches_solved = 0;
+    atomic< uint64_t > branches_collapsed = 0;
+    atomic< uint64_t > branches_cancelled = 0;
+    atomic< uint64_t > branches_dropped = 0;
+    atomic< uint64_t > branch_cache_hits = 0;
+    atomic< uint64_t > branch_cache_misses = 0;
+    atomic< uint64_t > graph_cache_hits = 0;
+    atomic< uint64_t > graph_cache_misses = 0;
+
+    /** Bytes currently allocated by every MEMORY subsystem.*/
+    atomic< int64_t > live_bytes[ MemorySubsystems ] = {};
+    /** Maximum of live_bytes ever reached.*/
+    atomic< int64_t > peak_bytes[ MemorySubsystems ] = {};
+
+    /** Accounts allocation (or deallocation if bytes are negative) within specified subsystem.*/
+    void charge( const MEMORY subsystem, const int64_t bytes ) {
+        const auto live = live_bytes[ size_t( subsystem ) ].fetch_add( bytes, memory_order_relaxed ) + bytes;
+        auto & peak = peak_bytes[ size_t( subsystem ) ];
+        auto previous = peak.load( memory_order_relaxed );
+        while ( live > previous && ! peak.compare_exchange_weak( previous, live, memory_order_relaxed ) ) {}
+    }
+
+    /** How many nodes of some TYPE there are within graph and how many edges they reference.*/
+    struct TypeCount {
+        string type;
+        uint64_t nodes = 0;
+        uint64_t edges = 0;
+    };
+    void set_type_counts( vector< TypeCount > counts ) {
+        lock_guard< mutex > lock( guard );
+        types = move( counts );
+    }
+    /** Type counts of the graph as it was when counted last time.*/
+    vector< TypeCount > type_counts() const {
+        lock_guard< mutex > lock( guard );
+        return types;
+    }
+
+    struct PhaseTime {
+        string name;
+        double seconds = 0;
+        /** Phase might run multiple times, i.e. once per included file.*/
+        uint64_t count = 0;
+        /** Nodes of the largest graph phase worked over: alive once it started or once it ended, whichever is more.*/
+        uint64_t nodes = 0;
+    };
+
+    /** Nodes created and not deleted yet.*/
+    uint64_t live_nodes() const {
+        const uint64_t created = nodes_created;
+        const uint64_t deleted = nodes_deleted;
+        return created > deleted ? created - deleted : 0;
+    }
+
+    /** Adds time spent within phase to it's total.*/
+    void add_phase( const string & name, const double seconds, const uint64_t nodes = 0 ) {
+        lock_guard< mutex > lock( guard );
+        for ( auto & phase : phases ) {
+            if ( phase.name == name ) {
+                phase.seconds += seconds;
+                ++ phase.count;
+                phase.nodes = max( phase.nodes, nodes );
+                return;
+            }
+        }
+        phases.push_back( { name, seconds, 1, nodes } );
+    }
+    /** Phases in order of their first occurence.*/
+    vector< PhaseTime > phase_times() const {
+        lock_guard< mutex > lock( guard );
+        return phases;
+    }
+
+    void write_json( ostream & o ) const {
+        const auto precision = o.precision( 9 );
+        o << "{\"phases\":[";
+        bool first = true;
+        for ( const auto & phase : phase_times() ) {
+            if ( ! first )
+                o << ",";
+            first = false;
+            o << "{\"name\":";
+            write_json_string( o, phase.name );
+            o << ",\"seconds\":" << phase.seconds << ",\"count\":" << phase.count << ",\"nodes\":" << phase.nodes << "}";
+        }
+        o << "],\"counters\":{";
+        o << "\"nodes_created\":" << nodes_created;
+        o << ",\"nodes_deleted\":" << nodes_deleted;
+        o << ",\"edges_added\":" << edges_added;
+        o << ",\"pulses\":" << pulses;
+        o << ",\"nodes_visited\":" << nodes_visited;
+        o << ",\"evaluation_attempts\":" << evaluation_attempts;
+        o << ",\"evaluation_successes\":" << evaluation_successes;
+        o << ",\"conditions_folded\":" << conditions_folded;
+        o << ",\"branches_pruned\":" << branches_pruned;
+        o << ",\"branches_solved\":" << branches_solved;
+        o << ",\"branches_collapsed\":" << branches_collapsed;
+        o << ",\"branches_cancelled\":" << branches_cancelled;
+        o << ",\"branches_dropped\":" << branches_dropped;
+        o << ",\"branch_cache_hits\":" << branch_cache_hits;
+        o << ",\"branch_cache_misses\":" << branch_cache_misses;
+        o << ",\"graph_cache_hits\":" << graph_cache_hits;
+        o << ",\"graph_cache_misses\":" << graph_cache_misses;
+        o << "},\"memory\":{";
+        for ( size_t m = 0; m < MemorySubsystems; ++ m ) {
+            if ( m > 0 )
+                o << ",";
+            o << "\"" << MemoryNames[ m ] << "\":{\"live\":" << live_bytes[ m ] << ",\"peak\":" << peak_bytes[ m ] << "}";
+        }
+        o << "},\"types\":{";
+        first = true;
+        for ( const auto & type : type_counts() ) {
+            if ( ! first )
+                o << ",";
+            first = false;
+            write_json_string( o, type.type );
+            o << ":{\"nodes\":" << type.nodes << ",\"edges\":" << type.edges << "}";
+        }
+        o << "}}";
+        o.precision( precision );
+    }
+
+private:
+    mutable mutex guard;
+    vector< PhaseTime > phases;
+    vector< TypeCount > types;
+};
+
+/** Stats of compilation current thread works for or nullptr if nothing should be counted.*/
+inline Stats *& current_stats() {
+    thread_local Stats * stats = nullptr;
+    return stats;
+}
+
+/** Increments specified counter of current Stats (if any).*/
+inline void count_stat( atomic< uint64_t > Stats::* counter, const uint64_t n = 1 ) {
+    if ( auto stats = current_stats() )
+        ( stats->*counter ).fetch_add( n, memory_order_relaxed );
+}
+
+/** Accounts allocation (or deallocation if bytes are negative) within current Stats (if any).*/
+inline void charge_memory( const MEMORY subsystem, const int64_t bytes ) {
+    if ( auto stats = current_stats() )
+        stats->charge( subsystem, bytes );
+}
+
+/** Makes current thread count into specified Stats until the end of scope. Tasks executed by other threads should open their own scopes.*/
+struct StatsScope {
+    Stats * previous;
+    StatsScope( Stats * stats ): previous( current_stats() ) {
+        current_stats() = stats;
+    }
+    ~StatsScope() {
+        current_stats() = previous;
+    }
+};
+
+/** Measures time until the end of scope and adds it to current Stats as named phase. Also recorded as span of the timeline if it's enabled.*/
+struct Phase {
+    const char * name;
+    Stats * stats;
+    chrono::steady_clock::time_point start;
+    uint64_t start_nodes = 0;
+    TimelineSpan span;
+
+    Phase( const char * name ): name(name), stats( current_stats() ), span( name ) {
+        if ( stats ) {
+            start = chrono::steady_clock::now();
+            start_nodes = stats->live_nodes();
+        }
+    }
+    ~Phase() {
+        if ( stats )
+            stats->add_phase( name, chrono::duration< double >( chrono::steady_clock::now() - start ).count(), max( start_nodes, stats->live_nodes() ) );
+    }
+};
@@ -1,3 +1,4 @@
+#pragma once
 
 #include <iomanip>
 #include <iostream>
@@ -13,14 +14,20 @@
 #include <utility>
 #include <algorithm>
 #include <numeric>
+#include <filesystem>
+#include <mutex>
+#include <sstream>
 #include "syntax_tree.hpp"
 #include "plot.hpp"
+#include "position_index.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 #include <stdlib.h>
 
 using namespace std;
 
 /** Returns true if specified string consist of whitespace characters only.*/
-bool only_whitespace( const string & line ) {
+inline bool only_whitespace( const string & line ) {
     for ( const auto & ch : line ) {
         if ( ! isspace( ch ) )
             return false;
@@ -28,9 +35,8 @@ bool only_whitespace( const string & line ) {
     return true;
 }
 
-Node * parse_lines( const string & file_name ) {
-    ifstream file( file_name );
-
+/** Splits source into chained TYPE::LINE nodes referenced by single TYPE::SOURCE_FILE node.*/
+inline Node * parse_lines( istream & file, const string & file_name ) {
     auto file_node = new Node(
         file_name,
         TYPE::SOURCE_FILE,
@@ -66,96 +72,169 @@ Node * parse_lines( const string & file_name ) {
 
     return file_node;
 }
+inline Node * parse_lines( const string & file_name ) {
+    ifstream file( file_name );
+    return parse_lines( file, file_name );
+}
 
-void remove_empty_lines( Node * root ) {
-    set< Node * > remove;
+/** Returns file's LINEs in syntactic order.*/
+inline vector< Node * > file_lines( Node * file_node ) {
+    vector< Node * > lines;
+    auto line_node = file_node;
+    while ( ( line_node = line_node->child( TYPE::LINE ) ) )
+        lines.push_back( line_node );
+    return lines;
+}
 
-    const auto & on_line = [&]( Node * line_node ) {
-        if ( ! line_node->type( TYPE::LINE ) )
-            return true;
-        
-        if ( only_whitespace( line_node->content ) ) {
-            const auto P = { TYPE::LINE, TYPE::SOURCE_FILE };
-            auto parent = line_node->parent( P );
-            auto child = line_node->child( TYPE::LINE );
-            if ( parent && child )
-                parent->ref( child );
-            remove.insert( line_node );
+inline void remove_empty_lines( Node * root ) {
+    vector< Node * > files;
+    const auto & on_file = [&]( Node * file_node ) {
+        if ( file_node->type( TYPE::SOURCE_FILE ) )
+            files.push_back( file_node );
+    };
+    pulse( root, on_file );
+
+    GraphMutation mutation;
+    for ( auto file_node : files ) {
+        //empty lines might go in a row, so every kept line is chained right to the previous kept one:
+        auto kept = file_node;
+        for ( auto line_node : file_lines( file_node ) ) {
+            if ( only_whitespace( line_node->content ) ) {
+                mutation.kill( line_node );
+                continue;
+            }
+            kept->ref( line_node );
+            kept = line_node;
         }
+    }
+    mutation.commit();
+}
 
-        return true;
-    };
-    pulse( root, on_line );
+/** Removes comments from content of single line.
+@param in_multiline whether line starts within multiline comment; updated to whether the next one does.
+@return false if the whole line is within multiline comment.*/
+inline bool strip_comments( string & content, SourcePos & source_pos, bool & in_multiline ) {
+    //TODO: properly handle comment matchers inside literals (there is no definition for literals yet anyway) ...
+    for ( ;; ) {
+        if ( in_multiline ) {
+            const auto multi_end = content.find( "*/" );
+            if ( multi_end == string::npos )
+                return false;
+            in_multiline = false;
+            source_pos.char_start += multi_end + 2;
+            content.erase( 0, multi_end + 2 );
+        }
 
-    for ( const auto & r : remove )
-        delete r;
+        const auto single = content.find( "//", 0 );
+        if ( single != string::npos ) {
+            source_pos.char_end = source_pos.char_start + single;
+            content.erase( single );
+        }
+        else {
+            const auto multi = content.find( "/*", 0 );
+            if ( multi != string::npos ) {
+                const auto multi_end = content.find( "*/", multi + 2 );
+                if ( multi_end == string::npos ) {
+                    in_multiline = true;
+                    source_pos.char_end = source_pos.char_start + multi;
+                    content.erase( multi );
+                    //remaining on that same line to search for multiline comment ending:
+                    continue;
+                }
+                else {
+                    //built apart rather than replaced in place, since the comment is removed from the middle:
+                    string stripped;
+                    stripped.reserve( content.size() - ( multi_end + 2 - multi ) + 1 );
+                    stripped.append( content, 0, multi ).append( 1, ' ' ).append( content, multi_end + 2 );
+                    content = move( stripped );
+                }
+            }
+        }
+        return true;
+    }
 }
 
 /** Detects comments and removes their content from lines.*/
-void parse_comments( Node * root ) {
+inline void parse_comments( Node * root ) {
+    GraphMutation mutation;
     const auto & on_file = [&]( Node * file_node ) {
         if ( ! file_node->type( TYPE::SOURCE_FILE ) )
             return true;
-        
-        //TODO: properly handle comment matchers inside literals (there is no definition for literals yet anyway) ...
 
         bool in_multiline = false;
+        //removed lines stay chained until commit, so the next line is chained to the last kept one:
+        auto kept = file_node;
         auto node = file_node->child( TYPE::LINE );
         
         while ( node != nullptr ) {
-            if ( in_multiline ) {
-                const auto multi_end = node->content.find( "*/" );
-                if ( multi_end == string::npos ) {
-                    //completely remove the line:
-                    auto next = node->child( TYPE::LINE );
-                    const auto P = { TYPE::LINE, TYPE::SOURCE_FILE };
-                    auto parent = node->parent( P );
-                    if ( parent && next )
-                        parent->ref( next );
-                    delete node;
-                    node = next;
-                    continue;
-                }
-                else {
-                    in_multiline = false;
-                    node->source_pos.char_start += multi_end + 2;
-                    node->content = node->content.substr( multi_end + 2 );
-                }
+            auto next = node->child( TYPE::LINE );
+            if ( ! strip_comments( node->content, node->source_pos, in_multiline ) ) {
+                //completely remove the line:
+                if ( next )
+                    kept->ref( next );
+                mutation.kill( node );
             }
-
-            const auto single = node->content.find( "//", 0 );
-            if ( single != string::npos ) {
-                node->source_pos.char_end = node->source_pos.char_start + single;
-                node->content = node->content.substr( 0, single );
-            }
-            else {
-                const auto multi = node->content.find( "/*", 0 );
-                if ( multi != string::npos ) {
-                    const auto multi_end = node->content.find( "*/", multi + 2 );
-                    if ( multi_end == string::npos ) {
-                        in_multiline = true;
-                        node->source_pos.char_end = node->source_pos.char_start + multi;
-                        node->content = node->content.substr( 0, multi );
-                        //remaining on that same line to search for multiline comment ending:
-                        continue;
-                    }
-                    else {
-                        node->content = node->content.replace( multi, multi_end + 2 - multi, " " );
-                    }
-                }
-            }
-
-            node = node->child( TYPE::LINE );
+            else
+                kept = node;
+            node = next;
         }
         return true;
     };
     pulse( root, on_file );
+    mutation.commit();
 
     remove_empty_lines( root );
 }
 
+/** Detects "include" directives, replaces their lines with TYPE::INCLUDE nodes (one per included path) referenced by file.*/
+inline void parse_includes( Node * root ) {
+    const string Include = "include";
+
+    GraphMutation mutation;
+    const auto & on_file = [&]( Node * file_node ) {
+        if ( ! file_node->type( TYPE::SOURCE_FILE ) )
+            return;
+
+        auto kept = file_node;
+        for ( auto node : file_lines( file_node ) ) {
+            const auto start = node->content.find_first_not_of( " \t" );
+            if (
+                start == string::npos
+                ||
+                node->content.compare( start, Include.size(), Include ) != 0
+                ||
+                ( start + Include.size() < node->content.size() && ! isspace( node->content.at( start + Include.size() ) ) )
+            ) {
+                kept = node;
+                continue;
+            }
+
+            //every whitespace-separated word is an included path:
+            auto caret = start + Include.size();
+            while ( ( caret = node->content.find_first_not_of( " \t", caret ) ) != string::npos ) {
+                auto end = node->content.find_first_of( " \t", caret );
+                if ( end == string::npos )
+                    end = node->content.size();
+                file_node->ref( new Node(
+                    node->content.substr( caret, end - caret ),
+                    TYPE::INCLUDE,
+                    node->source_pos.disp( caret, end - caret )
+                ) );
+                caret = end;
+            }
+
+            auto next = node->child( TYPE::LINE );
+            if ( next )
+                kept->ref( next );
+            mutation.kill( node );
+        }
+    };
+    pulse( root, on_file, set{ TYPE::SOURCE_FILE } );
+    mutation.commit();
+}
+
 /** Returns true if specified string contains of alphabetic characters only.*/
-bool is_alpha_string( const string & s ) {
+inline bool is_alpha_string( const string & s ) {
     for ( const auto ch : s ) {
         if ( ! isalpha( ch ) )
             return false;
@@ -163,19 +242,10 @@ bool is_alpha_string( const string & s ) {
     return true;
 }
 
-/** Returns true if specified SourcePos intersects with any existing element on specified LINE.*/
-bool intersects_any_on_line( const Node * line, const SourcePos & s ) {
-    for ( auto line_el : line->refs ) {
-        if ( line_el->type( set{ TYPE::SOURCE_FILE, TYPE::LINE } ) )
-            continue;
-        if ( line_el->source_pos.intersects( s, false ) )
-            return true;
-    }
-    return false;
-}
-
-bool match_operator(
+/** @param tokens everything already matched on the LINE, which the operator must not intersect with.*/
+inline bool match_operator(
     Node * line_node,
+    LineIndex & tokens,
     const string & op,
     size_t & caret
 ) {
@@ -184,7 +254,7 @@ bool match_operator(
     if ( r == string::npos )
         return false;
     
-    if ( intersects_any_on_line( line_node, line_node->source_pos.disp( r, op.size() ) ) )
+    if ( tokens.intersects( line_node->source_pos.disp( r, op.size() ) ) )
         return false;
 
     //deny matching if literal operator has other literals around:
@@ -215,159 +285,165 @@ bool match_operator(
         TYPE::OPERATOR,
         line_node->source_pos.disp( r, op.size() )
     );
-    cout << "Operator found: " << op << " at " << op_node->source_pos << endl;
+    TRACE( LEXER, VERBOSE ) << "Operator found: " << op << " at " << op_node->source_pos;
     line_node->ref( op_node );
+    tokens.insert( op_node );
     caret = r + op.size();
     return true;
 }
 
-void match_operators( Node * root ) {
-    const auto & on_line = []( Node * line_node ){
-        if ( ! line_node->type( TYPE::LINE ) )
-            return true;
-        
-        for ( const auto & op : LongerOperators ) {
-            size_t caret = 0;
-            while ( caret < line_node->content.size() ) {
-                if ( ! match_operator( line_node, op, caret ) )
-                    break;
-            }
+/** Matches every operator within single LINE.*/
+inline void match_operators( Node * line_node, LineIndex & tokens ) {
+    for ( const auto & op : LongerOperators ) {
+        size_t caret = 0;
+        while ( caret < line_node->content.size() ) {
+            if ( ! match_operator( line_node, tokens, op, caret ) )
+                break;
         }
-
-        return true;
-    };
-    pulse( root, on_line );
+    }
 }
 
-bool is_number( const string & content ) {
+inline bool is_number( const string & content ) {
     char * tail = (char*)1;
     strtoll( content.c_str(), & tail, 0 );
     return tail == ( & ( content [ content.size() ] ) );
 }
 
-void match_terms( Node * root ) {
-    const auto & on_line = [&]( Node * line_node ) {
-        if ( ! line_node->type( TYPE::LINE ) )
-            return true;
-        
-        int32_t seq_start = 0;
-        for ( size_t caret = 0; caret <= line_node->content.size(); ++ caret ) {
-            if (
-                caret >= line_node->content.size()
-                ||
-                ! isalnum( line_node->content.at( caret ) )
-                ||
-                //check that not yet an operator:
-                intersects_any_on_line( line_node, line_node->source_pos.disp( caret, 1 ) )
-            ) {
-                const auto length = caret - seq_start;
-                if ( length > 0 ) {
-                    auto term_node = new Node(
-                        line_node->content.substr( seq_start, length ),
-                        TYPE::TERM,
-                        line_node->source_pos.disp( seq_start, length )
-                    );
-                    line_node->ref( term_node );
-                    cout << "Term " << term_node->content << " spawned at " << term_node->source_pos << " with length " << length << endl;
-
-                    if ( is_number( term_node->content ) )
-                        term_node->types.insert( TYPE::NUMBER );
-                }
-                seq_start = caret + 1;
+/** Matches TERMs within single LINE in between of already matched operators.*/
+inline void match_terms( Node * line_node, const LineIndex & tokens ) {
+    int32_t seq_start = 0;
+    for ( size_t caret = 0; caret <= line_node->content.size(); ++ caret ) {
+        if (
+            caret >= line_node->content.size()
+            ||
+            ! isalnum( line_node->content.at( caret ) )
+            ||
+            //check that not yet an operator:
+            tokens.intersects( line_node->source_pos.disp( caret, 1 ) )
+        ) {
+            const auto length = caret - seq_start;
+            if ( length > 0 ) {
+                auto term_node = new Node(
+                    line_node->content.substr( seq_start, length ),
+                    TYPE::TERM,
+                    line_node->source_pos.disp( seq_start, length )
+                );
+                line_node->ref( term_node );
+                TRACE( LEXER, VERBOSE ) << "Term " << term_node->content << " spawned at " << term_node->source_pos << " with length " << length;
+
+                if ( is_number( term_node->content ) )
+                    term_node->types.insert( TYPE::NUMBER );
             }
+            seq_start = caret + 1;
         }
-        return true;
-    };
-    pulse( root, on_line );
+    }
 }
 
 struct FileCache {
+    /** All the lexed TERMs and OPERATORs in syntactic order.*/
+    vector< Node * > tokens;
     list< Node * > terms;
     list< Node * > operators;
 };
 
-void chain_terms_and_operators(
+/** Splits every SOURCE_FILE's lines table into chunks and lexes them concurrently: once comments are removed lines don't depend on each other. Per-chunk tokens are merged back in syntactic order.*/
+inline void lex(
     Node * root,
-    map< Node *, FileCache > & cache
+    map< Node *, FileCache > & cache,
+    ThreadPool & pool = default_pool()
 ) {
+    //not worth scheduling for less lines:
+    const size_t MinChunk = 256;
+
+    vector< Node * > files;
     const auto & on_file = [&]( Node * file_node ) {
-        if ( ! file_node->type( TYPE::SOURCE_FILE ) )
-            return;
-        
-        //expression that is currently being parsed:
-        Node * caret = nullptr;
-        
-        auto line_node = file_node;
-        while ( ( line_node = line_node->child( TYPE::LINE ) ) ) {
-            list< Node * > terms_and_ops;
+        if ( file_node->type( TYPE::SOURCE_FILE ) )
+            files.push_back( file_node );
+    };
+    pulse( root, on_file );
 
-            for ( auto & to_ref : line_node->refs ) {
-                if ( to_ref->type( set{ TYPE::TERM, TYPE::OPERATOR } ) ) {
-                    terms_and_ops.push_back( to_ref );
+    const auto stats = current_stats();
+
+    for ( auto file_node : files ) {
+        const auto lines = file_lines( file_node );
+        const auto chunk = max( MinChunk, lines.size() / ( pool.size() * 4 ) + 1 );
+        vector< vector< Node * > > chunks( ( lines.size() + chunk - 1 ) / chunk );
+
+        pool.parallel_for( chunks.size(), [&]( const size_t c ) {
+            StatsScope scope( stats );
+            auto & tokens = chunks[ c ];
+            const auto end = min( lines.size(), ( c + 1 ) * chunk );
+            for ( auto l = c * chunk; l < end; ++ l ) {
+                auto line_node = lines[ l ];
+                LineIndex line_tokens;
+                for ( auto & to : line_node->refs ) {
+                    if ( ! to->type( set{ TYPE::SOURCE_FILE, TYPE::LINE } ) )
+                        line_tokens.insert( to );
                 }
-            }
-
-            syntactic_position_sort( terms_and_ops );
-            for ( auto & to : terms_and_ops ) {
-                if ( to->type( TYPE::TERM ) )
-                    cache[ file_node ].terms.push_back( to );
-                if ( to->type( TYPE::OPERATOR ) )
-                    cache[ file_node ].operators.push_back( to );
+                match_operators( line_node, line_tokens );
+                match_terms( line_node, line_tokens );
 
-                if ( caret == nullptr ) {
-                    caret = to;
-                    file_node->ref( caret );
-                }
-                else {
-                    caret->ref( to );
-                    caret = to;
+                const auto line_start = tokens.size();
+                for ( auto & to : line_node->refs ) {
+                    if ( to->type( set{ TYPE::TERM, TYPE::OPERATOR } ) )
+                        tokens.push_back( to );
                 }
+                sort(
+                    tokens.begin() + line_start,
+                    tokens.end(),
+                    []( Node * left, Node * right ) { return left->source_pos < right->source_pos; }
+                );
             }
-        }
-    };
-    pulse( root, on_file );
-}
+        } );
 
-int32_t index_in( const auto & array, const auto & el ) {
-    int32_t i = -1;
-    for ( const auto & existing : array ) {
-        ++ i;
-        if ( el == existing )
-            return i;
+        auto & tokens = cache[ file_node ].tokens;
+        for ( auto & c : chunks )
+            tokens.insert( tokens.end(), c.begin(), c.end() );
     }
-    return -1;
 }
-/** Returns element at specified position within ordered container with random access ability (like list, vector, array, etc.).*/
-auto random_access_at( auto & array, const auto & pos ) {
-    auto it = begin( array );
-    advance( it, pos );
-    return * it;
+
+inline void chain_terms_and_operators(
+    map< Node *, FileCache > & cache
+) {
+    for ( auto & [ file_node, file ] : cache ) {
+        //expression that is currently being parsed:
+        Node * caret = nullptr;
+
+        for ( auto & to : file.tokens ) {
+            if ( to->type( TYPE::TERM ) )
+                file.terms.push_back( to );
+            if ( to->type( TYPE::OPERATOR ) )
+                file.operators.push_back( to );
+
+            if ( caret == nullptr ) {
+                caret = to;
+                file_node->ref( caret );
+            }
+            else {
+                caret->ref( to );
+                caret = to;
+            }
+        }
+    }
 }
 
 /** Returns operators sorted by their semantical precedence.*/
 template< typename Ops >
 auto semantic_operators_order( const Ops & ops ) {
-    //sort operators by their precedence order:
-    vector< size_t > pointers( ops.size() );
-    iota( pointers.begin(), pointers.end(), 0 );
+    //sort operators by their precedence order (syntactic order is kept for the same precedence):
+    vector< pair< int32_t, typename Ops::value_type > > sorted;
+    sorted.reserve( ops.size() );
+    for ( const auto & op : ops )
+        sorted.emplace_back( Precedences.at( op->content ), op );
     stable_sort(
-        pointers.begin(),
-        pointers.end(),
-        [&](
-            const size_t & i1,
-            const size_t & i2
-        ) {
-            return
-                index_in( Operators, random_access_at( ops, i1 )->content )
-                <
-                index_in( Operators, random_access_at( ops, i2 )->content )
-            ;
-        }
+        sorted.begin(),
+        sorted.end(),
+        []( const auto & left, const auto & right ) { return left.first < right.first; }
     );
 
     list< typename Ops::value_type > result;
-    for ( const auto & p : pointers )
-        result.push_back( random_access_at( ops, p ) );
+    for ( const auto & op : sorted )
+        result.push_back( op.second );
     return result;
 }
 
@@ -397,14 +473,14 @@ Node * relative_term_up_to_expression( auto & from, const Stop & or_stop = false
     return ultimate_parent_expression( rel, or_stop );
 }
 
-auto check_rel_presence( const Node * from, const Node * term, const string & orient ) {
+inline auto check_rel_presence( const Node * from, const Node * term, const string & orient ) {
     if ( term == nullptr ) {
-        cout << "ERROR: no term at " << orient << " from operator " << from->content << " at " << from->source_pos << endl;
+        TRACE( PARSER, ERROR ) << "ERROR: no term at " << orient << " from operator " << from->content << " at " << from->source_pos;
         throw runtime_error( "semantics error" );
     }
 }
 
-Node * consume_left( Node * op, Node *& expr ) {
+inline Node * consume_left( Node * op, Node *& expr ) {
     auto left = relative_term_up_to_expression( op->refd );
     check_rel_presence( op, left, "left" );
 
@@ -419,7 +495,7 @@ Node * consume_left( Node * op, Node *& expr ) {
 
     return left;
 }
-Node * consume_right( Node * op, Node *& expr ) {
+inline Node * consume_right( Node * op, Node *& expr ) {
     auto right = relative_term_up_to_expression( op->refs );
     check_rel_presence( op, right, "right" );
 
@@ -434,7 +510,7 @@ Node * consume_right( Node * op, Node *& expr ) {
 
     return right;
 }
-Node * consume_infix( Node * op ) {
+inline Node * consume_infix( Node * op ) {
     Node * expr = nullptr;
     auto left = consume_left( op, expr );
     consume_right( op, expr );
@@ -452,15 +528,17 @@ Node * consume_infix( Node * op ) {
     return expr;
 }
 
-void match_semantics(
+inline void match_semantics(
     map< Node *, FileCache > & cache
 ) {
     for ( auto & file : cache ) {
         auto ops = semantic_operators_order( file.second.operators );
 
-        cout << "Operators sorted by their precedence:" << endl;
-        for ( const auto & op : ops ) {
-            cout << "    " << op->content << " at " << op->source_pos << endl;
+        if ( TRACING( PARSER, DEBUG ) ) {
+            TRACE( PARSER, DEBUG ) << "Operators sorted by their precedence:";
+            for ( const auto & op : ops ) {
+                TRACE( PARSER, DEBUG ) << "    " << op->content << " at " << op->source_pos;
+            }
         }
 
         //operators consume their operands:
@@ -484,20 +562,21 @@ void match_semantics(
 
             if ( expr == nullptr ) {
                 const string error = string( "ERROR: operator " ) + op->content + " was NOT matched.";
-                cout << error << endl;
+                TRACE( PARSER, ERROR ) << error;
                 throw runtime_error( error );
             }
-            else {
-                cout << "Operator " << op << " successfully matched into EXPRESSION " << expr << ":" << endl;
+            else if ( TRACING( PARSER, DEBUG ) ) {
+                TRACE( PARSER, DEBUG ) << "Operator " << op << " successfully matched into EXPRESSION " << expr << ":";
                 for ( const auto & ref : expr->refs )
-                    cout << "    " << ref << endl;
+                    TRACE( PARSER, DEBUG ) << "    " << ref;
             }
         }
     }
 }
 
-auto bottom_semantics( Node * node ) {
-    list< Node * > bottom;
+/** TERMs and OPERATORs the EXPRESSION is composed of in syntactic order.*/
+inline vector< Node * > bottom_semantics( Node * node ) {
+    vector< Node * > bottom;
     const auto & on_child = [&]( Node * child ) {
         for ( auto deep : child->refs ) {
             if ( deep->type( set{ TYPE::TERM, TYPE::OPERATOR } ) )
@@ -505,11 +584,10 @@ auto bottom_semantics( Node * node ) {
         }
     };
     pulse< true, false >( node, on_child, set{ TYPE::EXPRESSION } );
-    syntactic_position_sort( bottom );
-    return bottom;
+    return PositionIndex::sorted( bottom );
 }
 
-void reglue_parent_expr( Node * node, Node * to ) {
+inline void reglue_parent_expr( Node * node, Node * to ) {
     auto parent = node->parent( TYPE::EXPRESSION );
     if ( parent != nullptr ) {
         parent->unref( node );
@@ -517,9 +595,11 @@ void reglue_parent_expr( Node * node, Node * to ) {
     }
 }
 
-void merge_ifs( Node * root ) {
-    const auto & on_node = []( Node * node ) {
-        if ( ! node->type( TYPE::EXPRESSION ) )
+inline void merge_ifs( Node * root ) {
+    //"else" can be matched only with already matched "if-then", so all the "then"s go first regardless of traverse order:
+    string matching;
+    const auto & on_node = [&]( Node * node ) {
+        if ( ! node->type( TYPE::EXPRESSION ) || node->content != matching )
             return;
         
         //if not top-level expression:
@@ -531,25 +611,27 @@ void merge_ifs( Node * root ) {
             if ( left == nullptr || left->content != "if expression" ) {
                 ostringstream str;
                 str << "ERROR: no if expression at left of " << node;
-                cout << str.str() << endl;
-
-                cout << "    left: " << left << endl;
-                const auto bottom = bottom_semantics( node );
-                cout << "    it has bottom semantics (syntactically ordered):" << endl;
-                for ( const auto & b : bottom )
-                    cout << "        " << b << endl;
-                
-                cout << "    referenced by:" << endl;
-                for ( const auto & pr : bottom_semantics( node ).front()->refd )
-                    cout << "        " << pr << endl;
-                
-                cout << "    refs:" << endl;
-                for ( const auto & ref : node->refs ) {
-                    cout << "        " << ref << endl;
-
-                    cout << "            red:" << endl;
-                    for ( const auto & red : ref->refd ) {
-                        cout << "                " << red << endl;
+                TRACE( PARSER, ERROR ) << str.str();
+
+                if ( TRACING( PARSER, ERROR ) ) {
+                    TRACE( PARSER, ERROR ) << "    left: " << left;
+                    const auto bottom = bottom_semantics( node );
+                    TRACE( PARSER, ERROR ) << "    it has bottom semantics (syntactically ordered):";
+                    for ( const auto & b : bottom )
+                        TRACE( PARSER, ERROR ) << "        " << b;
+
+                    TRACE( PARSER, ERROR ) << "    referenced by:";
+                    for ( const auto & pr : bottom_semantics( node ).front()->refd )
+                        TRACE( PARSER, ERROR ) << "        " << pr;
+
+                    TRACE( PARSER, ERROR ) << "    refs:";
+                    for ( const auto & ref : node->refs ) {
+                        TRACE( PARSER, ERROR ) << "        " << ref;
+
+                        TRACE( PARSER, ERROR ) << "            red:";
+                        for ( const auto & red : ref->refd ) {
+                            TRACE( PARSER, ERROR ) << "                " << red;
+                        }
                     }
                 }
 
@@ -567,14 +649,14 @@ void merge_ifs( Node * root ) {
 
             if_then->ref( left );
             if_then->ref( node );
-            cout << "Matched then with else: " << if_then << endl;
+            TRACE( PARSER, DEBUG ) << "Matched then with else: " << if_then;
         }
         else if ( node->content == "else expression" ) {
             auto left = relative_term_up_to_expression( bottom_semantics( node ).front()->refd, vector{ "if-then expression" } );
             if ( left == nullptr || left->content != "if-then expression" ) {
                 ostringstream str;
                 str << "ERROR: no if-then expression at left of " << node;
-                cout << str.str() << endl;
+                TRACE( PARSER, ERROR ) << str.str();
                 throw runtime_error( str.str() );
             }
 
@@ -589,23 +671,25 @@ void merge_ifs( Node * root ) {
 
             if_then_else->ref( left );
             if_then_else->ref( node );
-            cout << "Matched else with if-then: " << if_then_else << endl;
+            TRACE( PARSER, DEBUG ) << "Matched else with if-then: " << if_then_else;
         }
     };
-    pulse( root, on_node );
+    for ( const auto & expression : { "then expression", "else expression" } ) {
+        matching = expression;
+        pulse( root, on_node );
+    }
 }
 
-Node * find_line_from_expression( Node * expr ) {
-    Node * result = nullptr;
-    const auto & on_node = [&]( Node * node ) {
-        if ( node->type( set{ TYPE::TERM, TYPE::OPERATOR } ) ) {
-            result = find_types( node->refd, TYPE::LINE );
-            return false;
-        }
-        return true;
-    };
-    pulse< true, false >( expr, on_node );
-    return result;
+/** LINE where expression (or token) starts: expression might span multiple lines, so it's syntactically first token decides regardless of addresses.*/
+inline Node * find_line_from_expression( Node * expr ) {
+    auto token = expr;
+    if ( ! expr->type( set{ TYPE::TERM, TYPE::OPERATOR } ) ) {
+        const auto bottom = bottom_semantics( expr );
+        if ( bottom.empty() )
+            return nullptr;
+        token = bottom.front();
+    }
+    return find_types( token->refd, TYPE::LINE );
 }
 
 Node * consume_right_until_indentation( Node * from, auto & syntactic_it, const string & name, const auto & until ) {
@@ -616,7 +700,7 @@ Node * consume_right_until_indentation( Node * from, auto & syntactic_it, const
 
         auto right_line = find_line_from_expression( right );
         if ( right_line != line && ! increased_indentation( right_line, line ) ) {
-            cout << "        different lines " << line << " AND " << right_line << " and NOT increased indentation" << endl;
+            TRACE( PARSER, VERBOSE ) << "        different lines " << line << " AND " << right_line << " and NOT increased indentation";
             break;
         }
         
@@ -627,63 +711,69 @@ Node * consume_right_until_indentation( Node * from, auto & syntactic_it, const
                 from->source_pos
             );
             rolling->ref( from );
-            cout << "        spawned EXPRESSION for left " << from << endl;
+            TRACE( PARSER, VERBOSE ) << "        spawned EXPRESSION for left " << from;
         }
-        cout << "        spawned RIGHT " << right << endl;
+        TRACE( PARSER, VERBOSE ) << "        spawned RIGHT " << right;
         rolling->ref( right );
         ++ syntactic_it;
     }
     return rolling;
 }
 
-void match_right_all( Node * file ) {
+inline void match_right_all( Node * file ) {
     set< Node * > top_level_set;
     const auto & on_node = [&]( Node * node ) {
         if ( node->type( set{ TYPE::LINE, TYPE::SOURCE_FILE } ) )
             return;
         //if NOT top level expression:
         if ( find_types( node->refd, vector{ TYPE::EXPRESSION, TYPE::ENTITY } ) != nullptr ) {
-            //cout << "    skipping node " << node << " because it's NOT top-level since it's referenced by " << find_types( node->refd, vector{ TYPE::EXPRESSION, TYPE::ENTITY } ) << endl;
+            //TRACE( PARSER, VERBOSE ) << "    skipping node " << node << " because it's NOT top-level since it's referenced by " << find_types( node->refd, vector{ TYPE::EXPRESSION, TYPE::ENTITY } );
             return;
         }
         top_level_set.insert( node );
     };
     pulse( file, on_node, false, set{ TYPE::SOURCE_FILE } );
 
-    list< Node * > top_level_list;
-    for ( auto & n : top_level_set )
-        top_level_list.push_back( n );
-    syntactic_position_sort( top_level_list );
+    const auto top_level_list = PositionIndex::sorted( top_level_set );
 
-    cout << "Top level semantic nodes of file " << file->content << " in syntactic order:" << endl;
+    TRACE( PARSER, DEBUG ) << "Top level semantic nodes of file " << file->content << " in syntactic order:";
     auto tl_it = top_level_list.begin();
     while ( tl_it != top_level_list.end() ) {
         auto tl = * tl_it;
-        cout << "    " << tl << endl;
+        TRACE( PARSER, DEBUG ) << "    " << tl;
         ++ tl_it;
 
         //RIGHT_ALL operand:
         if ( tl->type( TYPE::OPERATOR ) ) {
             auto op = consume_right_until_indentation( tl, tl_it, "operator", top_level_list.end() );
+            if ( op == nullptr ) {
+                ostringstream str;
+                str << "ERROR: no operands at right of " << tl;
+                TRACE( PARSER, ERROR ) << str.str();
+                throw runtime_error( str.str() );
+            }
             if ( tl->content == "inputs" )
                 op->types.insert( TYPE::INPUTS );
             else if ( tl->content == "outputs" )
                 op->types.insert( TYPE::OUTPUTS );
             else
-                cout << "ERROR: undefined RIGHT_ALL operator." << endl;
+                TRACE( PARSER, ERROR ) << "ERROR: undefined RIGHT_ALL operator.";
             continue;
         }
 
         //entity:
         if ( tl->type( TYPE::TERM ) ) {
             auto entity = consume_right_until_indentation( tl, tl_it, "entity", top_level_list.end() );
+            //just a term, nothing composed into it:
+            if ( entity == nullptr )
+                continue;
             entity->types.insert( TYPE::ENTITY );
             //TODO: maybe recursively? To handle potential entities defined as part of bigger entities (does it make any sense though?) ...
             continue;
         }
     }
 }
-void match_right_all_files( Node * root ) {
+inline void match_right_all_files( Node * root ) {
     const auto & on_file = []( Node * file_node ) {
         if ( file_node->type( TYPE::SOURCE_FILE ) )
             match_right_all( file_node );
@@ -691,43 +781,204 @@ void match_right_all_files( Node * root ) {
     pulse( root, on_file );
 }
 
-auto parse_source( const string & file_name ) {
-    auto root = parse_lines( file_name );
+/** @param file_name name under which source's nodes are positioned; doesn't have to exist in file system if source was read from memory.*/
+inline Node * parse_source( istream & source, const string & file_name, ThreadPool & pool = default_pool() ) {
+    Node * root = nullptr;
+    {
+        Phase phase( "parse_lines" );
+        root = parse_lines( source, file_name );
+    }
     if ( root == nullptr ) {
-        cout << "ERROR: empty source." << endl;
+        TRACE( PARSER, ERROR ) << "ERROR: empty source.";
         return root;
     }
-    parse_comments( root );
-    match_operators( root );
-    match_terms( root );
+    //partially parsed graph isn't returned to anyone:
+    try {
+        {
+            Phase phase( "parse_comments" );
+            parse_comments( root );
+        }
+        {
+            Phase phase( "parse_includes" );
+            parse_includes( root );
+        }
 
-    {
-        map< Node *, FileCache > cache;
-        chain_terms_and_operators( root, cache );
-        match_semantics( cache );
+        {
+            map< Node *, FileCache > cache;
+            {
+                Phase phase( "lex" );
+                lex( root, cache, pool );
+            }
+            {
+                Phase phase( "chain_terms_and_operators" );
+                chain_terms_and_operators( cache );
+            }
+            {
+                Phase phase( "match_semantics" );
+                match_semantics( cache );
+            }
+        }
+
+        {
+            Phase phase( "merge_ifs" );
+            merge_ifs( root );
+        }
+        {
+            Phase phase( "match_right_all_files" );
+            match_right_all_files( root );
+        }
+    }
+    catch ( ... ) {
+        destroy_graph( root );
+        throw;
     }
 
-    merge_ifs( root );
-    match_right_all_files( root );
+    return root;
+}
+inline Node * parse_source( const string & file_name ) {
+    ifstream file( file_name );
+    return parse_source( file, file_name );
+}
+
+/** Path of file included from includer file: relative to includer's directory, ".rcl" extension might be omitted.*/
+inline string resolve_include( const string & includer, const string & included ) {
+    filesystem::path path( included );
+    if ( ! path.has_extension() )
+        path += ".rcl";
+    if ( path.is_relative() )
+        path = filesystem::path( includer ).parent_path() / path;
+    return path.lexically_normal().string();
+}
+
+/** Separately parsed SOURCE_FILEs of single program.*/
+/** 64-bit FNV-1a: might be continued with another content by passing the previous hash.*/
+inline uint64_t content_hash( const string_view content, uint64_t hash = 0xcbf29ce484222325ull ) {
+    for ( const auto c : content ) {
+        hash ^= uint8_t( c );
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+struct Sources {
+    mutex guard;
+    /** By canonical paths, so the same file included with different relative paths is parsed once.*/
+    map< string, Node * > files;
+    /** Contents hashes of included files by the names they're parsed with, if requested.*/
+    map< string, uint64_t > * hashes = nullptr;
+};
 
+inline vector< Node * > includes_of( Node * file_node ) {
+    vector< Node * > includes;
+    for ( auto ref : file_node->refs ) {
+        if ( ref->type( TYPE::INCLUDE ) )
+            includes.push_back( ref );
+    }
+    return includes;
+}
+
+/** Concurrently parses files included by specified one (recursively). Never waits for files being parsed by others, so cyclic includes can't lock.*/
+inline void parse_included( Node * file_node, Sources & sources, ThreadPool & pool ) {
+    const auto includes = includes_of( file_node );
+    const auto stats = current_stats();
+    pool.parallel_for( includes.size(), [&]( const size_t i ) {
+        StatsScope scope( stats );
+        const auto path = resolve_include( file_node->content, includes[ i ]->content );
+        const auto key = filesystem::weakly_canonical( path ).string();
+        {
+            lock_guard< mutex > lock( sources.guard );
+            if ( ! sources.files.emplace( key, nullptr ).second )
+                return;
+        }
+
+        ifstream file( path, ios::binary );
+        if ( ! file ) {
+            ostringstream str;
+            str << "ERROR: cannot include " << path << " at " << includes[ i ]->source_pos;
+            TRACE( PARSER, ERROR ) << str.str();
+            throw runtime_error( str.str() );
+        }
+        //the very content parsed is hashed, so the file might change meanwhile:
+        ostringstream content;
+        content << file.rdbuf();
+        if ( sources.hashes ) {
+            const auto hash = content_hash( content.view() );
+            lock_guard< mutex > lock( sources.guard );
+            ( * sources.hashes )[ path ] = hash;
+        }
+        istringstream text( move( content ).str() );
+        auto included = parse_source( text, path, pool );
+        {
+            lock_guard< mutex > lock( sources.guard );
+            sources.files[ key ] = included;
+        }
+        parse_included( included, sources, pool );
+    } );
+}
+
+/** Makes every TYPE::INCLUDE node reference SOURCE_FILE it includes, so all the files get into single graph.*/
+inline void link_includes( Sources & sources ) {
+    for ( auto & file : sources.files ) {
+        for ( auto include : includes_of( file.second ) ) {
+            const auto key = filesystem::weakly_canonical( resolve_include( file.second->content, include->content ) ).string();
+            include->ref( sources.files.at( key ) );
+        }
+    }
+}
+
+/** Parses source along with all the files it includes into single graph. Each file is parsed only once no matter how many times it's included.
+@param hashes receives contents hashes (see content_hash()) of all the included files as they were parsed by their names if specified.
+@return SOURCE_FILE of specified source.*/
+inline Node * parse_program( istream & source, const string & file_name, ThreadPool & pool = default_pool(), map< string, uint64_t > * hashes = nullptr ) {
+    auto root = parse_source( source, file_name, pool );
+    if ( root == nullptr )
+        return root;
+
+    Sources sources;
+    sources.hashes = hashes;
+    sources.files[ filesystem::weakly_canonical( file_name ).string() ] = root;
+    try {
+        {
+            Phase phase( "parse_included" );
+            parse_included( root, sources, pool );
+        }
+        {
+            Phase phase( "link_includes" );
+            link_includes( sources );
+        }
+    }
+    catch ( ... ) {
+        //files parsed so far might be linked already:
+        vector< Node * > files;
+        for ( const auto & file : sources.files )
+            files.push_back( file.second );
+        destroy_graphs( files );
+        throw;
+    }
     return root;
 }
+inline Node * parse_program( const string & file_name, ThreadPool & pool = default_pool() ) {
+    ifstream file( file_name );
+    return parse_program( file, file_name, pool );
+}
 
-void print_file( const string & file_name ) {
+inline void print_file( const string & file_name ) {
+    if ( ! TRACING( LEXER, DEBUG ) )
+        return;
     ifstream file( file_name );
-    cout << "Source \"" << file_name << "\" input file:" << endl;
-    cout << "================================================" << endl;
+    TRACE( LEXER, DEBUG ) << "Source \"" << file_name << "\" input file:";
+    TRACE( LEXER, DEBUG ) << "================================================";
     string line;
     int32_t line_number = 0;
     while ( getline( file, line ) ) {
         ++ line_number;
-        cout << "Line " << line_number << ": \"" << line << "\"" << endl;
+        TRACE( LEXER, DEBUG ) << "Line " << line_number << ": \"" << line << "\"";
     }
-    cout << "================================================" << endl;
+    TRACE( LEXER, DEBUG ) << "================================================";
 }
 
-auto syntactic( const string & file_name )
+inline auto syntactic( const string & file_name, ThreadPool & pool = default_pool() )
 {
     print_file( file_name );
-    return parse_source( file_name );
+    return parse_program( file_name, pool );
 }
@@ -8,16 +8,24 @@
 #include <list>
 #include <queue>
 #include <set>
+#include <sstream>
 #include <cctype>
 #include <utility>
 #include <ranges>
 #include <algorithm>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "stats.hpp"
+#include "trace.hpp"
 
 using namespace std;
 
 enum TYPE {
     SOURCE_FILE,
     LINE,
+    /** Directive to include another source file: references included SOURCE_FILE once it's resolved.*/
+    INCLUDE,
 
     TERM,
     NUMBER,
@@ -47,10 +55,11 @@ enum TYPE {
     /** Just to break the symmetry of certain Operators (EXPRESSIONs) which have notion of "left" and "right".*/
     NONABELIAN,
 };
-ostream & operator <<( ostream & os, const TYPE & o ) {
+inline ostream & operator <<( ostream & os, const TYPE & o ) {
     switch ( o ) {
         case TYPE::SOURCE_FILE  : os << "SOURCE_FILE"  ; break;
         case TYPE::LINE         : os << "LINE"         ; break;
+        case TYPE::INCLUDE      : os << "INCLUDE"      ; break;
         case TYPE::TERM         : os << "TERM"         ; break;
         case TYPE::NUMBER       : os << "NUMBER"       ; break;
         case TYPE::OPERATOR     : os << "OPERATOR"     ; break;
@@ -76,7 +85,7 @@ enum OPERAND {
     RIGHT,
     RIGHT_ALL,
 };
-ostream & operator <<( ostream & os, const OPERAND & o ) {
+inline ostream & operator <<( ostream & os, const OPERAND & o ) {
     switch ( o ) {
         case OPERAND::INFIX    : os << "INFIX"    ; break;
         case OPERAND::LEFT     : os << "LEFT"     ; break;
@@ -123,6 +132,7 @@ const vector< OperatorDesc > OperatorsDesc = {
     { "->"     , INFIX, NON_ABELIAN },
     { "<-"     , INFIX, NON_ABELIAN },
 
+    //resolved before lexing since included paths aren't terms (see parse_includes()):
     { "include", RIGHT_ALL },
 
     { "inputs" , RIGHT_ALL },
@@ -149,6 +159,13 @@ const vector< string > Operators = []{
     }
     return data;
 }();
+/** Position of every operator within OperatorsDesc which is also it's semantical precedence.*/
+const map< string, int32_t > Precedences = []{
+    map< string, int32_t > data;
+    for ( size_t i = 0; i < OperatorsDesc.size(); ++ i )
+        data.emplace( OperatorsDesc[ i ].text, i );
+    return data;
+}();
 const map< string, OPERAND > Operands = []{
     map< string, OPERAND > data;
     for ( const auto & desc : OperatorsDesc ) {
@@ -212,7 +229,7 @@ struct SourcePos {
 
     auto operator<=>(const SourcePos&) const = default;
 };
-ostream & operator <<( ostream & os, const SourcePos & s ) {
+inline ostream & operator <<( ostream & os, const SourcePos & s ) {
     os << "{\"" << s.file << "\":" << s.line << ':' << s.char_start << '-' << s.char_end << '}';
     return os;
 }
@@ -225,29 +242,64 @@ struct Node {
     set< Node * > refs;
     /** Which other nodes reference this one.*/
     set< Node * > refd;
+    /** Subsystem this Node (along with edges it references) is accounted within.*/
+    MEMORY memory;
+    /** Bytes accounted on construction, so exactly the same amount is released on destruction whatever happens to content meanwhile.*/
+    int64_t charged;
+
+    /** Both ends of single edge.*/
+    static constexpr int64_t EdgeBytes = 2 * tree_node_bytes( sizeof( Node * ) );
 
     Node(
         const auto & content,
         const auto & type,
         SourcePos source_pos
-    ): content(content), types{type}, source_pos(source_pos)
-    {}
+    ): content(content), types{type}, source_pos(source_pos), memory( memory_of( type ) )
+    {
+        count_stat( & Stats::nodes_created );
+        charged = sizeof( Node ) + heap_bytes( this->content ) + heap_bytes( this->source_pos.file ) + tree_node_bytes( sizeof( TYPE ) );
+        charge_memory( memory, charged );
+    }
     ~Node() {
+        count_stat( & Stats::nodes_deleted );
+        charge_memory( memory, - charged - EdgeBytes * int64_t( refs.size() ) );
         for ( auto & ref : refs )
             ref->refd.erase( this );
-        for ( auto & red : refd )
+        for ( auto & red : refd ) {
             red->refs.erase( this );
+            charge_memory( red->memory, - EdgeBytes );
+        }
     }
 
     /** Make this Node reference other specified Node.*/
     void ref( Node * target ) {
-        refs.insert( target );
+        if ( refs.insert( target ).second ) {
+            count_stat( & Stats::edges_added );
+            charge_memory( memory, EdgeBytes );
+        }
         target->refd.insert( this );
     }
     void unref( Node * target ) {
-        refs.erase( target );
+        if ( refs.erase( target ) > 0 )
+            charge_memory( memory, - EdgeBytes );
         target->refd.erase( this );
     }
+
+    /** Subsystem Node of specified TYPE belongs to.*/
+    static MEMORY memory_of( const TYPE & type ) {
+        switch ( type ) {
+            case TYPE::SOURCE_FILE:
+            case TYPE::LINE:
+            case TYPE::INCLUDE:
+                return MEMORY::LINES;
+            case TYPE::TERM:
+            case TYPE::NUMBER:
+            case TYPE::OPERATOR:
+                return MEMORY::TOKENS;
+            default:
+                return MEMORY::EXPRESSIONS;
+        }
+    }
     /** Returns first occurence of Node with specified TYPE which references this Node.*/
     Node * parent( const TYPE & type ) {
         for ( auto & parent : refd ) {
@@ -285,33 +337,19 @@ struct Node {
         return false;
     }
 };
-ostream & operator <<( ostream & os, const Node * node ) {
+inline ostream & operator <<( ostream & os, const Node * node ) {
     os << "{ ";
     bool printed_type = false;
     for ( const auto & type : node->types ) {
         if ( printed_type )
-            cout << "|";
+            os << "|";
         printed_type = true;
         os << type;
     }
     os << " \"" << node->content << "\" at " << node->source_pos << " }";
     return os;
 }
-/** Used to reason about nodes relative positioning in line.*/
-struct NodeHandler {
-    Node * node;
-    NodeHandler( Node * node ): node(node) {}
-    bool operator < ( const NodeHandler & n ) const {
-        return node->source_pos < n.node->source_pos;
-    }
-};
-/** Sort Nodes regarding their presence in source code.*/
-void syntactic_position_sort( auto & nodes ) {
-    nodes.sort(
-        []( Node * left, Node * right ) { return left->source_pos < right->source_pos; }
-    );
-}
-int32_t indentation( Node * line ) {
+inline int32_t indentation( Node * line ) {
     int32_t r = 0;
     for ( auto & ch : line->content ) {
         if ( isspace( ch ) )
@@ -322,10 +360,10 @@ int32_t indentation( Node * line ) {
     return r;
 }
 /** Returns true if first TYPE::LINE has more indentation than second.*/
-bool increased_indentation( Node * increased, Node * then ) {
+inline bool increased_indentation( Node * increased, Node * then ) {
     return indentation( increased ) > indentation( then );
 }
-bool equal_indentation( Node * one_line, Node * another_line ) {
+inline bool equal_indentation( Node * one_line, Node * another_line ) {
     return indentation( one_line ) == indentation( another_line );
 }
 
@@ -352,14 +390,20 @@ void pulse(
     set< Node * > to_visit;
     to_visit.insert( root );
 
+    count_stat( & Stats::pulses );
+    uint64_t visits = 0;
+
     while ( ! to_visit.empty() ) {
         auto v_it = to_visit.begin();
-        to_visit.erase( v_it );
         auto node = * v_it;
+        to_visit.erase( v_it );
+        ++ visits;
 
         if constexpr ( is_same_v< invoke_result_t< decltype( on_node ), Node* >, bool > ) {
-            if ( ! on_node( node ) )
+            if ( ! on_node( node ) ) {
+                count_stat( & Stats::nodes_visited, visits );
                 return;
+            }
         }
         else
             on_node( node );
@@ -390,9 +434,10 @@ void pulse(
             visit( node->refd );
         static_assert( Refs || Refd, "pulse(): should traverse at least some direction" );
     }
+    count_stat( & Stats::nodes_visited, visits );
 }
 /** Returns first occurence of Node with specified TYPE around center Node or nullptr.*/
-Node * closest( Node * center, const TYPE type ) {
+inline Node * closest( Node * center, const TYPE type ) {
     Node * result = nullptr;
     const auto & on_node = [&]( Node * node ) {
         if ( node->type( type ) ) {
@@ -405,6 +450,164 @@ Node * closest( Node * center, const TYPE type ) {
     return result;
 }
 
+/** Deletes every Node reachable from root (including root itself).*/
+inline void destroy_graph( Node * root ) {
+    vector< Node * > all;
+    const auto & on_node = [&]( Node * node ) {
+        all.push_back( node );
+    };
+    pulse( root, on_node );
+    for ( auto & node : all )
+        delete node;
+}
+/** Deletes every Node reachable from any of roots, which might share nodes (i.e. partially linked files).*/
+inline void destroy_graphs( const vector< Node * > & roots ) {
+    set< Node * > all;
+    for ( auto root : roots ) {
+        if ( root == nullptr || all.contains( root ) )
+            continue;
+        pulse( root, [&]( Node * node ) {
+            all.insert( node );
+        } );
+    }
+    for ( auto node : all )
+        delete node;
+}
+
+/** Copies every Node reachable from root along with all the edges among them. Returns copy of root.
+@param copies filled with copy of every Node by it's original if specified.*/
+inline Node * clone_graph( Node * root, map< Node *, Node * > * copies = nullptr ) {
+    map< Node *, Node * > local;
+    auto & copy_of = copies == nullptr ? local : * copies;
+    const auto & on_node = [&]( Node * node ) {
+        //copy is accounted within the same MEMORY:
+        auto type = * node->types.begin();
+        for ( const auto & t : node->types ) {
+            if ( Node::memory_of( t ) == node->memory ) {
+                type = t;
+                break;
+            }
+        }
+        auto copy = new Node( node->content, type, node->source_pos );
+        copy->types = node->types;
+        copy_of[ node ] = copy;
+    };
+    pulse( root, on_node );
+    for ( const auto & [ node, copy ] : copy_of ) {
+        for ( auto ref : node->refs )
+            copy->ref( copy_of.at( ref ) );
+    }
+    return copy_of.at( root );
+}
+
+/** Batch of nodes removals and edges redirections applied at once by commit(): nodes are only marked dead meanwhile (and stay valid along with all their edges, so passes might keep traversing the graph), then every Node adjacent to the dead ones is visited once to drop all the edges to them at once instead of every deleted Node erasing itself from every neighbour one by one. Pending changes are committed on destruction.*/
+struct GraphMutation {
+    GraphMutation() = default;
+    GraphMutation( const GraphMutation & ) = delete;
+    GraphMutation & operator =( const GraphMutation & ) = delete;
+    ~GraphMutation() {
+        commit();
+    }
+
+    /** Marks node to be deleted by commit().*/
+    void kill( Node * node ) {
+        if ( dead.insert( node ).second )
+            killed.push_back( node );
+    }
+    bool is_dead( Node * node ) const {
+        return dead.contains( node );
+    }
+    /** Makes every Node which references from (only those of specified TYPEs if any) reference to instead on commit(). Target should stay alive.*/
+    void redirect( Node * from, Node * to, const set< TYPE > & referrers = {} ) {
+        redirects.push_back( { from, to, referrers } );
+    }
+
+    /** Applies redirections, then deletes dead nodes. Returns number of deleted nodes.*/
+    size_t commit() {
+        for ( const auto & redirect : redirects ) {
+            vector< Node * > moved;
+            for ( auto referrer : redirect.from->refd ) {
+                if ( dead.contains( referrer ) || ( ! redirect.referrers.empty() && ! referrer->type( redirect.referrers ) ) )
+                    continue;
+                referrer->ref( redirect.to );
+                moved.push_back( referrer );
+            }
+            //edges to dead nodes are dropped below anyway:
+            if ( ! dead.contains( redirect.from ) ) {
+                for ( auto referrer : moved )
+                    referrer->unref( redirect.from );
+            }
+        }
+        redirects.clear();
+
+        //every living neighbour is rebuilt once, however many of it's edges lead to dead nodes:
+        unordered_set< Node * > touched;
+        for ( auto node : killed ) {
+            for ( auto ref : node->refs ) {
+                if ( ! dead.contains( ref ) )
+                    touched.insert( ref );
+            }
+            for ( auto red : node->refd ) {
+                if ( ! dead.contains( red ) )
+                    touched.insert( red );
+            }
+        }
+        const auto & is_dead = [&]( Node * node ) { return dead.contains( node ); };
+        for ( auto node : touched ) {
+            const auto dropped = erase_if( node->refs, is_dead );
+            charge_memory( node->memory, - Node::EdgeBytes * int64_t( dropped ) );
+            erase_if( node->refd, is_dead );
+        }
+        //edges are already detached from the living, so destructors have nothing to erase:
+        for ( auto node : killed ) {
+            charge_memory( node->memory, - Node::EdgeBytes * int64_t( node->refs.size() ) );
+            node->refs.clear();
+            node->refd.clear();
+            delete node;
+        }
+        const auto deleted = killed.size();
+        killed.clear();
+        dead.clear();
+        return deleted;
+    }
+
+private:
+    struct Redirect {
+        Node * from;
+        Node * to;
+        set< TYPE > referrers;
+    };
+    unordered_set< Node * > dead;
+    /** In the order of kill() calls.*/
+    vector< Node * > killed;
+    vector< Redirect > redirects;
+};
+
+/** Counts nodes and edges they reference per TYPE within the whole graph into current Stats. Node of multiple TYPEs is counted within every one of them.*/
+inline void count_types( Node * root ) {
+    auto stats = current_stats();
+    if ( stats == nullptr || root == nullptr )
+        return;
+    map< TYPE, Stats::TypeCount > counts;
+    const auto & on_node = [&]( Node * node ) {
+        for ( const auto & type : node->types ) {
+            auto & count = counts[ type ];
+            ++ count.nodes;
+            count.edges += node->refs.size();
+        }
+    };
+    pulse( root, on_node );
+
+    vector< Stats::TypeCount > result;
+    for ( auto & [ type, count ] : counts ) {
+        stringstream name;
+        name << type;
+        count.type = name.str();
+        result.push_back( count );
+    }
+    stats->set_type_counts( move( result ) );
+}
+
 Node * find_types( auto & in, const auto & types ) {
     for ( auto r : in ) {
         if ( r->type( types ) )
@@ -413,12 +616,14 @@ Node * find_types( auto & in, const auto & types ) {
     return nullptr;
 }
 
-void print_lines( Node * root ) {
-    cout << "Source split into lines:" << endl;
+inline void print_lines( Node * root ) {
+    if ( ! TRACING( LEXER, DEBUG ) )
+        return;
+    TRACE( LEXER, DEBUG ) << "Source split into lines:";
     const auto & print = []( Node * node ) {
         if ( ! node->type( TYPE::LINE ) )
             return true;
-        cout << "    " << node->source_pos.line << ": chars " << node->source_pos.char_start << "-" << node->source_pos.char_end << ": " << node->content << endl;
+        TRACE( LEXER, DEBUG ) << "    " << node->source_pos.line << ": chars " << node->source_pos.char_start << "-" << node->source_pos.char_end << ": " << node->content;
         return true;
     };
     pulse( root, print );
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/** Work-stealing pool: every worker owns a deque of tasks, takes tasks from it's back and steals from the fronts of other workers' deques when idle. Threads waiting for their tasks to complete keep executing pending tasks themselves, so tasks can be safely nested.*/
+struct ThreadPool {
+    using Task = function< void() >;
+
+    ThreadPool( const size_t threads_count = max( 1u, thread::hardware_concurrency() ) ) {
+        for ( size_t i = 0; i < threads_count; ++ i )
+            queues.push_back( make_unique< Queue >() );
+        for ( size_t i = 0; i < threads_count; ++ i )
+            threads.emplace_back( [ this, i ]{ work( i ); } );
+    }
+    ~ThreadPool() {
+        {
+            lock_guard< mutex > lock( sleep_mutex );
+            stopping = true;
+        }
+        wake.notify_all();
+        for ( auto & t : threads )
+            t.join();
+    }
+    ThreadPool( const ThreadPool & ) = delete;
+    ThreadPool & operator =( const ThreadPool & ) = delete;
+
+    size_t size() const {
+        return threads.size();
+    }
+
+    /** Enqueues task (which must not throw) into current worker's own deque if called from within the pool or spreads tasks round-robin otherwise.*/
+    void submit( Task task ) {
+        auto & queue = * queues[
+            current_worker_pool() == this
+            ?
+            current_worker_index()
+            :
+            next_queue.fetch_add( 1, memory_order_relaxed ) % queues.size()
+        ];
+        {
+            lock_guard< mutex > lock( queue.guard );
+            queue.tasks.push_back( move( task ) );
+        }
+        {
+            lock_guard< mutex > lock( sleep_mutex );
+            ++ queued;
+        }
+        wake.notify_one();
+    }
+
+    /** Executes single pending task (own or stolen) if there is any. Returns false if there was nothing to execute.*/
+    bool run_pending() {
+        Task task;
+        if ( ! take( current_worker_pool() == this ? current_worker_index() : 0, task ) )
+            return false;
+        task();
+        return true;
+    }
+
+    /** Calls func( i ) for every i in [0, count) concurrently and waits for all of them to complete (helping with pending tasks meanwhile). First thrown exception is rethrown.*/
+    template< typename Func >
+    void parallel_for( const size_t count, const Func & func ) {
+        if ( count == 0 )
+            return;
+        if ( count == 1 || size() < 2 ) {
+            for ( size_t i = 0; i < count; ++ i )
+                func( i );
+            return;
+        }
+
+        struct Group {
+            atomic< size_t > remaining;
+            mutex guard;
+            condition_variable done;
+            exception_ptr error;
+        };
+        auto group = make_shared< Group >();
+        group->remaining = count;
+
+        const auto & run = [ group, &func ]( const size_t i ) {
+            try {
+                func( i );
+            }
+            catch ( ... ) {
+                lock_guard< mutex > lock( group->guard );
+                if ( ! group->error )
+                    group->error = current_exception();
+            }
+            if ( group->remaining.fetch_sub( 1, memory_order_acq_rel ) == 1 ) {
+                lock_guard< mutex > lock( group->guard );
+                group->done.notify_all();
+            }
+        };
+
+        //last one is performed by calling thread right away:
+        for ( size_t i = 0; i + 1 < count; ++ i )
+            submit( [ run, i ]{ run( i ); } );
+        run( count - 1 );
+
+        while ( group->remaining.load( memory_order_acquire ) > 0 ) {
+            if ( run_pending() )
+                continue;
+            //nothing to help with, so just wait for (probably long) tasks being executed by others:
+            unique_lock< mutex > lock( group->guard );
+            group->done.wait_for( lock, chrono::milliseconds( 1 ), [&]{ return group->remaining.load() == 0; } );
+        }
+        if ( group->error )
+            rethrow_exception( group->error );
+    }
+
+private:
+    struct Queue {
+        mutex guard;
+        deque< Task > tasks;
+    };
+    vector< unique_ptr< Queue > > queues;
+    vector< thread > threads;
+    atomic< size_t > next_queue = 0;
+
+    mutex sleep_mutex;
+    condition_variable wake;
+    /** Tasks submitted but not yet taken by anyone.*/
+    size_t queued = 0;
+    bool stopping = false;
+
+    static ThreadPool *& current_worker_pool() {
+        thread_local ThreadPool * pool = nullptr;
+        return pool;
+    }
+    static size_t & current_worker_index() {
+        thread_local size_t index = 0;
+        return index;
+    }
+
+    /** Takes task from the back of own deque or steals one from the front of another deque.*/
+    bool take( const size_t own, Task & task ) {
+        for ( size_t i = 0; i < queues.size(); ++ i ) {
+            const auto index = ( own + i ) % queues.size();
+            auto & queue = * queues[ index ];
+            lock_guard< mutex > lock( queue.guard );
+            if ( queue.tasks.empty() )
+                continue;
+            if ( i == 0 ) {
+                task = move( queue.tasks.back() );
+                queue.tasks.pop_back();
+            }
+            else {
+                task = move( queue.tasks.front() );
+                queue.tasks.pop_front();
+            }
+            lock_guard< mutex > sleep_lock( sleep_mutex );
+            -- queued;
+            return true;
+        }
+        return false;
+    }
+
+    void work( const size_t index ) {
+        current_worker_pool() = this;
+        current_worker_index() = index;
+        while ( true ) {
+            Task task;
+            if ( take( index, task ) ) {
+                task();
+                continue;
+            }
+            unique_lock< mutex > lock( sleep_mutex );
+            wake.wait( lock, [&]{ return queued > 0 || stopping; } );
+            if ( stopping && queued == 0 )
+                return;
+        }
+    }
+};
+
+/** Process-wide pool shared by all compilation stages.*/
+inline ThreadPool & default_pool() {
+    static ThreadPool pool;
+    return pool;
+}
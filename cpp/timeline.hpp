@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+using namespace std;
+
+/** Begin or end of named span of work on some thread.*/
+struct TimelineEvent {
+    string name;
+    /** 'B'egin or 'E'nd as named in trace event format.*/
+    char phase;
+    /** Nanoseconds since the recording started.*/
+    int64_t ts;
+};
+
+/** Events recorded by single thread. Only the owning thread appends to it, so no locking is needed while recording.*/
+struct TimelineBuffer {
+    uint32_t tid = 0;
+    vector< TimelineEvent > events;
+};
+
+/** Records begin/end events of compilation phases and branches from all the threads to be viewed in chrome://tracing or Perfetto UI.*/
+struct Timeline {
+    atomic< bool > enabled = false;
+    chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+    void record( const string & name, const char phase ) {
+        const auto ts = chrono::duration_cast< chrono::nanoseconds >( chrono::steady_clock::now() - epoch ).count();
+        local().events.push_back( { name, phase, ts } );
+    }
+
+    /** Should be called only while nothing is being recorded.*/
+    void clear() {
+        lock_guard< mutex > lock( guard );
+        for ( auto & buffer : buffers )
+            buffer->events.clear();
+        epoch = chrono::steady_clock::now();
+    }
+
+    /** Writes all the recorded events in Chrome trace event JSON format. Should be called only while nothing is being recorded.*/
+    void write_json( ostream & o ) {
+        lock_guard< mutex > lock( guard );
+        o << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for ( const auto & buffer : buffers ) {
+            if ( ! first )
+                o << ",";
+            first = false;
+            o << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid << ",\"args\":{\"name\":\"thread " << buffer->tid << "\"}}";
+            for ( const auto & event : buffer->events ) {
+                o << ",{\"name\":";
+                write_json_string( o, event.name );
+                o << ",\"ph\":\"" << event.phase << "\",\"pid\":1,\"tid\":" << buffer->tid << ",\"ts\":" << event.ts / 1000 << "." << setw( 3 ) << setfill( '0' ) << event.ts % 1000 << setfill( ' ' ) << "}";
+            }
+        }
+        o << "]}";
+    }
+
+private:
+    mutex guard;
+    vector< shared_ptr< TimelineBuffer > > buffers;
+
+    /** Current thread's buffer: registered once, so further recording is lock-free.*/
+    TimelineBuffer & local() {
+        thread_local shared_ptr< TimelineBuffer > buffer;
+        if ( ! buffer ) {
+            buffer = make_shared< TimelineBuffer >();
+            lock_guard< mutex > lock( guard );
+            buffer->tid = buffers.size() + 1;
+            buffers.push_back( buffer );
+        }
+        return * buffer;
+    }
+};
+inline Timeline & timeline() {
+    static Timeline t;
+    return t;
+}
+
+/** Records span from construction till the end of scope if timeline is enabled.*/
+struct TimelineSpan {
+    bool recording;
+    string name;
+
+    TimelineSpan( const string & name ): recording( timeline().enabled.load( memory_order_relaxed ) ) {
+        if ( ! recording )
+            return;
+        this->name = name;
+        timeline().record( name, 'B' );
+    }
+    ~TimelineSpan() {
+        if ( recording )
+            timeline().record( name, 'E' );
+    }
+};
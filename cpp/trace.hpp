@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#ifndef RECUMPOSE_TRACE_LEVEL
+/** Most detailed TRACE_LEVEL compiled in at all: traces of more detailed levels are cut out by compiler.*/
+#define RECUMPOSE_TRACE_LEVEL 3
+#endif
+
+/** How detailed trace event is. Every level includes all the less detailed ones.*/
+enum class TRACE_LEVEL {
+    ERROR,
+    /** Once per compilation phase.*/
+    INFO,
+    /** Once per expression, evaluation step, etc..*/
+    DEBUG,
+    /** Once per token, evaluation attempt, etc..*/
+    VERBOSE,
+};
+/** Subsystem producing trace events, each one has it's own runtime level.*/
+enum class TRACE_CATEGORY {
+    LEXER,
+    PARSER,
+    SEMANTIC,
+    EVALUATION,
+    DRIVER,
+};
+const size_t TraceCategories = size_t( TRACE_CATEGORY::DRIVER ) + 1;
+
+const vector< string > TraceLevelNames = { "error", "info", "debug", "verbose" };
+const vector< string > TraceCategoryNames = { "lexer", "parser", "semantic", "evaluation", "driver" };
+
+/** Runtime levels of every TRACE_CATEGORY; only errors are traced by default.*/
+inline atomic< int > * trace_levels() {
+    static atomic< int > levels[ TraceCategories ] = {};
+    return levels;
+}
+inline void set_trace_level( const TRACE_CATEGORY category, const TRACE_LEVEL level ) {
+    trace_levels()[ size_t( category ) ].store( int( level ), memory_order_relaxed );
+}
+inline void set_trace_level( const TRACE_LEVEL level ) {
+    for ( size_t c = 0; c < TraceCategories; ++ c )
+        set_trace_level( TRACE_CATEGORY( c ), level );
+}
+inline bool trace_enabled( const TRACE_CATEGORY category, const TRACE_LEVEL level ) {
+    return int( level ) <= trace_levels()[ size_t( category ) ].load( memory_order_relaxed );
+}
+
+/** Parses "category=level" (or just "level" for all categories) specification. Returns false if it's malformed.*/
+inline bool set_trace_level( const string & spec ) {
+    const auto & index_of = []( const vector< string > & names, const string & name ) {
+        const auto it = find( names.begin(), names.end(), name );
+        return it == names.end() ? -1 : int( it - names.begin() );
+    };
+    const auto eq = spec.find( '=' );
+    const auto level = index_of( TraceLevelNames, eq == string::npos ? spec : spec.substr( eq + 1 ) );
+    if ( level < 0 )
+        return false;
+    if ( eq == string::npos ) {
+        set_trace_level( TRACE_LEVEL( level ) );
+        return true;
+    }
+    const auto category = index_of( TraceCategoryNames, spec.substr( 0, eq ) );
+    if ( category < 0 )
+        return false;
+    set_trace_level( TRACE_CATEGORY( category ), TRACE_LEVEL( level ) );
+    return true;
+}
+
+/** Collects trace events from all the threads and writes them out in big chunks, so tracing doesn't flush console on every line.*/
+struct TraceSink {
+    /** Should outlive the sink or be replaced before it's destroyed.*/
+    ostream * target = & cout;
+    size_t capacity = 1 << 16;
+
+    void write( const string & event, const bool urgent ) {
+        lock_guard< mutex > lock( guard );
+        buffer += event;
+        if ( urgent || buffer.size() >= capacity )
+            flush_locked();
+    }
+    void flush() {
+        lock_guard< mutex > lock( guard );
+        flush_locked();
+    }
+    void redirect( ostream & o ) {
+        lock_guard< mutex > lock( guard );
+        flush_locked();
+        target = & o;
+    }
+    ~TraceSink() {
+        flush();
+    }
+
+private:
+    mutex guard;
+    string buffer;
+
+    void flush_locked() {
+        if ( buffer.empty() )
+            return;
+        target->write( buffer.data(), buffer.size() );
+        target->flush();
+        buffer.clear();
+    }
+};
+inline TraceSink & trace_sink() {
+    static TraceSink sink;
+    return sink;
+}
+inline void flush_traces() {
+    trace_sink().flush();
+}
+
+/** Single line of trace: formatted locally and passed to the sink as a whole once complete. Errors are written out right away.*/
+struct TraceEvent {
+    TraceEvent( const TRACE_LEVEL level ): level(level) {}
+    ~TraceEvent() {
+        s << '\n';
+        trace_sink().write( s.str(), level == TRACE_LEVEL::ERROR );
+    }
+    ostream & stream() {
+        return s;
+    }
+
+private:
+    TRACE_LEVEL level;
+    ostringstream s;
+};
+
+/** True if trace events of specified category and level should be formed: constant false (thus cut out) if level isn't compiled in.*/
+#define TRACING( category, level ) \
+    ( int( TRACE_LEVEL::level ) <= RECUMPOSE_TRACE_LEVEL && trace_enabled( TRACE_CATEGORY::category, TRACE_LEVEL::level ) )
+
+/** Streams single line of trace event like TRACE( LEXER, VERBOSE ) << "token " << token; nothing after TRACE() is evaluated if it's disabled.*/
+#define TRACE( category, level ) \
+    if ( ! TRACING( category, level ) ) {} \
+    else TraceEvent( TRACE_LEVEL::level ).stream()
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "document.hpp"
+
+#include <chrono>
+#include <memory>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+/** Reports changes of files with inotify. Directories of files are watched rather than files themselves, since editors often replace files (write temporary file and rename it over) instead of writing them in place.*/
+struct FileWatcher {
+    FileWatcher() {
+        fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+        if ( fd < 0 )
+            throw runtime_error( "ERROR: cannot initialize inotify" );
+    }
+    FileWatcher( const FileWatcher & ) = delete;
+    FileWatcher & operator =( const FileWatcher & ) = delete;
+    ~FileWatcher() {
+        close( fd );
+    }
+
+    /** Starts watching file (by it's canonical path) if it's not watched yet. File doesn't have to exist, but it's directory does.*/
+    void watch( const string & path ) {
+        const auto file = filesystem::weakly_canonical( path );
+        if ( ! files.insert( file.string() ).second )
+            return;
+        const auto directory = file.parent_path().string();
+        const int wd = inotify_add_watch( fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM );
+        if ( wd < 0 ) {
+            files.erase( file.string() );
+            throw runtime_error( "ERROR: cannot watch " + directory );
+        }
+        directories[ wd ] = directory;
+    }
+
+    /** Waits up to timeout for changes of watched files, then keeps collecting changes until none come within quiet period, so bursts of writes (i.e. saving all the files at once or writing single file in chunks) are reported once. Returns canonical paths of changed files: empty on timeout.*/
+    set< string > wait( const chrono::milliseconds timeout, const chrono::milliseconds quiet ) {
+        set< string > changed;
+        if ( ! poll_events( timeout ) )
+            return changed;
+        read_events( changed );
+        while ( poll_events( quiet ) )
+            read_events( changed );
+        return changed;
+    }
+
+private:
+    int fd = -1;
+    /** Canonical paths of watched files.*/
+    set< string > files;
+    map< int, string > directories;
+
+    bool poll_events( const chrono::milliseconds timeout ) {
+        pollfd p{ fd, POLLIN, 0 };
+        const int ready = poll( & p, 1, int( timeout.count() ) );
+        if ( ready < 0 && errno != EINTR )
+            throw runtime_error( "ERROR: cannot poll inotify" );
+        return ready > 0;
+    }
+
+    void read_events( set< string > & changed ) {
+        alignas( inotify_event ) char buffer[ 1 << 14 ];
+        while ( true ) {
+            const auto length = read( fd, buffer, sizeof( buffer ) );
+            if ( length <= 0 )
+                return;
+            for ( ssize_t offset = 0; offset < length; ) {
+                const auto event = reinterpret_cast< const inotify_event * >( buffer + offset );
+                offset += sizeof( inotify_event ) + event->len;
+                const auto directory = directories.find( event->wd );
+                if ( directory == directories.end() || event->len == 0 )
+                    continue;
+                const auto path = ( filesystem::path( directory->second ) / event->name ).string();
+                if ( files.contains( path ) )
+                    changed.insert( path );
+            }
+        }
+    }
+};
+
+/** Program along with all the files it includes kept parsed (see Document) between compilations: changed files are edited by the lines which differ, so only the statements touched are parsed again, while the rest of the graph is reused.*/
+struct WatchedProgram {
+    WatchedProgram( const string & source, ThreadPool & pool = default_pool() ): source( source ), pool( pool ) {
+        load();
+    }
+
+    const string & name() const {
+        return source;
+    }
+    /** Canonical paths of the source and all the files it includes (or tries to).*/
+    set< string > files() const {
+        set< string > result;
+        for ( const auto & file : documents )
+            result.insert( file.first );
+        return result;
+    }
+
+    /** Applies changes of files (by canonical paths). Returns false if none of program's files changed.*/
+    bool update( const set< string > & changed ) {
+        bool touched = false;
+        for ( auto & [ path, file ] : documents ) {
+            if ( ! changed.contains( path ) )
+                continue;
+            touched = true;
+            vector< string > lines;
+            file.error.clear();
+            if ( ! read_lines( file.name, lines ) ) {
+                file.error = "ERROR: cannot read " + file.name;
+                lines.clear();
+            }
+            edit( * file.document, lines );
+        }
+        if ( touched )
+            load();
+        return touched;
+    }
+
+    /** Links copies of graphs of all the files into single graph (the same parse_program() builds), so it might be compiled further while files are kept parsed. Throws runtime_error if any of files is malformed.
+    @return SOURCE_FILE of the source.*/
+    Node * link() const {
+        for ( const auto & file : documents ) {
+            if ( ! file.second.error.empty() )
+                throw runtime_error( file.second.error );
+            const auto errors = file.second.document->errors();
+            if ( ! errors.empty() )
+                throw runtime_error( errors.front().message );
+        }
+        map< string, Node * > roots;
+        try {
+            for ( const auto & file : documents )
+                roots[ file.first ] = file.second.document->clone();
+            for ( const auto & [ path, root ] : roots ) {
+                for ( auto include : includes_of( root ) )
+                    include->ref( roots.at( include_key( root->content, include ) ) );
+            }
+        }
+        catch ( ... ) {
+            for ( const auto & root : roots )
+                destroy_graph( root.second );
+            throw;
+        }
+        return roots.at( key_of( source ) );
+    }
+
+private:
+    /** Single file of the program.*/
+    struct File {
+        /** As it's included, so nodes are positioned the same way parse_program() positions them.*/
+        string name;
+        unique_ptr< Document > document;
+        /** Why the file cannot be read if so.*/
+        string error;
+    };
+
+    const string source;
+    ThreadPool & pool;
+    /** By canonical paths.*/
+    map< string, File > documents;
+
+    static string key_of( const string & path ) {
+        return filesystem::weakly_canonical( path ).string();
+    }
+    static string include_key( const string & includer, Node * include ) {
+        return key_of( resolve_include( includer, include->content ) );
+    }
+
+    static bool read_lines( const string & file_name, vector< string > & lines ) {
+        ifstream file( file_name );
+        if ( ! file )
+            return false;
+        string line;
+        while ( getline( file, line ) )
+            lines.push_back( line );
+        return true;
+    }
+
+    /** Replaces the lines in between of common beginning and ending of document and lines.*/
+    static void edit( Document & document, const vector< string > & lines ) {
+        const auto old_size = document.lines();
+        size_t prefix = 0;
+        while ( prefix < old_size && prefix < lines.size() && document.line( prefix ) == lines[ prefix ] )
+            ++ prefix;
+        size_t suffix = 0;
+        while ( suffix < old_size - prefix && suffix < lines.size() - prefix && document.line( old_size - suffix - 1 ) == lines[ lines.size() - suffix - 1 ] )
+            ++ suffix;
+        if ( prefix == old_size && prefix == lines.size() )
+            return;
+        //malformed statements are reported by link():
+        try {
+            document.edit( {
+                int32_t( prefix + 1 ),
+                int32_t( old_size - prefix - suffix ),
+                vector< string >( lines.begin() + prefix, lines.end() - suffix )
+            } );
+        }
+        catch ( const runtime_error & ) {
+        }
+    }
+
+    /** Loads files which are included but aren't loaded yet and drops those which aren't included anymore.*/
+    void load() {
+        set< string > reached;
+        vector< pair< string, string > > pending = { { key_of( source ), source } };
+        while ( ! pending.empty() ) {
+            const auto [ key, name ] = pending.back();
+            pending.pop_back();
+            if ( ! reached.insert( key ).second )
+                continue;
+            auto & file = documents[ key ];
+            if ( ! file.document ) {
+                file.name = name;
+                file.document = make_unique< Document >( name, "", pool );
+                vector< string > lines;
+                if ( ! read_lines( name, lines ) )
+                    file.error = "ERROR: cannot read " + name;
+                edit( * file.document, lines );
+            }
+            for ( auto include : includes_of( file.document->root() ) ) {
+                const auto path = resolve_include( file.name, include->content );
+                pending.push_back( { key_of( path ), path } );
+            }
+        }
+        erase_if( documents, [&]( const auto & file ) { return ! reached.contains( file.first ); } );
+    }
+};
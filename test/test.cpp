@@ -1,17 +1,51 @@
 
 #define CATCH_CONFIG_MAIN
 
-#include "../lib/Catch2/single_include/catch2/catch.hpp"
+#include <catch2/catch.hpp>
 #include "../cpp/syntactic.hpp"
+#include "../cpp/semantic.hpp"
+#include "../cpp/graph_cache.hpp"
+#include "../cpp/document.hpp"
+#include "../cpp/language_server.hpp"
+#include "../cpp/watch.hpp"
+#include "../cpp/recumpose.hpp"
+#include <thread>
+#include <filesystem>
 
 using namespace Catch;
 
+/** Every node along with what it refs, but addresses.*/
+multiset< string > describe_graph( Node * root ) {
+    multiset< string > nodes;
+    pulse( root, [&]( Node * node ) {
+        ostringstream s;
+        s << node;
+        multiset< string > refs;
+        for ( auto ref : node->refs ) {
+            ostringstream r;
+            r << ref;
+            refs.insert( r.str() );
+        }
+        for ( const auto & ref : refs )
+            s << " -> " << ref;
+        nodes.insert( s.str() );
+    } );
+    return nodes;
+}
+
+/** Name followed by number: appended rather than prepended to the number, since GCC 12 takes prepending for overlapping copy (false -Wrestrict) once it's inlined.*/
+string numbered( const string & name, const size_t number ) {
+    auto result = name;
+    result += to_string( number );
+    return result;
+}
+
 TEST_CASE( "Should match lines", "[match]" ) {
     auto root = parse_source( "../samples/simple.rcl" );
     REQUIRE( root != nullptr );
     int32_t lines_count = 0;
     const auto & on_node = [&]( auto node ) {
-        if ( node->type == TYPE::LINE )
+        if ( node->type( TYPE::LINE ) )
             ++ lines_count;
         return true;
     };
@@ -24,7 +58,7 @@ TEST_CASE( "Should match multiple operators within single line", "[match]" ) {
     REQUIRE( root != nullptr );
     Node * line = nullptr;
     const auto & on_line = [&]( Node * node ) {
-        if ( node->type == TYPE::LINE && node->source_pos.line == 2 ) {
+        if ( node->type( TYPE::LINE ) && node->source_pos.line == 2 ) {
             line = node;
             return false;
         }
@@ -34,7 +68,7 @@ TEST_CASE( "Should match multiple operators within single line", "[match]" ) {
     REQUIRE( line != nullptr );
     set< int32_t > cols;
     for ( const auto & ref : line->refs ) {
-        if ( ref->type == TYPE::OPERATOR )
+        if ( ref->type( TYPE::OPERATOR ) )
             cols.insert( ref->source_pos.char_start );
     }
     REQUIRE( cols.size() == 3 );
@@ -45,7 +79,7 @@ TEST_CASE( "Should parse terms last line symbols as well", "[match]" ) {
     REQUIRE( root != nullptr );
     set< string > terms;
     const auto & on_term = [&]( Node * node ) {
-        if ( node->type == TYPE::TERM )
+        if ( node->type( TYPE::TERM ) )
             terms.insert( node->content );
         return true;
     };
@@ -72,3 +106,1346 @@ TEST_CASE( "Short multi line comment after single line one", "[comment]" ) {
     
 }
 
+
+TEST_CASE( "Compiled program evaluates declared outputs", "[program]" ) {
+    const auto program = compile_source( "inputs a\nb = a * 2\noutputs b\n" );
+    REQUIRE( program->inputs == vector< string >{ "a" } );
+    REQUIRE( program->outputs == vector< string >{ "b" } );
+
+    auto result = program->evaluate( { { "a", 3 } } );
+    REQUIRE( result.at( "b" ) == 6 );
+    //same compiled program is reused with other inputs:
+    result = program->evaluate( { { "a", 5 } } );
+    REQUIRE( result.at( "b" ) == 10 );
+}
+
+TEST_CASE( "Compiled program evaluates concurrently", "[program]" ) {
+    const auto program = compile_source( "inputs a\nb = a * 2\noutputs b\n" );
+    vector< thread > threads;
+    vector< double > results( 8 );
+    for ( size_t i = 0; i < results.size(); ++ i ) {
+        threads.emplace_back( [&, i]{
+            results[ i ] = program->evaluate( { { "a", double( i ) } } ).at( "b" );
+        } );
+    }
+    for ( auto & t : threads )
+        t.join();
+    for ( size_t i = 0; i < results.size(); ++ i )
+        REQUIRE( results[ i ] == i * 2 );
+}
+
+TEST_CASE( "Unknown input is rejected", "[program]" ) {
+    const auto program = compile_file( "../samples/simple.rcl" );
+    REQUIRE_THROWS_AS( program->evaluate( { { "nonexistent", 1 } } ), runtime_error );
+    REQUIRE_THROWS_AS( compile_file( "../samples/nonexistent.rcl" ), runtime_error );
+}
+
+TEST_CASE( "Concurrently lexed chunks are chained in syntactic order", "[match]" ) {
+    stringstream source;
+    const int32_t Lines = 3000;
+    for ( int32_t i = 0; i < Lines; ++ i )
+        source << "x" << i << " = " << i << " + y" << endl;
+    auto root = parse_source( source, "generated" );
+    REQUIRE( root != nullptr );
+
+    //file references the very first token which chains all the others:
+    Node * caret = find_types( root->refs, set{ TYPE::TERM, TYPE::OPERATOR } );
+    REQUIRE( caret != nullptr );
+    int32_t tokens = 1;
+    while ( auto next = find_types( caret->refs, set{ TYPE::TERM, TYPE::OPERATOR } ) ) {
+        REQUIRE( caret->source_pos < next->source_pos );
+        caret = next;
+        ++ tokens;
+    }
+    REQUIRE( tokens == Lines * 5 );
+    destroy_graph( root );
+}
+
+TEST_CASE( "Included files are parsed once and linked into single graph", "[include]" ) {
+    const auto dir = filesystem::temp_directory_path() / "recumpose_include_test";
+    filesystem::create_directories( dir / "lib" );
+    const auto & write = [&]( const string & name, const string & content ) {
+        ofstream( dir / name ) << content;
+    };
+    //diamond: both "left" and "right" include "lib/shared":
+    write( "main.rcl", "include left right.rcl\nr = k * 2\noutputs r\n" );
+    write( "left.rcl", "include lib/shared\n" );
+    write( "right.rcl", "include ./lib/../lib/shared.rcl\n" );
+    write( "lib/shared.rcl", "k = 7\n" );
+
+    auto root = parse_program( ( dir / "main.rcl" ).string() );
+    set< Node * > files;
+    int32_t includes = 0;
+    const auto & on_node = [&]( Node * node ) {
+        if ( node->type( TYPE::SOURCE_FILE ) )
+            files.insert( node );
+        if ( node->type( TYPE::INCLUDE ) ) {
+            ++ includes;
+            REQUIRE( node->child( TYPE::SOURCE_FILE ) != nullptr );
+        }
+    };
+    pulse( root, on_node );
+    REQUIRE( files.size() == 4 );
+    REQUIRE( includes == 4 );
+    destroy_graph( root );
+
+    const auto program = compile_file( ( dir / "main.rcl" ).string() );
+    REQUIRE( program->evaluate().at( "r" ) == 14 );
+
+    write( "broken.rcl", "include nonexistent\n" );
+    REQUIRE_THROWS_AS( compile_file( ( dir / "broken.rcl" ).string() ), runtime_error );
+    filesystem::remove_all( dir );
+}
+
+TEST_CASE( "Unchanged sources are loaded from precompiled graphs", "[graph_cache]" ) {
+    const auto dir = filesystem::temp_directory_path() / "recumpose_graph_cache_test";
+    filesystem::remove_all( dir );
+    filesystem::create_directories( dir );
+    const auto & write = [&]( const string & name, const string & content ) {
+        ofstream( dir / name ) << content;
+    };
+    write( "main.rcl", "include lib\nr = k * 2\noutputs r\n" );
+    write( "lib.rcl", "k = 7\n" );
+    const auto main = ( dir / "main.rcl" ).string();
+    const auto cache = ( dir / "cache" ).string();
+
+    const auto & evaluate = []( Node * root ) {
+        merge_occurences( root );
+        Layer layer;
+        evaluate_layer( root, layer );
+        double r = 0;
+        pulse( root, [&]( Node * node ) {
+            if ( node->type( TYPE::TERM ) && node->content == "r" )
+                r = layer.value_or( node );
+        } );
+        destroy_graph( root );
+        return r;
+    };
+
+    Stats stats;
+    StatsScope scope( & stats );
+    auto parsed = cached_parse_program( main, cache );
+    auto loaded = cached_parse_program( main, cache );
+    REQUIRE( stats.graph_cache_misses == 1 );
+    REQUIRE( stats.graph_cache_hits == 1 );
+    REQUIRE( describe_graph( loaded ) == describe_graph( parsed ) );
+    REQUIRE( evaluate( parsed ) == 14 );
+    REQUIRE( evaluate( loaded ) == 14 );
+
+    //the graph with occurences merged is cached separately:
+    REQUIRE( evaluate( cached_parse_program( main, cache, default_pool(), true ) ) == 14 );
+    REQUIRE( evaluate( cached_parse_program( main, cache, default_pool(), true ) ) == 14 );
+    REQUIRE( stats.graph_cache_hits == 2 );
+
+    //changed include invalidates the graph:
+    write( "lib.rcl", "k = 8\n" );
+    REQUIRE( evaluate( cached_parse_program( main, cache ) ) == 16 );
+    REQUIRE( stats.graph_cache_misses == 3 );
+
+    //broken file is just parsed again:
+    for ( const auto & entry : filesystem::directory_iterator( cache ) )
+        ofstream( entry.path(), ios::binary | ios::trunc ) << "broken";
+    REQUIRE( evaluate( cached_parse_program( main, cache ) ) == 16 );
+    REQUIRE( evaluate( cached_parse_program( main, cache ) ) == 16 );
+    REQUIRE( stats.graph_cache_misses == 4 );
+    REQUIRE( stats.graph_cache_hits == 3 );
+
+    //concurrent writers of the same entry never publish a mix of each other's files:
+    const auto shared = ( dir / "shared.graph" ).string();
+    map< string, uint64_t > hashes;
+    ifstream main_file( main );
+    auto root = parse_program( main_file, main, default_pool(), & hashes );
+    REQUIRE( hashes.size() == 1 );
+    {
+        vector< thread > writers;
+        for ( size_t w = 0; w < 8; ++ w ) {
+            writers.emplace_back( [&]{
+                StatsScope unaccounted( nullptr );
+                for ( size_t i = 0; i < 20; ++ i )
+                    save_graph( shared, root, hashes );
+            } );
+        }
+        for ( auto & writer : writers )
+            writer.join();
+    }
+    auto published = GraphView( shared ).load();
+    REQUIRE( describe_graph( published ) == describe_graph( root ) );
+    destroy_graph( published );
+    size_t files = 0;
+    for ( [[maybe_unused]] const auto & entry : filesystem::directory_iterator( dir ) )
+        ++ files;
+    //no temporary files are left behind:
+    REQUIRE( files == 4 );
+
+    //include changed after it was parsed is stored as it was parsed, so the graph is stale:
+    REQUIRE( GraphView( shared ).up_to_date() );
+    write( "lib.rcl", "k = 9\n" );
+    save_graph( shared, root, hashes );
+    REQUIRE( ! GraphView( shared ).up_to_date() );
+    destroy_graph( root );
+    filesystem::remove_all( dir );
+}
+
+TEST_CASE( "Traces are written only for enabled categories and levels", "[trace]" ) {
+    ostringstream traces;
+    trace_sink().redirect( traces );
+
+    set_trace_level( TRACE_CATEGORY::LEXER, TRACE_LEVEL::VERBOSE );
+    destroy_graph( parse_source( "../samples/simple.rcl" ) );
+    flush_traces();
+    REQUIRE( traces.str().find( "Operator found: = at" ) != string::npos );
+    REQUIRE( traces.str().find( "Top level semantic nodes" ) == string::npos );
+
+    traces.str( "" );
+    set_trace_level( TRACE_LEVEL::ERROR );
+    destroy_graph( parse_source( "../samples/simple.rcl" ) );
+    flush_traces();
+    REQUIRE( traces.str().empty() );
+
+    trace_sink().redirect( std::cout );
+}
+
+TEST_CASE( "Compilation and evaluation are counted into Stats", "[stats]" ) {
+    const auto program = compile_source( "x = 2\ny = x * 3\n" );
+    REQUIRE( program->stats->nodes_created > 0 );
+    REQUIRE( program->stats->edges_added > 0 );
+    REQUIRE( program->stats->nodes_visited >= program->stats->pulses );
+    set< string > phases;
+    for ( const auto & phase : program->stats->phase_times() )
+        phases.insert( phase.name );
+    REQUIRE( phases.contains( "lex" ) );
+    REQUIRE( phases.contains( "merge_occurences" ) );
+
+    Stats evaluation;
+    REQUIRE( program->evaluate( {}, & evaluation ).at( "y" ) == 6 );
+    REQUIRE( evaluation.evaluation_successes > 0 );
+    REQUIRE( evaluation.evaluation_attempts >= evaluation.evaluation_successes );
+
+    ostringstream json;
+    evaluation.write_json( json );
+    REQUIRE( json.str().starts_with( "{\"phases\":[{\"name\":\"try_evaluate_all\"" ) );
+}
+
+TEST_CASE( "Compilation phases are recorded into timeline", "[timeline]" ) {
+    timeline().clear();
+    timeline().enabled = true;
+    compile_source( "x = 2\ny = x * 3\n" )->evaluate();
+    timeline().enabled = false;
+
+    ostringstream json;
+    timeline().write_json( json );
+    const auto & count_of = [&]( const string & what ) {
+        size_t n = 0;
+        for ( auto at = json.str().find( what ); at != string::npos; at = json.str().find( what, at + 1 ) )
+            ++ n;
+        return n;
+    };
+    REQUIRE( json.str().starts_with( "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" ) );
+    REQUIRE( count_of( "{\"name\":\"lex\",\"ph\":\"B\"" ) == 1 );
+    REQUIRE( count_of( "{\"name\":\"try_evaluate_all\",\"ph\":\"B\"" ) == 1 );
+    REQUIRE( count_of( "\"ph\":\"B\"" ) == count_of( "\"ph\":\"E\"" ) );
+    timeline().clear();
+}
+
+TEST_CASE( "Consecutive comment lines are removed without breaking lines chain", "[comments]" ) {
+    const size_t Blocks = 200;
+    string source;
+    for ( size_t i = 0; i < Blocks; ++ i )
+        source += "// comment\n/** multiline\n    comment\n*/\nc" + to_string( i ) + " = " + to_string( i ) + "\n";
+    //lines removal used to depend on nodes' addresses, so it's repeated with different allocations:
+    for ( size_t attempt = 0; attempt < 3; ++ attempt ) {
+        istringstream stream( source );
+        auto root = parse_lines( stream, "comments.rcl" );
+        parse_comments( root );
+        REQUIRE( file_lines( root ).size() == Blocks );
+        destroy_graph( root );
+    }
+}
+
+TEST_CASE( "Nodes are removed and edges redirected in batches", "[mutation]" ) {
+    Stats stats;
+    {
+        StatsScope scope( & stats );
+        auto root = new Node( "root", TYPE::SOURCE_FILE, SourcePos( 0, 0, 0 ) );
+        auto kept = new Node( "x", TYPE::TERM, SourcePos( 1, 0, 0 ) );
+        root->ref( kept );
+        vector< Node * > duplicates;
+        vector< Node * > expressions;
+        for ( int32_t i = 0; i < 100; ++ i ) {
+            auto duplicate = new Node( "x", TYPE::TERM, SourcePos( i + 2, 0, 0 ) );
+            auto expression = new Node( "expression", TYPE::EXPRESSION, SourcePos( i + 2, 0, 0 ) );
+            root->ref( duplicate );
+            root->ref( expression );
+            expression->ref( duplicate );
+            //dead nodes reference each other as well:
+            if ( ! duplicates.empty() )
+                duplicate->ref( duplicates.back() );
+            duplicates.push_back( duplicate );
+            expressions.push_back( expression );
+        }
+
+        GraphMutation mutation;
+        for ( auto duplicate : duplicates ) {
+            mutation.redirect( duplicate, kept, { TYPE::EXPRESSION } );
+            mutation.kill( duplicate );
+        }
+        REQUIRE( mutation.is_dead( duplicates.front() ) );
+        //nothing changes until commit:
+        REQUIRE( root->refs.size() == 201 );
+        REQUIRE( mutation.commit() == duplicates.size() );
+
+        REQUIRE( root->refs.size() == 101 );
+        REQUIRE( kept->refd.size() == 101 );
+        for ( auto expression : expressions )
+            REQUIRE( expression->refs == set{ kept } );
+
+        //living nodes are redirected without being removed:
+        auto other = new Node( "y", TYPE::TERM, SourcePos( 200, 0, 0 ) );
+        root->ref( other );
+        mutation.redirect( kept, other, { TYPE::EXPRESSION } );
+        REQUIRE( mutation.commit() == 0 );
+        REQUIRE( kept->refd == set{ root } );
+        REQUIRE( other->refd.size() == 101 );
+
+        destroy_graph( root );
+    }
+    for ( size_t m = 0; m < MemorySubsystems; ++ m )
+        REQUIRE( stats.live_bytes[ m ] == 0 );
+    REQUIRE( stats.nodes_deleted == stats.nodes_created );
+}
+
+TEST_CASE( "Graphs of sources which fail to parse are released", "[memory]" ) {
+    const auto dir = filesystem::temp_directory_path() / "recumpose_failed_parse_test";
+    filesystem::remove_all( dir );
+    filesystem::create_directories( dir );
+    const auto & write = [&]( const string & name, const string & content ) {
+        ofstream( dir / name ) << content;
+    };
+    string valid;
+    for ( size_t i = 0; i < 200; ++ i )
+        valid += numbered( "v", i ) + " = " + to_string( i ) + " * 2\n";
+    write( "lib.rcl", valid );
+    write( "broken_lib.rcl", valid + "b = 1 +\n" );
+
+    for ( const auto & source : {
+        //malformed statements of the source itself:
+        valid + "x = 1 +\n",
+        valid + "y = if 1 else 2\n",
+        valid + "inputs\n",
+        //included files are parsed (and some of them linked) already:
+        "include lib nonexistent\n" + valid,
+        "include lib broken_lib\n" + valid,
+    } ) {
+        write( "main.rcl", source );
+        Stats stats;
+        {
+            StatsScope scope( & stats );
+            REQUIRE_THROWS( parse_program( ( dir / "main.rcl" ).string() ) );
+        }
+        REQUIRE( stats.nodes_created > 0 );
+        REQUIRE( stats.nodes_deleted == stats.nodes_created );
+        for ( size_t m = 0; m < MemorySubsystems; ++ m )
+            REQUIRE( stats.live_bytes[ m ] == 0 );
+    }
+    filesystem::remove_all( dir );
+}
+
+TEST_CASE( "Memory of compiled graph is accounted and released with the Program", "[memory]" ) {
+    auto program = compile_source( "x = 2\ny = x * 3\n" );
+    const auto stats = program->stats;
+    REQUIRE( stats->live_bytes[ size_t( MEMORY::TOKENS ) ] > 0 );
+    REQUIRE( stats->live_bytes[ size_t( MEMORY::EXPRESSIONS ) ] > 0 );
+    REQUIRE( stats->peak_bytes[ size_t( MEMORY::LINES ) ] >= stats->live_bytes[ size_t( MEMORY::LINES ) ] );
+
+    map< string, Stats::TypeCount > types;
+    for ( const auto & type : stats->type_counts() )
+        types[ type.type ] = type;
+    REQUIRE( types[ "TERM" ].nodes == 4 );
+    REQUIRE( types[ "NUMBER" ].nodes == 2 );
+    REQUIRE( types[ "EXPRESSION" ].nodes == 3 );
+    REQUIRE( types[ "EXPRESSION" ].edges > 0 );
+
+    Stats evaluation;
+    program->evaluate( {}, & evaluation );
+    REQUIRE( evaluation.peak_bytes[ size_t( MEMORY::LAYERS ) ] > 0 );
+    REQUIRE( evaluation.live_bytes[ size_t( MEMORY::LAYERS ) ] == 0 );
+
+    program.reset();
+    for ( size_t m = 0; m < MemorySubsystems; ++ m )
+        REQUIRE( stats->live_bytes[ m ] == 0 );
+    REQUIRE( stats->nodes_deleted == stats->nodes_created );
+}
+
+TEST_CASE( "Evaluation follows dependencies regardless of their syntactic order", "[evaluation]" ) {
+    const auto reversed = compile_source( "z = y - x\ny = x * 2\nx = 3\n" );
+    const auto values = reversed->evaluate();
+    REQUIRE( values.at( "y" ) == 6 );
+    REQUIRE( values.at( "z" ) == 3 );
+
+    //every line depends on the previous one:
+    const size_t Lines = 2000;
+    string source = "v0 = 5000\n";
+    for ( size_t i = 1; i < Lines; ++ i )
+        source += numbered( "v", i ) + " = v" + to_string( i - 1 ) + " - 1\n";
+    source += "outputs v" + to_string( Lines - 1 ) + "\n";
+    const auto chain = compile_source( source );
+    REQUIRE( chain->evaluate().at( numbered( "v", Lines - 1 ) ) == 5000 - double( Lines - 1 ) );
+}
+
+TEST_CASE( "Strongly connected components are ordered by dependencies", "[evaluation]" ) {
+    //0 <-> 1 is a knot depending on 2, while 3 depends on the knot:
+    const vector< vector< size_t > > on = { { 1, 2 }, { 0 }, {}, { 0 } };
+    const auto components = strongly_connected( on );
+    REQUIRE( components.size() == 3 );
+    REQUIRE( components[ 0 ] == vector< size_t >{ 2 } );
+    REQUIRE( set< size_t >( components[ 1 ].begin(), components[ 1 ].end() ) == set< size_t >{ 0, 1 } );
+    REQUIRE( components[ 2 ] == vector< size_t >{ 3 } );
+}
+
+TEST_CASE( "Simultaneous linear equations are solved", "[evaluation]" ) {
+    const auto equations = compile_file( "../samples/equations.rcl" );
+    REQUIRE( equations->evaluate().at( "b" ) == 1 );
+
+    //every pair of equations is knotted and depends on the previous pair:
+    const size_t Pairs = 1000;
+    string source = "x0 + y0 = 10\nx0 - y0 = 4\n";
+    for ( size_t i = 1; i < Pairs; ++ i ) {
+        const auto x = numbered( "x", i ), y = numbered( "y", i );
+        source += x + " + " + y + " = 10\n" + x + " - " + y + " = y" + to_string( i - 1 ) + "\n";
+    }
+    source += "outputs y" + to_string( Pairs - 1 ) + "\n";
+    const auto values = compile_source( source )->evaluate();
+    //y = ( 10 - y_previous ) / 2 converges to 10 / 3:
+    REQUIRE( values.at( numbered( "y", Pairs - 1 ) ) == Catch::Detail::Approx( 10.0 / 3 ) );
+}
+
+TEST_CASE( "Conditions decidable from ranges of unknown inputs are folded", "[ranges]" ) {
+    REQUIRE( Interval{ -1, 2 } * Interval::whole() == Interval::whole() );
+    REQUIRE( Interval::point( 0 ) * Interval::whole() == Interval::point( 0 ) );
+    REQUIRE( Interval{ 1, 2 } / Interval{ -1, 1 } == Interval::whole() );
+    REQUIRE( Interval{ 2, 4 } / Interval{ 2, 4 } == Interval{ 0.5, 2 } );
+    REQUIRE( truth_less_equal( Interval{ 0, 1 }, Interval{ 1, 2 } ) == Interval::point( 1 ) );
+    REQUIRE( truth_less_equal( Interval{ 0, 3 }, Interval{ 1, 2 } ) == Interval{ 0, 1 } );
+    REQUIRE( truth_less( Interval{ 0, 1 }, Interval{ 1, 2 } ) == Interval{ 0, 1 } );
+    REQUIRE( truth_less( Interval{ 0, 1 }, Interval{ 2, 3 } ) == Interval::point( 1 ) );
+    REQUIRE( truth_less( Interval{ 1, 2 }, Interval{ 0, 1 } ) == Interval::point( 0 ) );
+
+    auto root = parse_program( "../samples/ranges.rcl" );
+    merge_occurences( root );
+    map< string, Node * > terms;
+    pulse( root, [&]( Node * node ) {
+        if ( node->type( TYPE::TERM ) )
+            terms[ node->content ] = node;
+    } );
+
+    Layer layer;
+    evaluate_layer( root, layer );
+    REQUIRE( ! layer.values.contains( terms.at( "y" ) ) );
+    const auto ranges = evaluate_ranges( root, layer );
+    REQUIRE( ranges.at( terms.at( "x" ) ) == Interval{ 0, 10 } );
+    REQUIRE( ranges.at( terms.at( "z" ) ) == Interval{ 0, 20 } );
+
+    set< Node * > pruned;
+    REQUIRE( fold_conditions( root, ranges, layer, pruned ) == 2 );
+    REQUIRE( ! pruned.empty() );
+    evaluate_layer( root, layer );
+    REQUIRE( layer.values.at( terms.at( "y" ) ) == 2 );
+    destroy_graph( root );
+
+    //known inputs decide conditions as they are:
+    const auto values = compile_file( "../samples/ranges.rcl" )->evaluate( { { "x", 5 } } );
+    REQUIRE( values.at( "y" ) == 2 );
+    REQUIRE( values.at( "z" ) == 10 );
+
+    //strict comparison at the very bound of the range is decided only if it fails for every value:
+    const auto boundary = "inputs x\nx >= 0\ny <- if x > 0 then 1 else 2\nw <- if 0 > x then 3 else 4\noutputs y w\n";
+    istringstream source( boundary );
+    root = parse_program( source, "boundary.rcl" );
+    merge_occurences( root );
+    terms.clear();
+    pulse( root, [&]( Node * node ) {
+        if ( node->type( TYPE::TERM ) )
+            terms[ node->content ] = node;
+    } );
+    Layer boundary_layer;
+    evaluate_layer( root, boundary_layer );
+    pruned.clear();
+    REQUIRE( fold_conditions( root, evaluate_ranges( root, boundary_layer ), boundary_layer, pruned ) == 1 );
+    evaluate_layer( root, boundary_layer );
+    REQUIRE( ! boundary_layer.values.contains( terms.at( "y" ) ) );
+    REQUIRE( boundary_layer.values.at( terms.at( "w" ) ) == 4 );
+    destroy_graph( root );
+    const auto program = compile_source( boundary );
+    REQUIRE( program->evaluate( { { "x", 0 } } ).at( "y" ) == 2 );
+    REQUIRE( program->evaluate( { { "x", 1 } } ).at( "y" ) == 1 );
+}
+
+TEST_CASE( "Branches are solved once all the branches they depend on are solved", "[branches]" ) {
+    ThreadPool pool( 4 );
+    Stats stats;
+    StatsScope scope( & stats );
+
+    //leaves are summed up by groups which are summed up by the root:
+    const size_t Groups = 100;
+    const size_t Leaves = 10;
+    vector< Branch * > branches;
+    const auto & spawn = [&]( function< bool( Branch & ) > solve ) {
+        branches.push_back( new Branch );
+        branches.back()->solve = solve;
+        return branches.back();
+    };
+    const auto & sum = [&]( Branch & branch ) {
+        for ( auto ref : branch.refs )
+            branch.value += ref->value;
+        return true;
+    };
+    auto root = spawn( sum );
+    vector< Branch * > groups;
+    for ( size_t g = 0; g < Groups; ++ g ) {
+        groups.push_back( spawn( sum ) );
+        root->ref( groups.back() );
+        for ( size_t l = 0; l < Leaves; ++ l ) {
+            const auto value = double( g * Leaves + l );
+            groups.back()->ref( spawn( [ value ]( Branch & branch ) {
+                branch.value = value;
+                return true;
+            } ) );
+        }
+    }
+    solve_branches( branches, pool );
+    REQUIRE( root->state == BRANCH::SOLVED );
+    REQUIRE( root->value == Groups * Leaves * ( Groups * Leaves - 1 ) / 2 );
+    REQUIRE( stats.branches_solved == branches.size() );
+
+    //collapse of single leaf cancels it's group along with the root, while other groups are still solved:
+    for ( auto branch : branches )
+        branch->value = 0;
+    ( * groups.front()->refs.begin() )->solve = []( Branch & ) {
+        return false;
+    };
+    solve_branches( branches, pool );
+    REQUIRE( groups.front()->state == BRANCH::CANCELLED );
+    REQUIRE( root->state == BRANCH::CANCELLED );
+    REQUIRE( groups.back()->state == BRANCH::SOLVED );
+    REQUIRE( stats.branches_collapsed == 1 );
+    REQUIRE( stats.branches_cancelled == 2 );
+
+    groups.front()->solve = []( Branch & ) -> bool {
+        throw runtime_error( "unsolvable" );
+    };
+    ( * groups.front()->refs.begin() )->solve = nullptr;
+    REQUIRE_THROWS_WITH( solve_branches( branches, pool ), "unsolvable" );
+    REQUIRE( root->state == BRANCH::CANCELLED );
+
+    for ( auto branch : branches )
+        delete branch;
+
+    Branch one;
+    Branch another;
+    one.ref( & another );
+    another.ref( & one );
+    REQUIRE_THROWS( solve_branches( { & one, & another }, pool ) );
+}
+
+TEST_CASE( "Forked layers share everything but their own changes", "[layers]" ) {
+    Stats stats;
+    StatsScope scope( & stats );
+    const auto & layer_bytes = [&]{
+        return stats.live_bytes[ size_t( MEMORY::LAYERS ) ].load();
+    };
+
+    //nodes are used just as keys:
+    const size_t Values = 10000;
+    vector< unique_ptr< Node > > owned;
+    vector< Node * > nodes;
+    for ( size_t i = 0; i < Values; ++ i ) {
+        owned.push_back( make_unique< Node >( "v", TYPE::TERM, SourcePos( 1, 1, 1 ) ) );
+        nodes.push_back( owned.back().get() );
+    }
+    {
+        Layer base;
+        map< Node *, double > expected;
+        for ( size_t i = 0; i < Values; ++ i ) {
+            base.assign( nodes[ i ], i );
+            expected[ nodes[ i ] ] = i;
+        }
+        //the same node again:
+        base.assign( nodes[ 0 ], -1 );
+        expected[ nodes[ 0 ] ] = -1;
+        REQUIRE( base.values.size() == Values );
+        size_t visited = 0;
+        base.values.for_each( [&]( Node * node, const double value ) {
+            REQUIRE( expected.at( node ) == value );
+            ++ visited;
+        } );
+        REQUIRE( visited == Values );
+        const auto base_bytes = layer_bytes();
+
+        const size_t Forks = 1000;
+        vector< Layer > forks( Forks, base );
+        REQUIRE( layer_bytes() == base_bytes );
+        for ( size_t f = 0; f < Forks; ++ f )
+            forks[ f ].assign( nodes[ f ], 1e6 + f );
+        for ( size_t f = 0; f < Forks; ++ f ) {
+            REQUIRE( forks[ f ].values.at( nodes[ f ] ) == 1e6 + f );
+            REQUIRE( forks[ f ].values.at( nodes[ f + 1 ] ) == f + 1 );
+        }
+        REQUIRE( base.values.at( nodes[ 1 ] ) == 1 );
+        //every fork pays just for the path to it's own change:
+        REQUIRE( layer_bytes() - base_bytes < int64_t( Forks ) * base_bytes / 100 );
+    }
+    REQUIRE( layer_bytes() == 0 );
+}
+
+TEST_CASE( "Least recently used entries are evicted first", "[lru]" ) {
+    LruCache< string, int > lru( 2 );
+    lru.put( "a", 1 );
+    lru.put( "b", 2 );
+    int value;
+    REQUIRE( lru.find( "a", value ) );
+    //"b" is the least recently used now:
+    lru.put( "c", 3 );
+    REQUIRE( ! lru.find( "b", value ) );
+    REQUIRE( lru.find( "c", value ) );
+    REQUIRE( value == 3 );
+    REQUIRE( lru.hits == 2 );
+    REQUIRE( lru.misses == 1 );
+    REQUIRE( lru.evictions == 1 );
+}
+
+TEST_CASE( "Compositions are keyed regardless of operands order and syntax", "[branches]" ) {
+    const auto & key_of = []( const string & source ) {
+        istringstream stream( source );
+        auto root = parse_source( stream, "key.rcl" );
+        Layer layer;
+        pulse( root, [&]( Node * node ) {
+            if ( node->type( TYPE::TERM ) && node->content == "a" )
+                layer.assign( node, 1 );
+        } );
+        string key;
+        pulse( root, [&]( Node * node ) {
+            auto op = find_types( node->refs, TYPE::OPERATOR );
+            if ( node->type( TYPE::EXPRESSION ) && op != nullptr && op->content == "=" )
+                key = composition_key( "test", node, layer );
+        } );
+        destroy_graph( root );
+        return key;
+    };
+    REQUIRE( key_of( "y = a * b + 2" ) == key_of( "y  =  2 + b * a" ) );
+    REQUIRE( key_of( "y = a - b" ) != key_of( "y = b - a" ) );
+}
+
+TEST_CASE( "Identical branches are solved once", "[branches]" ) {
+    ThreadPool pool( 2 );
+    BranchCache cache( 16 );
+    Stats stats;
+    StatsScope scope( & stats );
+    size_t solved = 0;
+    for ( size_t execution = 0; execution < 3; ++ execution ) {
+        Branch branch;
+        branch.key = "same";
+        branch.solve = [&]( Branch & b ) {
+            ++ solved;
+            b.value = 42;
+            return true;
+        };
+        solve_branches( { & branch }, pool, cache );
+        REQUIRE( branch.value == 42 );
+    }
+    REQUIRE( solved == 1 );
+    REQUIRE( stats.branch_cache_hits == 2 );
+    REQUIRE( stats.branch_cache_misses == 1 );
+}
+
+TEST_CASE( "Branches exploration stays within the budget", "[branches]" ) {
+    ThreadPool pool( 4 );
+    BranchCache cache( 16 );
+    Stats stats;
+    StatsScope scope( & stats );
+
+    //the cheapest leaves are solved first while dependents are the most expensive:
+    vector< unique_ptr< Branch > > leaves;
+    vector< unique_ptr< Branch > > dependents;
+    vector< Branch * > branches;
+    for ( size_t i = 0; i < 5; ++ i ) {
+        leaves.push_back( make_unique< Branch >() );
+        leaves.back()->cost = 5 - i;
+        dependents.push_back( make_unique< Branch >() );
+        dependents.back()->cost = 10;
+        dependents.back()->ref( leaves.back().get() );
+        branches.push_back( leaves.back().get() );
+        branches.push_back( dependents.back().get() );
+    }
+
+    solve_branches( branches, pool, cache, { .branches = 3 } );
+    for ( size_t i = 0; i < 5; ++ i ) {
+        const auto cheapest = leaves[ i ]->cost <= 3;
+        REQUIRE( leaves[ i ]->state == ( cheapest ? BRANCH::SOLVED : BRANCH::DROPPED ) );
+        REQUIRE( dependents[ i ]->state == ( cheapest ? BRANCH::DROPPED : BRANCH::CANCELLED ) );
+    }
+    REQUIRE( stats.branches_solved == 3 );
+    REQUIRE( stats.branches_dropped == 5 );
+    REQUIRE( stats.branches_cancelled == 2 );
+
+    //Branches themselves take more memory than that:
+    solve_branches( branches, pool, cache, { .bytes = 1 } );
+    for ( auto branch : branches )
+        REQUIRE( branch->state != BRANCH::SOLVED );
+
+    solve_branches( branches, pool, cache, { .branches = 100, .bytes = 1 << 30 } );
+    for ( auto branch : branches )
+        REQUIRE( branch->state == BRANCH::SOLVED );
+
+    //just enough of the most expensive Branches are dropped for their Layers to get back within the budget:
+    vector< unique_ptr< Branch > > heavy;
+    vector< Branch * > heavy_branches;
+    for ( size_t i = 0; i < 8; ++ i ) {
+        heavy.push_back( make_unique< Branch >() );
+        heavy.back()->cost = i;
+        for ( uintptr_t v = 1; v <= 1000; ++ v )
+            heavy.back()->layer.assign( reinterpret_cast< Node * >( v * 16 ), double( i ) );
+        heavy_branches.push_back( heavy.back().get() );
+    }
+    const auto used = stats.live_bytes[ size_t( MEMORY::BRANCHES ) ] + stats.live_bytes[ size_t( MEMORY::LAYERS ) ];
+    REQUIRE( heavy.back()->layer.owned_bytes() > 1 );
+    const auto dropped = stats.branches_dropped.load();
+    solve_branches( heavy_branches, pool, cache, { .bytes = used - 1 } );
+    REQUIRE( stats.branches_dropped - dropped == 1 );
+    REQUIRE( heavy.back()->state == BRANCH::DROPPED );
+    for ( size_t i = 0; i + 1 < heavy.size(); ++ i )
+        REQUIRE( heavy[ i ]->state == BRANCH::SOLVED );
+}
+
+TEST_CASE( "Branch state is stored and resumed", "[branches]" ) {
+    const string source = "a = 4\nb = 2\na @+ b\n";
+    const auto path = ( filesystem::temp_directory_path() / "recumpose_test.branches" ).string();
+    ThreadPool pool( 2 );
+    Stats stats;
+    StatsScope scope( & stats );
+
+    const auto & spawn = [&]( Node *& root, Layer & layer ) {
+        istringstream stream( source );
+        root = parse_source( stream, "state.rcl" );
+        merge_occurences( root );
+        evaluate_layer( root, layer );
+        return branch_compositions( root, layer );
+    };
+
+    //only the right branch is solved within the budget, while the left one is left pending for another process:
+    Node * root;
+    Layer layer;
+    auto branches = spawn( root, layer );
+    REQUIRE( branches.size() == 2 );
+    BranchCache cache( 16 );
+    solve_branches( branches, pool, cache, { .branches = 1 } );
+    save_branch_state( path, layer, branches );
+    {
+        BranchStateView view( path );
+        REQUIRE( view.branches.size() == 2 );
+        for ( size_t i = 0; i < branches.size(); ++ i ) {
+            REQUIRE( view.name( i ) == branches[ i ]->name );
+            REQUIRE( view.key( i ) == branches[ i ]->key );
+            REQUIRE( view.state( i ) == branches[ i ]->state );
+            REQUIRE( view.refs( i ).size() == branches[ i ]->refs.size() );
+        }
+        REQUIRE( view.state( 0 ) == BRANCH::DROPPED );
+        REQUIRE( view.refs( 0 )[ 0 ] == 1 );
+
+        const auto nodes = bind_nodes( view, root );
+        const auto restored = restore_layer( view, nodes );
+        REQUIRE( restored.values.size() == layer.values.size() );
+        layer.values.for_each( [&]( Node * node, const double value ) {
+            REQUIRE( restored.value_or( node, -1 ) == value );
+        } );
+    }
+    for ( auto branch : branches )
+        delete branch;
+    destroy_graph( root );
+
+    //another graph compiled from the same source solves only what's left:
+    Layer resumed_layer;
+    branches = spawn( root, resumed_layer );
+    BranchCache resumed( 16 );
+    {
+        BranchStateView view( path );
+        REQUIRE( resume_branches( view, resumed ) == 1 );
+        REQUIRE( bind_nodes( view, root ).size() == view.nodes.size() );
+    }
+    solve_branches( branches, pool, resumed );
+    REQUIRE( resumed.hits == 1 );
+    REQUIRE( branches[ 0 ]->state == BRANCH::SOLVED );
+    REQUIRE( branches[ 0 ]->value == 6 );
+    //the left branch's layer is stored as just what it changed:
+    save_branch_state( path, resumed_layer, branches );
+    {
+        BranchStateView view( path );
+        REQUIRE( view.layers[ 1 ].values_end - view.layers[ 1 ].values_begin == 1 );
+        const auto nodes = bind_nodes( view, root );
+        const auto left = restore_layer( view, nodes, 0 );
+        const auto base = restore_layer( view, nodes );
+        size_t changed = 0;
+        left.values.for_each_difference( base.values, [&]( Node * node, const double value ) {
+            REQUIRE( node->content == "a" );
+            REQUIRE( value == 6 );
+            ++ changed;
+        } );
+        REQUIRE( changed == 1 );
+    }
+    for ( auto branch : branches )
+        delete branch;
+    destroy_graph( root );
+
+    //files of another format are rejected:
+    {
+        ofstream garbage( path, ios::binary | ios::trunc );
+        garbage << "definitely not a branch state";
+    }
+    REQUIRE_THROWS_AS( BranchStateView( path ), runtime_error );
+    filesystem::remove( path );
+}
+
+TEST_CASE( "Edited documents are parsed incrementally", "[document]" ) {
+    const auto & parsed = []( const string & text ) {
+        istringstream stream( text );
+        auto root = parse_source( stream, "document.rcl" );
+        auto description = describe_graph( root );
+        destroy_graph( root );
+        return description;
+    };
+    const auto & read = []( const string & file_name ) {
+        ifstream file( file_name );
+        ostringstream text;
+        text << file.rdbuf();
+        return text.str();
+    };
+    //positioned as parsed at once:
+    const auto & described = []( const Document & document ) {
+        auto copy = document.clone();
+        auto description = describe_graph( copy );
+        destroy_graph( copy );
+        return description;
+    };
+    //every node is looked up where it is:
+    const auto & indexed = []( const Document & document ) {
+        bool found = true;
+        pulse( document.root(), [&]( Node * node ) {
+            if ( node == document.root() )
+                return;
+            const auto pos = document.position( node );
+            const auto at = document.at( pos.line, pos.char_start );
+            found = found && find( at.begin(), at.end(), node ) != at.end();
+        } );
+        return found;
+    };
+
+    //the same graph as parsed at once:
+    for ( const auto & sample : { "simple", "square_equation", "tree_element", "ranges", "equations", "falcon", "program_1" } ) {
+        const auto text = read( string( "../samples/" ) + sample + ".rcl" );
+        Document document( "document.rcl", text );
+        REQUIRE( described( document ) == parsed( text ) );
+    }
+
+    Document document( "document.rcl", "inputs x\ny = x * 2\nz = y + 1\noutputs z\n" );
+    const vector< LineEdit > edits = {
+        //changed statement:
+        { 2, 1, { "y = x * 3" } },
+        //inserted indented continuation and statements:
+        { 4, 0, { "w = 7", "v:", "    u = 5" } },
+        //multiline comment opened and spanning the following blocks:
+        { 2, 0, { "a = 1 /* start" } },
+        { 5, 0, { "end */ b = 2" } },
+        //comment extended up to the end once again and then removed:
+        { 5, 1, { "b = 2" } },
+        { 2, 1, { "a = 1" } },
+        { 1, 0, { "// leading comment", "" } },
+        { 11, 1, { "outputs z w" } },
+    };
+    for ( const auto & e : edits ) {
+        document.edit( e );
+        REQUIRE( described( document ) == parsed( document.text() ) );
+        REQUIRE( indexed( document ) );
+    }
+    //multiline comment closed earlier than it was and then removed along with it's opening:
+    Document commented( "document.rcl", "inputs x\ny = x * 2\nz = y + 1\noutputs z\n" );
+    const vector< LineEdit > comment_edits = {
+        { 2, 0, { "a = 1 /* start" } },
+        { 4, 0, { "still commented */ b = 2" } },
+        //comment closed early:
+        { 3, 0, { "*/" } },
+        //opening removed:
+        { 2, 2, {} },
+    };
+    for ( const auto & e : comment_edits ) {
+        commented.edit( e );
+        REQUIRE( described( commented ) == parsed( commented.text() ) );
+        REQUIRE( indexed( commented ) );
+    }
+    //malformed block is left out until it's fixed:
+    const auto lines = int32_t( document.lines() );
+    REQUIRE_THROWS_AS( document.edit( { lines + 1, 0, { "t:" } } ), runtime_error );
+    document.edit( { lines + 1, 1, { "t:", "    s" } } );
+    REQUIRE( described( document ) == parsed( document.text() ) );
+
+    //editing single line of large document parses just that line:
+    string large;
+    for ( int i = 0; i < 2000; ++ i )
+        large += numbered( "x", i ) + " = " + to_string( i ) + " + 1\n";
+    Document big( "document.rcl", large );
+    Stats stats;
+    StatsScope scope( & stats );
+    big.edit( { 1000, 1, { "x999 = 5 * 2" } } );
+    REQUIRE( stats.nodes_created < 20 );
+    REQUIRE( described( big ) == parsed( big.text() ) );
+    REQUIRE( indexed( big ) );
+
+    //inserted and removed lines parse just the blocks around, while nodes of the following blocks aren't renumbered:
+    const auto & last_term = [&]() {
+        Node * last = nullptr;
+        for ( auto node : big.at( int32_t( big.lines() ), 1 ) ) {
+            if ( node->type( TYPE::TERM ) )
+                last = node;
+        }
+        return last;
+    };
+    const auto following = last_term();
+    REQUIRE( following != nullptr );
+    const auto stored = following->source_pos;
+    const auto line = big.position( following ).line;
+    const auto created = stats.nodes_created.load();
+    big.edit( { 500, 0, { "inserted = 1", "    continued = 2" } } );
+    REQUIRE( stats.nodes_created - created < 40 );
+    REQUIRE( following->source_pos == stored );
+    REQUIRE( big.position( following ).line == line + 2 );
+    REQUIRE( big.at( 501, 5 ).front()->content == "    continued = 2" );
+    big.edit( { 100, 3, {} } );
+    REQUIRE( stats.nodes_created - created < 80 );
+    REQUIRE( following->source_pos == stored );
+    REQUIRE( big.position( following ).line == line - 1 );
+    REQUIRE( last_term() == following );
+    REQUIRE( described( big ) == parsed( big.text() ) );
+    REQUIRE( indexed( big ) );
+
+    REQUIRE_THROWS_AS( big.edit( { 5000, 1, {} } ), out_of_range );
+}
+
+TEST_CASE( "Nodes are looked up by their positions", "[positions]" ) {
+    istringstream source( "inputs x\nyy = x * 2 + 10\noutputs yy\n" );
+    auto root = parse_source( source, "positions.rcl" );
+    const PositionIndex index( root );
+
+    size_t count = 0;
+    pulse( root, [&]( Node * ) { ++ count; } );
+    REQUIRE( index.size() == count );
+
+    //everything covering the character, from the widest LINE down to the TERM:
+    const auto & contents = []( const vector< Node * > & nodes ) {
+        vector< string > result;
+        for ( auto node : nodes )
+            result.push_back( node->content );
+        return result;
+    };
+    const auto at_yy = index.at( "positions.rcl", 2, 2 );
+    REQUIRE( find( at_yy.begin(), at_yy.end(), root->child( TYPE::LINE )->child( TYPE::LINE ) ) != at_yy.end() );
+    const auto terms = contents( index.overlapping( SourcePos( 2, 1, 16, "positions.rcl" ) ) );
+    for ( const auto & content : { "yy", "=", "x", "*", "2", "+", "10" } )
+        REQUIRE( find( terms.begin(), terms.end(), content ) != terms.end() );
+    REQUIRE( contents( index.at( "positions.rcl", 2, 15 ) ).back() == "10" );
+    REQUIRE( index.at( "positions.rcl", 2, 40 ).empty() );
+    REQUIRE( index.at( "positions.rcl", 7, 1 ).empty() );
+    REQUIRE( index.at( "other.rcl", 2, 1 ).empty() );
+    REQUIRE( index.intersects( SourcePos( 3, 9, 10, "positions.rcl" ) ) );
+
+    //iteration goes in syntactic order:
+    vector< Node * > ordered;
+    index.for_each( [&]( Node * node ) { ordered.push_back( node ); } );
+    REQUIRE( ordered.size() == count );
+    REQUIRE( is_sorted( ordered.begin(), ordered.end(), []( Node * left, Node * right ) { return left->source_pos < right->source_pos; } ) );
+    REQUIRE( PositionIndex::sorted( ordered ) == ordered );
+
+    //nodes leave the index:
+    PositionIndex edited( root );
+    vector< Node * > first_line;
+    edited.for_each_on_line( "positions.rcl", 1, [&]( Node * node ) { first_line.push_back( node ); } );
+    REQUIRE( first_line == index.overlapping( SourcePos( 1, 1, 100, "positions.rcl" ) ) );
+    for ( auto node : first_line )
+        edited.erase( node );
+    REQUIRE( edited.overlapping( SourcePos( 1, 1, 100, "positions.rcl" ) ).empty() );
+    REQUIRE( edited.size() == index.size() - first_line.size() );
+    REQUIRE( edited.at( "positions.rcl", 2, 15 ) == index.at( "positions.rcl", 2, 15 ) );
+
+    destroy_graph( root );
+
+    //nodes wider than lookups reach back are still found, after the widest ones are gone as well:
+    string sum = "s = v0";
+    for ( size_t i = 1; i < 100; ++ i )
+        sum += " + " + numbered( "v", i );
+    istringstream wide( sum + "\n" );
+    root = parse_source( wide, "wide.rcl" );
+    PositionIndex long_line( root );
+    const auto & line = root->child( TYPE::LINE );
+    const auto middle = static_cast< int32_t >( sum.size() / 2 );
+    const auto at_middle = long_line.at( "wide.rcl", 1, middle );
+    REQUIRE( at_middle.front() == line );
+    REQUIRE( at_middle.size() >= 2 );
+    long_line.erase( line );
+    REQUIRE( long_line.at( "wide.rcl", 1, middle ) == vector< Node * >( at_middle.begin() + 1, at_middle.end() ) );
+    destroy_graph( root );
+}
+
+TEST_CASE( "Language server answers from the graph kept in memory", "[lsp]" ) {
+    const auto & message = []( const string & json ) {
+        ostringstream framed;
+        write_lsp_message( framed, json );
+        return framed.str();
+    };
+    const auto & position = []( const string & method, const int id, const int line, const int character ) {
+        return "{\"jsonrpc\":\"2.0\",\"id\":" + to_string( id ) + ",\"method\":\"" + method + "\",\"params\":{\"textDocument\":{\"uri\":\"file:///tmp/lsp%20test.rcl\"},\"position\":{\"line\":" + to_string( line ) + ",\"character\":" + to_string( character ) + "},\"context\":{\"includeDeclaration\":true}}}";
+    };
+    const auto & change = []( const int line, const int start, const int end_line, const int end, const string & text ) {
+        return "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didChange\",\"params\":{\"textDocument\":{\"uri\":\"file:///tmp/lsp%20test.rcl\",\"version\":2},\"contentChanges\":[{\"range\":{\"start\":{\"line\":" + to_string( line ) + ",\"character\":" + to_string( start ) + "},\"end\":{\"line\":" + to_string( end_line ) + ",\"character\":" + to_string( end ) + "}},\"text\":\"" + text + "\"}]}}";
+    };
+
+    string input;
+    input += message( "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"initialize\",\"params\":{}}" );
+    input += message( "{\"jsonrpc\":\"2.0\",\"method\":\"initialized\",\"params\":{}}" );
+    input += message( "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didOpen\",\"params\":{\"textDocument\":{\"uri\":\"file:///tmp/lsp%20test.rcl\",\"languageId\":\"recumpose\",\"version\":1,\"text\":\"y = 2 * 3\\nz = y + 1\\noutputs z\\n\"}}}" );
+    input += message( position( "textDocument/hover", 2, 1, 0 ) );
+    input += message( position( "textDocument/references", 3, 0, 0 ) );
+    //"3" becomes "4":
+    input += message( change( 0, 8, 0, 9, "4" ) );
+    input += message( position( "textDocument/hover", 4, 1, 0 ) );
+    //malformed statement inserted and removed then:
+    input += message( change( 3, 0, 3, 0, "t:\\n" ) );
+    input += message( change( 3, 0, 4, 0, "" ) );
+    input += message( position( "textDocument/hover", 5, 2, 8 ) );
+    input += message( "{\"jsonrpc\":\"2.0\",\"id\":6,\"method\":\"textDocument/definition\",\"params\":{}}" );
+    input += message( "{\"jsonrpc\":\"2.0\",\"id\":7,\"method\":\"shutdown\"}" );
+    input += message( "{\"jsonrpc\":\"2.0\",\"method\":\"exit\"}" );
+
+    istringstream in( input );
+    ostringstream out;
+    REQUIRE( LanguageServer( in, out ).run() == 0 );
+
+    vector< Json > responses;
+    map< int64_t, Json > results;
+    vector< Json > diagnostics;
+    istringstream written( out.str() );
+    string body;
+    while ( read_lsp_message( written, body ) ) {
+        responses.push_back( Json::parse( body ) );
+        const auto & response = responses.back();
+        if ( response[ "method" ].text == "textDocument/publishDiagnostics" )
+            diagnostics.push_back( response[ "params" ][ "diagnostics" ] );
+        else
+            results[ response[ "id" ].integer() ] = response;
+    }
+
+    REQUIRE( results[ 1 ][ "result" ][ "capabilities" ][ "hoverProvider" ].boolean );
+    REQUIRE( results[ 2 ][ "result" ][ "contents" ][ "value" ].text == "z = 7" );
+    REQUIRE( results[ 2 ][ "result" ][ "range" ][ "end" ][ "character" ].integer() == 1 );
+    //"y" is declared and used:
+    const auto & references = results[ 3 ][ "result" ];
+    REQUIRE( references.items.size() == 2 );
+    REQUIRE( references[ 0 ][ "range" ][ "start" ][ "line" ].integer() == 0 );
+    REQUIRE( references[ 1 ][ "range" ][ "start" ][ "line" ].integer() == 1 );
+    REQUIRE( references[ 1 ][ "range" ][ "start" ][ "character" ].integer() == 4 );
+    REQUIRE( references[ 1 ][ "uri" ].text == "file:///tmp/lsp%20test.rcl" );
+    REQUIRE( results[ 4 ][ "result" ][ "contents" ][ "value" ].text == "z = 9" );
+    REQUIRE( results[ 5 ][ "result" ][ "contents" ][ "value" ].text == "z = 9" );
+    REQUIRE( results[ 6 ][ "error" ][ "code" ].integer() == -32601 );
+    REQUIRE( results[ 7 ][ "result" ].is_null() );
+
+    //diagnostics are published on open and on every change:
+    REQUIRE( diagnostics.size() == 4 );
+    REQUIRE( diagnostics[ 0 ].items.empty() );
+    REQUIRE( diagnostics[ 2 ].items.size() == 1 );
+    REQUIRE( diagnostics[ 2 ][ 0 ][ "range" ][ "start" ][ "line" ].integer() == 3 );
+    REQUIRE( diagnostics[ 3 ].items.empty() );
+
+    //semantics of edits are analyzed only once asked for, so the malformed statement typed over is never reported:
+    input = message( "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didOpen\",\"params\":{\"textDocument\":{\"uri\":\"file:///tmp/lsp%20test.rcl\",\"languageId\":\"recumpose\",\"version\":1,\"text\":\"y = 1\\n\"}}}" );
+    input += message( change( 0, 4, 0, 5, "1 ++ 2" ) );
+    input += message( change( 0, 4, 0, 10, "3" ) );
+    input += message( position( "textDocument/hover", 8, 0, 0 ) );
+    istringstream typed( input );
+    ostringstream published;
+    REQUIRE( LanguageServer( typed, published ).run() == 1 );
+    diagnostics.clear();
+    results.clear();
+    istringstream written_typed( published.str() );
+    while ( read_lsp_message( written_typed, body ) ) {
+        const auto response = Json::parse( body );
+        if ( response[ "method" ].text == "textDocument/publishDiagnostics" )
+            diagnostics.push_back( response[ "params" ][ "diagnostics" ] );
+        else
+            results[ response[ "id" ].integer() ] = response;
+    }
+    REQUIRE( diagnostics.size() == 3 );
+    for ( const auto & published_diagnostics : diagnostics )
+        REQUIRE( published_diagnostics.items.empty() );
+    REQUIRE( results[ 8 ][ "result" ][ "contents" ][ "value" ].text == "y = 3" );
+
+    //while a semantic error is published once the client stays quiet:
+    input = message( "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didOpen\",\"params\":{\"textDocument\":{\"uri\":\"file:///tmp/lsp%20test.rcl\",\"languageId\":\"recumpose\",\"version\":1,\"text\":\"y = 1 ++ 2\\n\"}}}" );
+    //the client sends the rest after a pause:
+    struct PausedInput : streambuf {
+        string first;
+        string rest;
+        PausedInput( const string & first, const string & rest ): first( first ), rest( rest ) {
+            setg( this->first.data(), this->first.data(), this->first.data() + this->first.size() );
+        }
+        int_type underflow() override {
+            if ( eback() == rest.data() )
+                return traits_type::eof();
+            this_thread::sleep_for( chrono::milliseconds( 200 ) );
+            setg( rest.data(), rest.data(), rest.data() + rest.size() );
+            return traits_type::to_int_type( rest.front() );
+        }
+    };
+    PausedInput paused( input, message( "{\"jsonrpc\":\"2.0\",\"method\":\"exit\"}" ) );
+    istream quiet( & paused );
+    ostringstream quiet_published;
+    REQUIRE( LanguageServer( quiet, quiet_published, default_pool(), chrono::milliseconds( 10 ) ).run() == 1 );
+    diagnostics.clear();
+    istringstream written_quiet( quiet_published.str() );
+    while ( read_lsp_message( written_quiet, body ) )
+        diagnostics.push_back( Json::parse( body )[ "params" ][ "diagnostics" ] );
+    REQUIRE( diagnostics.size() == 2 );
+    REQUIRE( diagnostics[ 0 ].items.empty() );
+    REQUIRE( diagnostics[ 1 ].items.size() == 1 );
+    REQUIRE( diagnostics[ 1 ][ 0 ][ "range" ][ "start" ][ "character" ].integer() == 6 );
+
+    const auto parsed = Json::parse( " { \"a\" : [ 1, -2.5e1, \"\\u00e9\\n\", true, null ], \"b\": {} } " );
+    REQUIRE( parsed[ "a" ][ 1 ].number == -25 );
+    REQUIRE( parsed[ "a" ][ 2 ].text == "\xc3\xa9\n" );
+    REQUIRE( parsed[ "a" ][ 4 ].is_null() );
+    REQUIRE( parsed[ "b" ].kind == Json::OBJECT );
+    REQUIRE_THROWS_AS( Json::parse( "{\"a\":}" ), runtime_error );
+    REQUIRE_THROWS_AS( Json::parse( "[1] 2" ), runtime_error );
+}
+
+TEST_CASE( "Watched programs are reparsed by changed files only", "[watch]" ) {
+    const auto dir = filesystem::temp_directory_path() / "recumpose_watch_test";
+    filesystem::remove_all( dir );
+    filesystem::create_directories( dir / "lib" );
+    const auto & write = [&]( const string & name, const string & content ) {
+        ofstream( dir / name ) << content;
+    };
+    const auto & parsed = [&]() {
+        auto root = parse_program( ( dir / "main.rcl" ).string() );
+        auto description = describe_graph( root );
+        destroy_graph( root );
+        return description;
+    };
+    const auto & linked = []( const WatchedProgram & program ) {
+        auto root = program.link();
+        auto description = describe_graph( root );
+        destroy_graph( root );
+        return description;
+    };
+    const auto & path = [&]( const string & name ) {
+        return filesystem::weakly_canonical( dir / name ).string();
+    };
+    write( "main.rcl", "include left lib/shared\nr = k * 2\noutputs r\n" );
+    write( "left.rcl", "include lib/shared\nl = k + 1\n" );
+    write( "lib/shared.rcl", "k = 7\n" );
+
+    WatchedProgram program( ( dir / "main.rcl" ).string() );
+    REQUIRE( program.files() == set{ path( "main.rcl" ), path( "left.rcl" ), path( "lib/shared.rcl" ) } );
+    REQUIRE( linked( program ) == parsed() );
+
+    //only the changed line of the changed file is parsed again:
+    write( "lib/shared.rcl", "k = 8\n" );
+    REQUIRE_FALSE( program.update( { path( "other.rcl" ) } ) );
+    {
+        Stats stats;
+        StatsScope scope( & stats );
+        REQUIRE( program.update( { path( "lib/shared.rcl" ) } ) );
+        REQUIRE( stats.nodes_created < 10 );
+    }
+    REQUIRE( linked( program ) == parsed() );
+
+    //includes come and go:
+    write( "right.rcl", "m = 3\n" );
+    write( "main.rcl", "include right lib/shared\nr = k * m\noutputs r\n" );
+    REQUIRE( program.update( { path( "main.rcl" ) } ) );
+    REQUIRE( program.files() == set{ path( "main.rcl" ), path( "right.rcl" ), path( "lib/shared.rcl" ) } );
+    REQUIRE( linked( program ) == parsed() );
+
+    //malformed files fail the link until they're fixed:
+    write( "right.rcl", "m = 3 +\n" );
+    program.update( { path( "right.rcl" ) } );
+    REQUIRE_THROWS_AS( program.link(), runtime_error );
+    filesystem::remove( dir / "right.rcl" );
+    program.update( { path( "right.rcl" ) } );
+    REQUIRE_THROWS_AS( program.link(), runtime_error );
+    write( "right.rcl", "m = 4\n" );
+    program.update( { path( "right.rcl" ) } );
+    REQUIRE( linked( program ) == parsed() );
+
+    //changes are reported once their burst ends:
+    FileWatcher watcher;
+    for ( const auto & file : program.files() )
+        watcher.watch( file );
+    REQUIRE( watcher.wait( chrono::milliseconds( 10 ), chrono::milliseconds( 10 ) ).empty() );
+    thread writer( [&]{
+        for ( int i = 0; i < 5; ++ i ) {
+            write( "lib/shared.rcl", "k = " + to_string( i ) + "\n" );
+            this_thread::sleep_for( chrono::milliseconds( 5 ) );
+        }
+        //replaced rather than written in place:
+        write( "right.tmp", "m = 5\n" );
+        filesystem::rename( dir / "right.tmp", dir / "right.rcl" );
+        write( "unwatched.rcl", "\n" );
+    } );
+    const auto changed = watcher.wait( chrono::seconds( 5 ), chrono::milliseconds( 200 ) );
+    writer.join();
+    REQUIRE( changed == set{ path( "lib/shared.rcl" ), path( "right.rcl" ) } );
+    REQUIRE( watcher.wait( chrono::milliseconds( 10 ), chrono::milliseconds( 10 ) ).empty() );
+
+    filesystem::remove_all( dir );
+}
+
+TEST_CASE( "Plots are written with stable node ids", "[plot]" ) {
+    const auto dir = filesystem::temp_directory_path() / "recumpose_plot_test";
+    filesystem::remove_all( dir );
+    filesystem::create_directories( dir );
+    const auto & read = []( const filesystem::path & file_name ) {
+        ifstream file( file_name );
+        ostringstream text;
+        text << file.rdbuf();
+        return text.str();
+    };
+    //the same graph at other addresses is written the same way:
+    for ( const auto & name : { "first", "second" } ) {
+        auto root = parse_source( "../samples/falcon.rcl" );
+        plot( root, set{ TYPE::EXPRESSION, TYPE::TERM, TYPE::NONABELIAN }, ( dir / name ).string(), false );
+        destroy_graph( root );
+    }
+    const auto first = read( dir / "first.dot" );
+    auto second = read( dir / "second.dot" );
+    REQUIRE( first.starts_with( "digraph " ) );
+    REQUIRE( first.find( " -> " ) != string::npos );
+    REQUIRE( first.find( "n0 [label=" ) != string::npos );
+    second.replace( second.find( "second" ), 6, "first" );
+    REQUIRE( first == second );
+
+    REQUIRE( dot_quoted( "a \"b\"\\" ) == "\"a \\\"b\\\"\\\\\"" );
+    render_jobs().wait();
+    filesystem::remove_all( dir );
+}
+
+TEST_CASE( "Several views of the graph are exported within single traversal", "[export]" ) {
+    const auto dir = filesystem::temp_directory_path() / "recumpose_export_test";
+    filesystem::remove_all( dir );
+    filesystem::create_directories( dir );
+    const auto & read = []( const string & file_name ) {
+        ifstream file( file_name );
+        ostringstream text;
+        text << file.rdbuf();
+        return text.str();
+    };
+    const auto & name = [&]( const string & view ) {
+        return ( dir / view ).string();
+    };
+    const set< TYPE > semantics{ TYPE::EXPRESSION, TYPE::TERM, TYPE::NONABELIAN };
+    const set< TYPE > expressions{ TYPE::EXPRESSION, TYPE::TERM, TYPE::ENTITY, TYPE::NONABELIAN };
+
+    auto root = parse_source( "../samples/falcon.rcl" );
+    Stats stats;
+    vector< string > written;
+    {
+        StatsScope scope( & stats );
+        written = export_graph( root, {
+            { name( "dot" ), semantics, GRAPH_FORMAT::DOT },
+            { name( "json" ), expressions, GRAPH_FORMAT::JSON },
+            { name( "graphml" ), expressions, GRAPH_FORMAT::GRAPHML },
+        } );
+    }
+    REQUIRE( stats.pulses == 1 );
+    REQUIRE( written == vector{ name( "dot" ) + ".dot", name( "json" ) + ".json", name( "graphml" ) + ".graphml" } );
+
+    //the same nodes under the same ids within every view:
+    const auto json = Json::parse( read( name( "json" ) + ".json" ) );
+    const auto & nodes = json[ "nodes" ].items;
+    REQUIRE( ! nodes.empty() );
+    size_t entities = 0;
+    size_t edges = 0;
+    for ( const auto & node : nodes ) {
+        if ( node[ "types" ].text.find( "ENTITY" ) != string::npos )
+            ++ entities;
+        edges += node[ "refs" ].items.size();
+    }
+    REQUIRE( entities > 0 );
+    REQUIRE( edges > 0 );
+    const auto graphml = read( name( "graphml" ) + ".graphml" );
+    REQUIRE( graphml.find( "<graphml" ) != string::npos );
+    REQUIRE( graphml.ends_with( "</graphml>\n" ) );
+    size_t graphml_edges = 0;
+    for ( auto at = graphml.find( "<edge " ); at != string::npos; at = graphml.find( "<edge ", at + 1 ) )
+        ++ graphml_edges;
+    REQUIRE( graphml_edges == edges );
+    const auto dot = read( name( "dot" ) + ".dot" );
+    for ( const auto & node : nodes ) {
+        const auto label = "n" + to_string( node[ "id" ].integer() ) + " [label=" + dot_quoted( node[ "label" ].text ) + "];";
+        istringstream types( node[ "types" ].text );
+        bool semantic = false;
+        for ( string type; types >> type; )
+            semantic = semantic || type == "EXPRESSION" || type == "TERM" || type == "NONABELIAN";
+        REQUIRE( ( dot.find( label ) != string::npos ) == semantic );
+    }
+
+    //ids don't depend on where nodes are allocated:
+    const auto copy = clone_graph( root );
+    export_graph( copy, { { name( "copy" ), expressions, GRAPH_FORMAT::JSON } } );
+    REQUIRE( read( name( "copy" ) + ".json" ) == read( name( "json" ) + ".json" ) );
+    destroy_graph( copy );
+
+    //nodes equal by position, content and TYPEs are told apart by what they reference whichever is allocated first:
+    const auto & twins = [&]( const bool reversed, const string & view ) {
+        auto file = new Node( "twins.rcl", TYPE::SOURCE_FILE, SourcePos( 0, 0, 0, "twins.rcl" ) );
+        Node * twin[ 2 ];
+        twin[ reversed ? 1 : 0 ] = new Node( "a", TYPE::TERM, SourcePos( 1, 1, 1, "twins.rcl" ) );
+        twin[ reversed ? 0 : 1 ] = new Node( "a", TYPE::TERM, SourcePos( 1, 1, 1, "twins.rcl" ) );
+        for ( size_t t = 0; t < 2; ++ t ) {
+            file->ref( twin[ t ] );
+            twin[ t ]->ref( new Node( numbered( "x", t ), TYPE::TERM, SourcePos( 2, 1, 1, "twins.rcl" ) ) );
+        }
+        export_graph( file, { { name( view ), { TYPE::TERM }, GRAPH_FORMAT::JSON } } );
+        destroy_graph( file );
+        return read( name( view ) + ".json" );
+    };
+    REQUIRE( twins( false, "twins" ) == twins( true, "reversed_twins" ) );
+
+    //split by entities: every node is written once, edges across the clusters lead to declared nodes:
+    written = export_graph( root, { { name( "entities" ), expressions, GRAPH_FORMAT::JSON } }, GRAPH_SPLIT::PER_ENTITY );
+    REQUIRE( written.size() > 1 );
+    set< int64_t > ids;
+    for ( const auto & file_name : written ) {
+        const auto cluster = Json::parse( read( file_name ) );
+        set< int64_t > declared;
+        for ( const auto & node : cluster[ "nodes" ].items )
+            declared.insert( node[ "id" ].integer() );
+        for ( const auto & node : cluster[ "nodes" ].items ) {
+            for ( const auto & ref : node[ "refs" ].items )
+                REQUIRE( declared.contains( ref.integer() ) );
+            //nodes declared for the edges have no edges of their own:
+            if ( ! node[ "refs" ].items.empty() )
+                REQUIRE( ids.insert( node[ "id" ].integer() ).second );
+        }
+    }
+    destroy_graph( root );
+
+    //split by files:
+    const auto & write = [&]( const string & file_name, const string & content ) {
+        ofstream( dir / file_name ) << content;
+    };
+    write( "main.rcl", "include lib\nr = k * 2\noutputs r\n" );
+    write( "lib.rcl", "k = 7\n" );
+    root = parse_program( name( "main.rcl" ) );
+    written = export_graph( root, { { name( "files" ), semantics, GRAPH_FORMAT::GRAPHML } }, GRAPH_SPLIT::PER_SOURCE_FILE );
+    REQUIRE( written == vector{ name( "files_lib" ) + ".graphml", name( "files_main" ) + ".graphml" } );
+    destroy_graph( root );
+
+    filesystem::remove_all( dir );
+}